@@ -0,0 +1,468 @@
+#pragma once
+
+#include "scene.h"
+
+#include <cglm/cglm.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define BVH_BIN_COUNT 12
+#define BVH_MAX_LEAF_SIZE 4
+#define BVH_MAX_DEPTH 64
+// Keeps leaf bounds conservative against rounding differences between box and primitive tests
+#define BVH_BOUNDS_PADDING 0.0001f
+
+typedef struct
+{
+    vec3 min;
+    vec3 max;
+} aabb_t;
+
+// 32 bytes, so two siblings share a cache line
+typedef struct bvh_node
+{
+    vec3 bounds_min;
+    int first; // index of the left child (the right one follows it) or of the first object index for leaves
+    vec3 bounds_max;
+    int count; // number of objects for leaves, 0 for interior nodes
+} bvh_node_t;
+
+// Structure-of-arrays copy of the bounded objects in leaf order, so a whole leaf can be intersected at once.
+// Streams are padded by BVH_MAX_LEAF_SIZE entries, so reading BVH_MAX_LEAF_SIZE lanes from any leaf stays in bounds.
+typedef struct
+{
+    float *position[3];
+    float *half_size[3];   // cubes
+    float *radius_squared; // spheres
+    int *type;             // -1 for padding
+    float *memory;
+} object_soa_t;
+
+typedef struct
+{
+    bvh_node_t *nodes;
+    int node_count;
+    int *object_indices; // bounded objects in leaf order
+    int object_count;
+    int *unbounded_object_indices; // planes, tested against every ray
+    int unbounded_object_count;
+    object_soa_t soa;
+} bvh_t;
+
+typedef struct
+{
+    bvh_t *bvh;
+    aabb_t *object_bounds;
+    vec3 *object_centroids;
+} bvh_builder_t;
+
+void aabb_empty(aabb_t *aabb)
+{
+    glm_vec3_fill(aabb->min, INFINITY);
+    glm_vec3_fill(aabb->max, -INFINITY);
+}
+
+void aabb_grow(aabb_t *aabb, vec3 min, vec3 max)
+{
+    glm_vec3_minv(aabb->min, min, aabb->min);
+    glm_vec3_maxv(aabb->max, max, aabb->max);
+}
+
+float aabb_half_area(aabb_t *aabb)
+{
+    vec3 extent;
+    glm_vec3_sub(aabb->max, aabb->min, extent);
+    return extent[0] * extent[1] + extent[1] * extent[2] + extent[2] * extent[0];
+}
+
+bool get_object_bounds(object_t *object, aabb_t *bounds_dst)
+{
+    vec3 half_size;
+
+    switch (object->type)
+    {
+    case OBJECT_TYPE_SPHERE:
+        glm_vec3_fill(half_size, object->radius);
+        break;
+    case OBJECT_TYPE_CUBE:
+        glm_vec3_scale(object->size, 0.5f, half_size);
+        break;
+    default:
+        return false;
+    }
+
+    glm_vec3_adds(half_size, BVH_BOUNDS_PADDING, half_size);
+    glm_vec3_sub(object->position, half_size, bounds_dst->min);
+    glm_vec3_add(object->position, half_size, bounds_dst->max);
+    return true;
+}
+
+void bvh_make_leaf(bvh_node_t *node, int first, int count)
+{
+    node->first = first;
+    node->count = count;
+}
+
+// Splits objects [first, first + count) at the middle, used when SAH binning can't separate them
+int bvh_partition_median(bvh_builder_t *builder, int first, int count, int axis)
+{
+    int *indices = &builder->bvh->object_indices[first];
+    vec3 *centroids = builder->object_centroids;
+    int median = count / 2;
+
+    // Quickselect: objects before the median end up with smaller or equal centroids
+    int left = 0, right = count - 1;
+    while (left < right)
+    {
+        float pivot = centroids[indices[(left + right) / 2]][axis];
+        int i = left, j = right;
+        while (i <= j)
+        {
+            while (centroids[indices[i]][axis] < pivot)
+            {
+                i++;
+            }
+            while (centroids[indices[j]][axis] > pivot)
+            {
+                j--;
+            }
+            if (i <= j)
+            {
+                int tmp = indices[i];
+                indices[i] = indices[j];
+                indices[j] = tmp;
+                i++;
+                j--;
+            }
+        }
+
+        if (median <= j)
+        {
+            right = j;
+        }
+        else if (median >= i)
+        {
+            left = i;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    return median;
+}
+
+void bvh_subdivide(bvh_builder_t *builder, int node_index, int first, int count, int depth)
+{
+    bvh_t *bvh = builder->bvh;
+    bvh_node_t *node = &bvh->nodes[node_index];
+
+    aabb_t bounds, centroid_bounds;
+    aabb_empty(&bounds);
+    aabb_empty(&centroid_bounds);
+    for (int i = first; i < first + count; i++)
+    {
+        int index = bvh->object_indices[i];
+        aabb_grow(&bounds, builder->object_bounds[index].min, builder->object_bounds[index].max);
+        aabb_grow(&centroid_bounds, builder->object_centroids[index], builder->object_centroids[index]);
+    }
+    glm_vec3_copy(bounds.min, node->bounds_min);
+    glm_vec3_copy(bounds.max, node->bounds_max);
+
+    if (count == 1)
+    {
+        bvh_make_leaf(node, first, count);
+        return;
+    }
+
+    // Binned SAH: try BVH_BIN_COUNT - 1 split planes along every axis
+    float best_cost = INFINITY;
+    int best_axis = -1;
+    int best_split = 0;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float extent = centroid_bounds.max[axis] - centroid_bounds.min[axis];
+        if (extent <= 0.0f)
+        {
+            continue;
+        }
+
+        struct
+        {
+            aabb_t bounds;
+            int count;
+        } bins[BVH_BIN_COUNT];
+        for (int i = 0; i < BVH_BIN_COUNT; i++)
+        {
+            aabb_empty(&bins[i].bounds);
+            bins[i].count = 0;
+        }
+
+        float scale = BVH_BIN_COUNT / extent;
+        for (int i = first; i < first + count; i++)
+        {
+            int index = bvh->object_indices[i];
+            int bin = glm_min(BVH_BIN_COUNT - 1, (int)((builder->object_centroids[index][axis] - centroid_bounds.min[axis]) * scale));
+            aabb_grow(&bins[bin].bounds, builder->object_bounds[index].min, builder->object_bounds[index].max);
+            bins[bin].count++;
+        }
+
+        float left_areas[BVH_BIN_COUNT - 1];
+        int left_counts[BVH_BIN_COUNT - 1];
+        aabb_t left_bounds;
+        aabb_empty(&left_bounds);
+        int left_count = 0;
+        for (int i = 0; i < BVH_BIN_COUNT - 1; i++)
+        {
+            aabb_grow(&left_bounds, bins[i].bounds.min, bins[i].bounds.max);
+            left_count += bins[i].count;
+            left_areas[i] = left_count > 0 ? aabb_half_area(&left_bounds) : 0.0f;
+            left_counts[i] = left_count;
+        }
+
+        aabb_t right_bounds;
+        aabb_empty(&right_bounds);
+        int right_count = 0;
+        for (int i = BVH_BIN_COUNT - 1; i > 0; i--)
+        {
+            aabb_grow(&right_bounds, bins[i].bounds.min, bins[i].bounds.max);
+            right_count += bins[i].count;
+            if (left_counts[i - 1] == 0 || right_count == 0)
+            {
+                continue;
+            }
+
+            float cost = left_areas[i - 1] * left_counts[i - 1] + aabb_half_area(&right_bounds) * right_count;
+            if (cost < best_cost)
+            {
+                best_cost = cost;
+                best_axis = axis;
+                best_split = i;
+            }
+        }
+    }
+
+    float leaf_cost = aabb_half_area(&bounds) * count;
+    if (count <= BVH_MAX_LEAF_SIZE && best_cost >= leaf_cost)
+    {
+        bvh_make_leaf(node, first, count);
+        return;
+    }
+
+    int left_count = 0;
+    if (best_axis >= 0 && depth < BVH_MAX_DEPTH / 2)
+    {
+        float scale = BVH_BIN_COUNT / (centroid_bounds.max[best_axis] - centroid_bounds.min[best_axis]);
+        int *indices = &bvh->object_indices[first];
+        int i = 0, j = count - 1;
+        while (i <= j)
+        {
+            int bin = glm_min(BVH_BIN_COUNT - 1, (int)((builder->object_centroids[indices[i]][best_axis] - centroid_bounds.min[best_axis]) * scale));
+            if (bin < best_split)
+            {
+                i++;
+            }
+            else
+            {
+                int tmp = indices[i];
+                indices[i] = indices[j];
+                indices[j] = tmp;
+                j--;
+            }
+        }
+        left_count = i;
+    }
+
+    if (left_count == 0 || left_count == count)
+    {
+        // Median splits keep the remaining depth logarithmic
+        int axis = 0;
+        vec3 extent;
+        glm_vec3_sub(centroid_bounds.max, centroid_bounds.min, extent);
+        if (extent[1] > extent[axis])
+        {
+            axis = 1;
+        }
+        if (extent[2] > extent[axis])
+        {
+            axis = 2;
+        }
+        left_count = bvh_partition_median(builder, first, count, axis);
+    }
+
+    int left_index = bvh->node_count;
+    bvh->node_count += 2;
+    node->first = left_index;
+    node->count = 0;
+
+    bvh_subdivide(builder, left_index, first, left_count, depth + 1);
+    bvh_subdivide(builder, left_index + 1, first + left_count, count - left_count, depth + 1);
+}
+
+void object_soa_build(object_soa_t *soa, object_t *objects, int *object_indices, int object_count)
+{
+    int lane_count = object_count + BVH_MAX_LEAF_SIZE;
+    soa->memory = malloc(sizeof(float) * lane_count * 7);
+    soa->type = malloc(sizeof(int) * lane_count);
+    if (soa->memory == NULL || soa->type == NULL)
+    {
+        fprintf(stderr, "Error: failed to allocate BVH\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+        soa->position[i] = &soa->memory[lane_count * i];
+        soa->half_size[i] = &soa->memory[lane_count * (3 + i)];
+    }
+    soa->radius_squared = &soa->memory[lane_count * 6];
+
+    for (int lane = 0; lane < lane_count; lane++)
+    {
+        object_t padding = {.type = -1};
+        object_t *object = lane < object_count ? &objects[object_indices[lane]] : &padding;
+
+        for (int i = 0; i < 3; i++)
+        {
+            soa->position[i][lane] = object->position[i];
+            soa->half_size[i][lane] = object->size[i] / 2.0f;
+        }
+        soa->radius_squared[lane] = object->radius * object->radius;
+        soa->type[lane] = object->type;
+    }
+}
+
+void bvh_destroy(bvh_t *bvh)
+{
+    free(bvh->soa.memory);
+    free(bvh->soa.type);
+    free(bvh->nodes);
+    free(bvh->object_indices);
+    free(bvh->unbounded_object_indices);
+    *bvh = (bvh_t){0};
+}
+
+// Whether nodes and object indices, e.g. from a file, form a tree that traversal can't go astray in: children come after
+// their parent, leaves hold bounded objects and stay within BVH_MAX_LEAF_SIZE and BVH_MAX_DEPTH
+bool bvh_validate(const bvh_node_t *nodes, int node_count, const int *object_indices, int index_count, const object_t *objects, int object_count)
+{
+    for (int i = 0; i < index_count; i++)
+    {
+        aabb_t bounds;
+        if (object_indices[i] < 0 || object_indices[i] >= object_count || !get_object_bounds((object_t *)&objects[object_indices[i]], &bounds))
+        {
+            return false;
+        }
+    }
+
+    if (node_count == 0)
+    {
+        return true;
+    }
+    int *depths = calloc(node_count, sizeof(int));
+    if (depths == NULL)
+    {
+        fprintf(stderr, "Error: failed to allocate BVH\n");
+        exit(EXIT_FAILURE);
+    }
+
+    bool valid = true;
+    for (int i = 0; i < node_count && valid; i++)
+    {
+        const bvh_node_t *node = &nodes[i];
+        if (node->count > 0)
+        {
+            valid = node->count <= BVH_MAX_LEAF_SIZE && node->first >= 0 && node->first <= index_count - node->count;
+        }
+        else
+        {
+            valid = node->first > i && node->first < node_count - 1 && depths[i] < BVH_MAX_DEPTH;
+            if (valid)
+            {
+                // Every parent of a node comes before it, so its depth is final when it is checked
+                depths[node->first] = glm_imax(depths[node->first], depths[i] + 1);
+                depths[node->first + 1] = glm_imax(depths[node->first + 1], depths[i] + 1);
+            }
+        }
+    }
+
+    free(depths);
+    return valid;
+}
+
+// Takes nodes and bounded object indices built before, e.g. stored with the scene, instead of building them
+void bvh_adopt(bvh_t *bvh, object_t *objects, int object_count, const bvh_node_t *nodes, int node_count, const int *object_indices, int index_count)
+{
+    bvh_destroy(bvh);
+
+    bvh->nodes = malloc(sizeof(bvh_node_t) * (node_count + 1));
+    bvh->object_indices = malloc(sizeof(int) * (index_count + 1));
+    bvh->unbounded_object_indices = malloc(sizeof(int) * (object_count + 1));
+    if (bvh->nodes == NULL || bvh->object_indices == NULL || bvh->unbounded_object_indices == NULL)
+    {
+        fprintf(stderr, "Error: failed to allocate BVH\n");
+        exit(EXIT_FAILURE);
+    }
+
+    memcpy(bvh->nodes, nodes, sizeof(bvh_node_t) * node_count);
+    bvh->node_count = node_count;
+    memcpy(bvh->object_indices, object_indices, sizeof(int) * index_count);
+    bvh->object_count = index_count;
+
+    for (int i = 0; i < object_count; i++)
+    {
+        aabb_t bounds;
+        if (!get_object_bounds(&objects[i], &bounds))
+        {
+            bvh->unbounded_object_indices[bvh->unbounded_object_count++] = i;
+        }
+    }
+    object_soa_build(&bvh->soa, objects, bvh->object_indices, bvh->object_count);
+}
+
+void bvh_build(bvh_t *bvh, object_t *objects, int object_count)
+{
+    bvh_destroy(bvh);
+
+    bvh_builder_t builder = {.bvh = bvh};
+    builder.object_bounds = malloc(sizeof(aabb_t) * (object_count + 1));
+    builder.object_centroids = malloc(sizeof(vec3) * (object_count + 1));
+    bvh->object_indices = malloc(sizeof(int) * (object_count + 1));
+    bvh->unbounded_object_indices = malloc(sizeof(int) * (object_count + 1));
+    // A binary tree with one object per leaf at most has 2n - 1 nodes
+    bvh->nodes = malloc(sizeof(bvh_node_t) * (2 * object_count + 1));
+    if (builder.object_bounds == NULL || builder.object_centroids == NULL || bvh->object_indices == NULL ||
+        bvh->unbounded_object_indices == NULL || bvh->nodes == NULL)
+    {
+        fprintf(stderr, "Error: failed to allocate BVH\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < object_count; i++)
+    {
+        if (get_object_bounds(&objects[i], &builder.object_bounds[i]))
+        {
+            glm_vec3_add(builder.object_bounds[i].min, builder.object_bounds[i].max, builder.object_centroids[i]);
+            glm_vec3_scale(builder.object_centroids[i], 0.5f, builder.object_centroids[i]);
+            bvh->object_indices[bvh->object_count++] = i;
+        }
+        else
+        {
+            bvh->unbounded_object_indices[bvh->unbounded_object_count++] = i;
+        }
+    }
+
+    if (bvh->object_count > 0)
+    {
+        bvh->node_count = 1;
+        bvh_subdivide(&builder, 0, 0, bvh->object_count, 0);
+    }
+    object_soa_build(&bvh->soa, objects, bvh->object_indices, bvh->object_count);
+
+    free(builder.object_bounds);
+    free(builder.object_centroids);
+}
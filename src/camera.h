@@ -2,6 +2,9 @@
 
 #include <cglm/cglm.h>
 
+#define Z_NEAR 0.1f
+#define Z_FAR 100.0f
+
 typedef struct
 {
     vec3 position;
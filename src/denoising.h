@@ -0,0 +1,384 @@
+#pragma once
+
+#include "imaging.h"
+#include "thread-pool.h"
+
+#include <cglm/cglm.h>
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(DENOISING_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+#define DENOISING_SIMD
+#include <emmintrin.h>
+#endif
+
+// Edge-avoiding a-trous wavelet filter (Dammertz et al.) with the edge-stopping functions of SVGF (Schied et al.). The ray
+// tracer's accumulation and reprojection already stand in for SVGF's temporal stage, so only the spatial filter runs here.
+// Irradiance is filtered with the albedo divided out, so textures and object colors stay sharp while their lighting blurs.
+#define DENOISING_ITERATION_COUNT 5 // 3x3 taps 1, 2, 4, 8 and 16 pixels apart, together a kernel 63 pixels wide
+#define DENOISING_PADDING 16        // invalid columns on both sides of every row, as wide as the farthest tap
+#define DENOISING_ROWS_PER_JOB 8
+#define DENOISING_PLANE_SIGMA 0.01f    // distance of a neighbour from the pixel's tangent plane, relative to the pixel's depth
+#define DENOISING_NORMAL_SQUARINGS 7   // the normal weight is the cosine between the normals to the power of 2^7 = 128
+// Neighbours whose normal weight or whose other weights are below about 2^-16 get no weight at all. This skips negligible
+// contributions and keeps the squared weights of the variance far from denormal numbers, which are slow on most processors.
+#define DENOISING_MIN_COSINE 0.92f
+#define DENOISING_MAX_EXPONENT 16.0f
+#define DENOISING_MIN_WEIGHT_SUM 1e-6f // far below the weight of a pixel's own tap, so only invalid pixels' sums are raised to it
+#define DENOISING_LUMINANCE_SIGMA 4.0f // luminance difference in standard deviations of the pixel's estimate
+#define DENOISING_MIN_DEVIATION 0.002f // keeps converged pixels from rejecting neighbours that differ by rounding
+#define DENOISING_MIN_ALBEDO 0.01f     // albedo channels are clamped to it, so dark materials don't amplify noise
+
+typedef enum
+{
+    DENOISING_CHANNEL_RED,
+    DENOISING_CHANNEL_GREEN,
+    DENOISING_CHANNEL_BLUE,
+    DENOISING_CHANNEL_VARIANCE, // of the luminance of the irradiance estimate
+    DENOISING_CHANNEL_COUNT
+} denoising_channel_t;
+
+// Planes of one float per pixel, rows are stride floats apart and start DENOISING_PADDING floats into the allocation.
+// Pixels without a guide have a zero normal, which gives them no weight, so the padding needs no bounds checks.
+typedef struct
+{
+    int width;
+    int height;
+    int stride;
+    float *memory;
+
+    // Written by the ray tracer: the demodulated irradiance of every pixel and the guide of the primary hits
+    float *input[DENOISING_CHANNEL_COUNT];
+    float *albedo[3];
+    float *position[3];
+    float *normal[3];
+    float *plane_scale; // inverse of the tangent plane distance that halves a neighbour's weight, scaled by log2(e)
+
+    float *filtered[2][DENOISING_CHANNEL_COUNT]; // ping-pong buffers of the iterations
+    int output;                                  // filtered buffer holding the last iteration
+} denoiser_t;
+
+// One iteration of the filter
+typedef struct
+{
+    denoiser_t *denoiser;
+    float **source;
+    float **destination;
+    int step;
+} denoising_pass_t;
+
+static const float denoising_kernel[3] = {1.0f / 4.0f, 1.0f / 2.0f, 1.0f / 4.0f};
+
+void denoiser_destroy(denoiser_t *denoiser)
+{
+    free(denoiser->memory);
+    *denoiser = (denoiser_t){0};
+}
+
+// Clears every plane, so no pixel has a guide until the ray tracer sets it
+void denoiser_resize(denoiser_t *denoiser, int width, int height)
+{
+    denoiser_destroy(denoiser);
+
+    int plane_count = DENOISING_CHANNEL_COUNT + 3 + 3 + 3 + 1 + 2 * DENOISING_CHANNEL_COUNT;
+    int stride = DENOISING_PADDING + (width + 3) / 4 * 4 + DENOISING_PADDING;
+    size_t plane_size = (size_t)stride * height;
+    denoiser->memory = calloc(plane_size * plane_count, sizeof(float));
+    if (denoiser->memory == NULL && plane_size > 0)
+    {
+        fprintf(stderr, "Error: failed to allocate %dx%d denoiser\n", width, height);
+        exit(EXIT_FAILURE);
+    }
+    denoiser->width = width;
+    denoiser->height = height;
+    denoiser->stride = stride;
+
+    float *plane = denoiser->memory + DENOISING_PADDING;
+    for (int i = 0; i < DENOISING_CHANNEL_COUNT; i++, plane += plane_size)
+    {
+        denoiser->input[i] = plane;
+    }
+    for (int i = 0; i < 3; i++, plane += plane_size)
+    {
+        denoiser->albedo[i] = plane;
+    }
+    for (int i = 0; i < 3; i++, plane += plane_size)
+    {
+        denoiser->position[i] = plane;
+    }
+    for (int i = 0; i < 3; i++, plane += plane_size)
+    {
+        denoiser->normal[i] = plane;
+    }
+    denoiser->plane_scale = plane;
+    plane += plane_size;
+    for (int i = 0; i < 2; i++)
+    {
+        for (int j = 0; j < DENOISING_CHANNEL_COUNT; j++, plane += plane_size)
+        {
+            denoiser->filtered[i][j] = plane;
+        }
+    }
+}
+
+// Radiance of a pixel, demodulated by the albedo of its primary hit. variance is that of the radiance's luminance.
+void denoiser_set_input(denoiser_t *denoiser, int x, int y, vec3 radiance, vec3 albedo, float variance)
+{
+    size_t index = (size_t)y * denoiser->stride + x;
+    vec3 clamped_albedo;
+    for (int i = 0; i < 3; i++)
+    {
+        clamped_albedo[i] = glm_max(albedo[i], DENOISING_MIN_ALBEDO);
+        denoiser->albedo[i][index] = clamped_albedo[i];
+        denoiser->input[i][index] = radiance[i] / clamped_albedo[i];
+    }
+    float albedo_luminance = luminance(clamped_albedo);
+    denoiser->input[DENOISING_CHANNEL_VARIANCE][index] = variance / (albedo_luminance * albedo_luminance);
+}
+
+// Primary hit of a pixel whose input is current, normal must be normalized
+void denoiser_set_guide(denoiser_t *denoiser, int x, int y, vec3 position, vec3 normal, float depth)
+{
+    size_t index = (size_t)y * denoiser->stride + x;
+    for (int i = 0; i < 3; i++)
+    {
+        denoiser->position[i][index] = position[i];
+        denoiser->normal[i][index] = normal[i];
+    }
+    denoiser->plane_scale[index] = (float)GLM_LOG2E / (DENOISING_PLANE_SIGMA * depth);
+}
+
+// Excludes a pixel from the filter, it neither takes nor gives any weight
+void denoiser_clear_guide(denoiser_t *denoiser, int x, int y)
+{
+    size_t index = (size_t)y * denoiser->stride + x;
+    for (int i = 0; i < 3; i++)
+    {
+        denoiser->normal[i][index] = 0.0f;
+    }
+    denoiser->plane_scale[index] = 0.0f;
+}
+
+// Filtered radiance of a pixel with a guide, the albedo multiplied back in
+void denoiser_get_output(denoiser_t *denoiser, int x, int y, vec3 radiance_dst)
+{
+    size_t index = (size_t)y * denoiser->stride + x;
+    for (int i = 0; i < 3; i++)
+    {
+        radiance_dst[i] = denoiser->filtered[denoiser->output][i][index] * denoiser->albedo[i][index];
+    }
+}
+
+// 2^x for -DENOISING_MAX_EXPONENT <= x <= 0 from the integer part in the exponent bits and a polynomial for the fraction, about 1e-5 relative error.
+// The SIMD version performs the same operations, so both paths filter to identical images.
+static inline float denoising_exp2(float x)
+{
+    x = glm_max(x, -DENOISING_MAX_EXPONENT);
+    float whole = floorf(x);
+    float fraction = x - whole;
+    float polynomial = 1.0f + fraction * (0.6931472f + fraction * (0.2402265f + fraction * (0.0555041f + fraction * 0.0096181f)));
+    union
+    {
+        uint32_t bits;
+        float value;
+    } scale = {.bits = (uint32_t)((int)whole + 127) << 23};
+    return polynomial * scale.value;
+}
+
+#ifdef DENOISING_SIMD
+static inline __m128 denoising_exp2_4(__m128 x)
+{
+    x = _mm_max_ps(x, _mm_set1_ps(-DENOISING_MAX_EXPONENT));
+    // Truncation rounds negative numbers up, floor is one less unless they were whole already
+    __m128i truncated = _mm_cvttps_epi32(x);
+    __m128i whole = _mm_add_epi32(truncated, _mm_castps_si128(_mm_cmplt_ps(x, _mm_cvtepi32_ps(truncated))));
+    __m128 fraction = _mm_sub_ps(x, _mm_cvtepi32_ps(whole));
+    __m128 polynomial = _mm_add_ps(_mm_mul_ps(fraction, _mm_set1_ps(0.0096181f)), _mm_set1_ps(0.0555041f));
+    polynomial = _mm_add_ps(_mm_mul_ps(fraction, polynomial), _mm_set1_ps(0.2402265f));
+    polynomial = _mm_add_ps(_mm_mul_ps(fraction, polynomial), _mm_set1_ps(0.6931472f));
+    polynomial = _mm_add_ps(_mm_mul_ps(fraction, polynomial), _mm_set1_ps(1.0f));
+    __m128 scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(whole, _mm_set1_epi32(127)), 23));
+    return _mm_mul_ps(polynomial, scale);
+}
+#endif
+
+// Filters the rows of one job. Every neighbour's weight is a 3x3 binomial kernel times how well its normal, its distance from
+// the pixel's tangent plane and its luminance agree with the pixel, the luminance tolerance following the pixel's noise.
+// Variance is filtered with the squared weights, so the tolerance shrinks as the iterations average samples.
+void denoise_rows(void *context, int worker_index, int job_index)
+{
+    denoising_pass_t *pass = (denoising_pass_t *)context;
+    denoiser_t *denoiser = pass->denoiser;
+    float **source = pass->source;
+    float **destination = pass->destination;
+    int stride = denoiser->stride;
+    int step = pass->step;
+
+    int y_end = glm_min((job_index + 1) * DENOISING_ROWS_PER_JOB, denoiser->height);
+    for (int y = job_index * DENOISING_ROWS_PER_JOB; y < y_end; y++)
+    {
+#ifdef DENOISING_SIMD
+        // Four pixels of a row at a time, the last group reaches into the padding and only filters invalid pixels there
+        for (int x = 0; x < denoiser->width; x += 4)
+        {
+            size_t index = (size_t)y * stride + x;
+            __m128 position[3], normal[3], color[3];
+            for (int i = 0; i < 3; i++)
+            {
+                position[i] = _mm_loadu_ps(&denoiser->position[i][index]);
+                normal[i] = _mm_loadu_ps(&denoiser->normal[i][index]);
+                color[i] = _mm_loadu_ps(&source[i][index]);
+            }
+            __m128 plane_scale = _mm_loadu_ps(&denoiser->plane_scale[index]);
+            __m128 pixel_luminance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(0.2126f), color[0]), _mm_mul_ps(_mm_set1_ps(0.7152f), color[1])), _mm_mul_ps(_mm_set1_ps(0.0722f), color[2]));
+            __m128 deviation = _mm_sqrt_ps(_mm_loadu_ps(&source[DENOISING_CHANNEL_VARIANCE][index]));
+            __m128 luminance_scale = _mm_div_ps(_mm_set1_ps((float)GLM_LOG2E), _mm_add_ps(_mm_mul_ps(_mm_set1_ps(DENOISING_LUMINANCE_SIGMA), deviation), _mm_set1_ps(DENOISING_MIN_DEVIATION)));
+
+            __m128 weight_sum = _mm_setzero_ps();
+            __m128 color_sum[3] = {_mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps()};
+            __m128 variance_sum = _mm_setzero_ps();
+            for (int dy = -1; dy <= 1; dy++)
+            {
+                int neighbour_y = y + dy * step;
+                if (neighbour_y < 0 || neighbour_y >= denoiser->height)
+                {
+                    continue;
+                }
+
+                for (int dx = -1; dx <= 1; dx++)
+                {
+                    size_t neighbour_index = (size_t)neighbour_y * stride + x + dx * step;
+                    __m128 neighbour_color[3];
+                    __m128 plane_distance = _mm_setzero_ps();
+                    __m128 cosine = _mm_setzero_ps();
+                    for (int i = 0; i < 3; i++)
+                    {
+                        neighbour_color[i] = _mm_loadu_ps(&source[i][neighbour_index]);
+                        __m128 offset = _mm_sub_ps(_mm_loadu_ps(&denoiser->position[i][neighbour_index]), position[i]);
+                        plane_distance = _mm_add_ps(plane_distance, _mm_mul_ps(normal[i], offset));
+                        cosine = _mm_add_ps(cosine, _mm_mul_ps(normal[i], _mm_loadu_ps(&denoiser->normal[i][neighbour_index])));
+                    }
+                    __m128 neighbour_luminance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(0.2126f), neighbour_color[0]), _mm_mul_ps(_mm_set1_ps(0.7152f), neighbour_color[1])), _mm_mul_ps(_mm_set1_ps(0.0722f), neighbour_color[2]));
+
+                    __m128 absolute_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+                    __m128 exponent = _mm_add_ps(
+                        _mm_mul_ps(_mm_and_ps(plane_distance, absolute_mask), plane_scale),
+                        _mm_mul_ps(_mm_and_ps(_mm_sub_ps(pixel_luminance, neighbour_luminance), absolute_mask), luminance_scale));
+                    __m128 normal_weight = _mm_max_ps(cosine, _mm_set1_ps(DENOISING_MIN_COSINE));
+                    for (int i = 0; i < DENOISING_NORMAL_SQUARINGS; i++)
+                    {
+                        normal_weight = _mm_mul_ps(normal_weight, normal_weight);
+                    }
+                    __m128 weight = _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(denoising_kernel[dy + 1] * denoising_kernel[dx + 1]), normal_weight),
+                                               denoising_exp2_4(_mm_sub_ps(_mm_setzero_ps(), exponent)));
+                    __m128 significant = _mm_and_ps(_mm_cmpgt_ps(cosine, _mm_set1_ps(DENOISING_MIN_COSINE)), _mm_cmplt_ps(exponent, _mm_set1_ps(DENOISING_MAX_EXPONENT)));
+                    weight = _mm_and_ps(significant, weight);
+
+                    weight_sum = _mm_add_ps(weight_sum, weight);
+                    for (int i = 0; i < 3; i++)
+                    {
+                        color_sum[i] = _mm_add_ps(color_sum[i], _mm_mul_ps(weight, neighbour_color[i]));
+                    }
+                    variance_sum = _mm_add_ps(variance_sum, _mm_mul_ps(_mm_mul_ps(weight, weight), _mm_loadu_ps(&source[DENOISING_CHANNEL_VARIANCE][neighbour_index])));
+                }
+            }
+
+            // Invalid pixels have no weight at all, their sums are zero and so are their results
+            __m128 weight_sum_safe = _mm_max_ps(weight_sum, _mm_set1_ps(DENOISING_MIN_WEIGHT_SUM));
+            for (int i = 0; i < 3; i++)
+            {
+                _mm_storeu_ps(&destination[i][index], _mm_div_ps(color_sum[i], weight_sum_safe));
+            }
+            _mm_storeu_ps(&destination[DENOISING_CHANNEL_VARIANCE][index], _mm_div_ps(variance_sum, _mm_mul_ps(weight_sum_safe, weight_sum_safe)));
+        }
+#else
+        for (int x = 0; x < denoiser->width; x++)
+        {
+            size_t index = (size_t)y * stride + x;
+            vec3 position, normal, color;
+            for (int i = 0; i < 3; i++)
+            {
+                position[i] = denoiser->position[i][index];
+                normal[i] = denoiser->normal[i][index];
+                color[i] = source[i][index];
+            }
+            float plane_scale = denoiser->plane_scale[index];
+            float pixel_luminance = 0.2126f * color[0] + 0.7152f * color[1] + 0.0722f * color[2];
+            float deviation = sqrtf(source[DENOISING_CHANNEL_VARIANCE][index]);
+            float luminance_scale = (float)GLM_LOG2E / (DENOISING_LUMINANCE_SIGMA * deviation + DENOISING_MIN_DEVIATION);
+
+            float weight_sum = 0.0f;
+            vec3 color_sum = {0.0f, 0.0f, 0.0f};
+            float variance_sum = 0.0f;
+            for (int dy = -1; dy <= 1; dy++)
+            {
+                int neighbour_y = y + dy * step;
+                if (neighbour_y < 0 || neighbour_y >= denoiser->height)
+                {
+                    continue;
+                }
+
+                for (int dx = -1; dx <= 1; dx++)
+                {
+                    size_t neighbour_index = (size_t)neighbour_y * stride + x + dx * step;
+                    vec3 neighbour_color;
+                    float plane_distance = 0.0f;
+                    float cosine = 0.0f;
+                    for (int i = 0; i < 3; i++)
+                    {
+                        neighbour_color[i] = source[i][neighbour_index];
+                        plane_distance += normal[i] * (denoiser->position[i][neighbour_index] - position[i]);
+                        cosine += normal[i] * denoiser->normal[i][neighbour_index];
+                    }
+                    float neighbour_luminance = 0.2126f * neighbour_color[0] + 0.7152f * neighbour_color[1] + 0.0722f * neighbour_color[2];
+
+                    float exponent = fabsf(plane_distance) * plane_scale + fabsf(pixel_luminance - neighbour_luminance) * luminance_scale;
+                    if (cosine <= DENOISING_MIN_COSINE || exponent >= DENOISING_MAX_EXPONENT)
+                    {
+                        continue;
+                    }
+                    float normal_weight = cosine;
+                    for (int i = 0; i < DENOISING_NORMAL_SQUARINGS; i++)
+                    {
+                        normal_weight *= normal_weight;
+                    }
+                    float weight = denoising_kernel[dy + 1] * denoising_kernel[dx + 1] * normal_weight * denoising_exp2(0.0f - exponent);
+
+                    weight_sum += weight;
+                    for (int i = 0; i < 3; i++)
+                    {
+                        color_sum[i] += weight * neighbour_color[i];
+                    }
+                    variance_sum += weight * weight * source[DENOISING_CHANNEL_VARIANCE][neighbour_index];
+                }
+            }
+
+            // Invalid pixels have no weight at all, their sums are zero and so are their results
+            float weight_sum_safe = glm_max(weight_sum, DENOISING_MIN_WEIGHT_SUM);
+            for (int i = 0; i < 3; i++)
+            {
+                destination[i][index] = color_sum[i] / weight_sum_safe;
+            }
+            destination[DENOISING_CHANNEL_VARIANCE][index] = variance_sum / (weight_sum_safe * weight_sum_safe);
+        }
+#endif
+    }
+}
+
+// Filters the input with DENOISING_ITERATION_COUNT iterations of growing step, one parallel pass over the rows each
+void denoiser_run(denoiser_t *denoiser, thread_pool_t *thread_pool)
+{
+    int job_count = (denoiser->height + DENOISING_ROWS_PER_JOB - 1) / DENOISING_ROWS_PER_JOB;
+    float **source = denoiser->input;
+    for (int i = 0; i < DENOISING_ITERATION_COUNT; i++)
+    {
+        denoising_pass_t pass = {.denoiser = denoiser, .source = source, .destination = denoiser->filtered[i % 2], .step = 1 << i};
+        thread_pool_run(thread_pool, job_count, denoise_rows, &pass);
+        source = denoiser->filtered[i % 2];
+        denoiser->output = i % 2;
+    }
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include "scene.h"
+
+#include <cglm/cglm.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#if !defined(FRUSTUM_CULLING_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+#define FRUSTUM_CULLING_SIMD
+#include <emmintrin.h>
+#endif
+
+// Left, right, bottom, top, near and far planes, points inside have dot(plane.xyz, point) + plane.w >= 0
+typedef struct
+{
+    vec4 planes[6];
+} frustum_t;
+
+// Bounding spheres in SoA layout, padded to a multiple of 4 so they can be tested 4 at a time
+typedef struct
+{
+    float *center_x;
+    float *center_y;
+    float *center_z;
+    float *radius;
+    int count;
+    int capacity;
+} bounding_spheres_t;
+
+// Planes of the clip space cube in world space (Gribb and Hartmann 2001)
+void frustum_from_matrix(mat4 projection_view, frustum_t *frustum_dst)
+{
+    for (int i = 0; i < 6; i++)
+    {
+        int row = i / 2;
+        float sign = i % 2 == 0 ? 1.0f : -1.0f;
+        vec4 plane;
+        for (int column = 0; column < 4; column++)
+        {
+            plane[column] = projection_view[column][3] + sign * projection_view[column][row];
+        }
+        glm_vec4_scale(plane, 1.0f / glm_vec3_norm(plane), frustum_dst->planes[i]);
+    }
+}
+
+// Planes are unbounded and always pass
+void get_object_bounding_sphere(object_t *object, vec3 center_dst, float *radius_dst)
+{
+    glm_vec3_copy(object->position, center_dst);
+    switch (object->type)
+    {
+    case OBJECT_TYPE_SPHERE:
+        *radius_dst = object->radius;
+        break;
+    case OBJECT_TYPE_CUBE:
+        *radius_dst = 0.5f * glm_vec3_norm(object->size);
+        break;
+    case OBJECT_TYPE_PLANE:
+        *radius_dst = INFINITY;
+        break;
+    default:
+        fprintf(stderr, "Error: unknown object type %d\n", object->type);
+        exit(EXIT_FAILURE);
+    }
+}
+
+void bounding_spheres_destroy(bounding_spheres_t *spheres)
+{
+    free(spheres->center_x);
+    free(spheres->center_y);
+    free(spheres->center_z);
+    free(spheres->radius);
+    *spheres = (bounding_spheres_t){0};
+}
+
+void bounding_spheres_build(bounding_spheres_t *spheres, object_t *objects, int object_count)
+{
+    int padded_count = (object_count + 3) & ~3;
+    if (spheres->capacity < padded_count)
+    {
+        spheres->center_x = (float *)realloc(spheres->center_x, padded_count * sizeof(float));
+        spheres->center_y = (float *)realloc(spheres->center_y, padded_count * sizeof(float));
+        spheres->center_z = (float *)realloc(spheres->center_z, padded_count * sizeof(float));
+        spheres->radius = (float *)realloc(spheres->radius, padded_count * sizeof(float));
+        if (spheres->center_x == NULL || spheres->center_y == NULL || spheres->center_z == NULL || spheres->radius == NULL)
+        {
+            fprintf(stderr, "Error: failed to allocate bounding spheres\n");
+            exit(EXIT_FAILURE);
+        }
+        spheres->capacity = padded_count;
+    }
+
+    for (int i = 0; i < padded_count; i++)
+    {
+        vec3 center = {0.0f, 0.0f, 0.0f};
+        float radius = 0.0f;
+        if (i < object_count)
+        {
+            get_object_bounding_sphere(&objects[i], center, &radius);
+        }
+        spheres->center_x[i] = center[0];
+        spheres->center_y[i] = center[1];
+        spheres->center_z[i] = center[2];
+        spheres->radius[i] = radius;
+    }
+    spheres->count = object_count;
+}
+
+// Conservative: spheres outside a single plane are culled, those near a frustum corner may pass. Returns the visible count.
+int frustum_cull(frustum_t *frustum, bounding_spheres_t *spheres, bool *visible_dst)
+{
+    int visible_count = 0;
+#ifdef FRUSTUM_CULLING_SIMD
+    for (int first = 0; first < spheres->count; first += 4)
+    {
+        __m128 center_x = _mm_loadu_ps(&spheres->center_x[first]);
+        __m128 center_y = _mm_loadu_ps(&spheres->center_y[first]);
+        __m128 center_z = _mm_loadu_ps(&spheres->center_z[first]);
+        __m128 radius_negative = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&spheres->radius[first]));
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (int i = 0; i < 6; i++)
+        {
+            float *plane = frustum->planes[i];
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(center_x, _mm_set1_ps(plane[0])), _mm_mul_ps(center_y, _mm_set1_ps(plane[1]))),
+                                         _mm_add_ps(_mm_mul_ps(center_z, _mm_set1_ps(plane[2])), _mm_set1_ps(plane[3])));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, radius_negative));
+        }
+
+        int mask = _mm_movemask_ps(inside);
+        int lane_count = spheres->count - first < 4 ? spheres->count - first : 4;
+        for (int lane = 0; lane < lane_count; lane++)
+        {
+            visible_dst[first + lane] = (mask >> lane) & 1;
+            visible_count += visible_dst[first + lane];
+        }
+    }
+#else
+    for (int i = 0; i < spheres->count; i++)
+    {
+        vec3 center = {spheres->center_x[i], spheres->center_y[i], spheres->center_z[i]};
+        visible_dst[i] = true;
+        for (int j = 0; j < 6; j++)
+        {
+            if (glm_vec3_dot(frustum->planes[j], center) + frustum->planes[j][3] < -spheres->radius[i])
+            {
+                visible_dst[i] = false;
+                break;
+            }
+        }
+        visible_count += visible_dst[i];
+    }
+#endif
+    return visible_count;
+}
@@ -2,6 +2,21 @@
 
 #define GLFW_INCLUDE_NONE
 #include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Entry points newer than OpenGL 3.3, loaded at runtime when the context has them
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+typedef void(APIENTRYP gl_tex_storage_2d_proc_t)(GLenum target, GLsizei levels, GLenum internal_format, GLsizei width, GLsizei height);
+typedef void(APIENTRYP gl_buffer_storage_proc_t)(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
 
 GLuint create_shader_program(const char *vertex_shader_source, const char *fragment_shader_source)
 {
@@ -50,4 +65,27 @@ GLuint create_shader_program(const char *vertex_shader_source, const char *fragm
     glDeleteShader(fragment_shader);
 
     return shader_program;
-}
\ No newline at end of file
+}
+
+// Whether the current context is at least OpenGL major.minor or supports the named extension
+bool has_gl_feature(int major, int minor, const char *extension)
+{
+    GLint context_major, context_minor;
+    glGetIntegerv(GL_MAJOR_VERSION, &context_major);
+    glGetIntegerv(GL_MINOR_VERSION, &context_minor);
+    if (context_major > major || (context_major == major && context_minor >= minor))
+    {
+        return true;
+    }
+
+    GLint extension_count;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &extension_count);
+    for (GLint i = 0; i < extension_count; i++)
+    {
+        if (strcmp((const char *)glGetStringi(GL_EXTENSIONS, i), extension) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <cglm/cglm.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
 
 void generate_test_image(unsigned char *image, int width, int height)
 {
@@ -17,9 +20,82 @@ void generate_test_image(unsigned char *image, int width, int height)
     }
 }
 
-void set_pixel(unsigned char *image, int x, int y, vec3 color)
+// RGB image with 8 bits per channel, rows are stored bottom-up like OpenGL textures
+typedef struct
 {
-    image[(y * 640 + x) * 3 + 0] = 255 * glm_clamp(color[0], 0.0f, 1.0f);
-    image[(y * 640 + x) * 3 + 1] = 255 * glm_clamp(color[1], 0.0f, 1.0f);
-    image[(y * 640 + x) * 3 + 2] = 255 * glm_clamp(color[2], 0.0f, 1.0f);
+    int width;
+    int height;
+    unsigned char *pixels;
+} framebuffer_t;
+
+// Returns true if the pixels were reallocated, their contents are undefined then
+bool framebuffer_resize(framebuffer_t *framebuffer, int width, int height)
+{
+    if (framebuffer->pixels != NULL && framebuffer->width == width && framebuffer->height == height)
+    {
+        return false;
+    }
+
+    free(framebuffer->pixels);
+    framebuffer->pixels = malloc((size_t)width * height * 3);
+    if (framebuffer->pixels == NULL)
+    {
+        fprintf(stderr, "Error: failed to allocate %dx%d framebuffer\n", width, height);
+        exit(EXIT_FAILURE);
+    }
+    framebuffer->width = width;
+    framebuffer->height = height;
+    return true;
+}
+
+void framebuffer_destroy(framebuffer_t *framebuffer)
+{
+    free(framebuffer->pixels);
+    *framebuffer = (framebuffer_t){0};
+}
+
+// Relative luminance of a linear RGB color (Rec. 709 weights)
+float luminance(vec3 color)
+{
+    return 0.2126f * color[0] + 0.7152f * color[1] + 0.0722f * color[2];
+}
+
+void set_pixel(framebuffer_t *framebuffer, int x, int y, vec3 color)
+{
+    unsigned char *pixel = &framebuffer->pixels[((size_t)y * framebuffer->width + x) * 3];
+    pixel[0] = 255 * glm_clamp(color[0], 0.0f, 1.0f);
+    pixel[1] = 255 * glm_clamp(color[1], 0.0f, 1.0f);
+    pixel[2] = 255 * glm_clamp(color[2], 0.0f, 1.0f);
+}
+
+void copy_pixel(framebuffer_t *framebuffer, int x, int y, int x_dst, int y_dst)
+{
+    unsigned char *pixel = &framebuffer->pixels[((size_t)y * framebuffer->width + x) * 3];
+    unsigned char *pixel_dst = &framebuffer->pixels[((size_t)y_dst * framebuffer->width + x_dst) * 3];
+    pixel_dst[0] = pixel[0];
+    pixel_dst[1] = pixel[1];
+    pixel_dst[2] = pixel[2];
+}
+
+bool write_ppm(const char *path, framebuffer_t *framebuffer)
+{
+    int width = framebuffer->width, height = framebuffer->height;
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+
+    // Images are stored bottom-up like OpenGL textures, PPM rows go top-down
+    bool success = true;
+    size_t row_size = (size_t)width * 3;
+    for (int y = height - 1; y >= 0 && success; y--)
+    {
+        success = fwrite(&framebuffer->pixels[y * row_size], 1, row_size, file) == row_size;
+    }
+
+    return fclose(file) == 0 && success;
 }
@@ -0,0 +1,183 @@
+#pragma once
+
+#include "sampling.h"
+
+#include <cglm/cglm.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+// World-space hash grid of the diffuse light leaving bounce hits. A cell is a small cube of one object's surface with
+// normals in one direction bucket, it averages the diffuse radiance of its samples, which already includes every light's
+// shadow. Bounce hits in a settled cell take that average instead of tracing shadow rays and shading the lights, but a
+// fraction of them is still traced and added, so cells keep converging as the image does. Cells have one fixed size and
+// diffuse light doesn't depend on the direction it is seen from, so cells outlive camera moves and are only cleared when
+// objects or lights change; when the table is full, the least recently used cell of a bucket is replaced.
+//
+// Not a speedup yet: every bounce hit takes a bucket lock, and in the demo scene the cache saves 17% of the rays but only
+// about 2% of the time, the bounce rays themselves and sampling dominate. It also averages light over a cell and drops
+// the bounce hits' specular light, which raises the RMSE against a reference at 64 spp from 0.935 to 0.966. That's why the
+// ray tracer only uses it when irradiance_caching is set.
+#define IRRADIANCE_CACHE_CELL_SIZE 0.1f
+#define IRRADIANCE_CACHE_NORMAL_RESOLUTION 8        // octahedral normal buckets per axis
+#define IRRADIANCE_CACHE_SAMPLE_COUNT 16            // samples a cell takes before it is used instead of shading
+#define IRRADIANCE_CACHE_MAX_SAMPLE_COUNT 4096      // then the samples are halved, like a pixel's shadow samples
+#define IRRADIANCE_CACHE_REFRESH_PROBABILITY 0.125f // of a hit in a settled cell being traced and added anyway
+#define IRRADIANCE_CACHE_WAYS 8                     // cells per bucket, a key can only live in its bucket
+#define IRRADIANCE_CACHE_MEMORY (4 << 20)           // bytes of cells
+#define IRRADIANCE_CACHE_LOCK_COUNT 256             // buckets share locks by index, so threads rarely wait for each other
+
+typedef struct
+{
+    uint64_t key; // 0 for empty cells
+    uint32_t last_used;
+    uint32_t sample_count;
+    vec3 radiance_sum;
+} irradiance_cache_cell_t;
+
+typedef struct
+{
+    irradiance_cache_cell_t *cells;
+    int bucket_count; // a power of two
+    mtx_t locks[IRRADIANCE_CACHE_LOCK_COUNT];
+    uint32_t clock; // advanced once per rendered image, cells remember when they were last used
+} irradiance_cache_t;
+
+void irradiance_cache_create(irradiance_cache_t *cache)
+{
+    cache->bucket_count = 1;
+    while ((size_t)cache->bucket_count * 2 * IRRADIANCE_CACHE_WAYS * sizeof(irradiance_cache_cell_t) <= IRRADIANCE_CACHE_MEMORY)
+    {
+        cache->bucket_count *= 2;
+    }
+    cache->cells = calloc((size_t)cache->bucket_count * IRRADIANCE_CACHE_WAYS, sizeof(irradiance_cache_cell_t));
+    if (cache->cells == NULL)
+    {
+        fprintf(stderr, "Error: failed to allocate irradiance cache\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < IRRADIANCE_CACHE_LOCK_COUNT; i++)
+    {
+        mtx_init(&cache->locks[i], mtx_plain);
+    }
+    cache->clock = 0;
+}
+
+void irradiance_cache_destroy(irradiance_cache_t *cache)
+{
+    for (int i = 0; i < IRRADIANCE_CACHE_LOCK_COUNT; i++)
+    {
+        mtx_destroy(&cache->locks[i]);
+    }
+    free(cache->cells);
+    cache->cells = NULL;
+    cache->bucket_count = 0;
+}
+
+// No thread may use the cache meanwhile
+void irradiance_cache_clear(irradiance_cache_t *cache)
+{
+    memset(cache->cells, 0, (size_t)cache->bucket_count * IRRADIANCE_CACHE_WAYS * sizeof(irradiance_cache_cell_t));
+}
+
+// Key of the cell containing a surface point, never 0. Two independent 32-bit hashes make collisions negligible.
+uint64_t irradiance_cache_get_key(vec3 position, vec3 normal, int object_index)
+{
+    // Octahedral mapping of the normal to the unit square
+    float l1_norm = fabsf(normal[0]) + fabsf(normal[1]) + fabsf(normal[2]);
+    float u = normal[0] / l1_norm, v = normal[1] / l1_norm;
+    if (normal[2] < 0.0f)
+    {
+        float folded_u = (1.0f - fabsf(v)) * (u >= 0.0f ? 1.0f : -1.0f);
+        v = (1.0f - fabsf(u)) * (v >= 0.0f ? 1.0f : -1.0f);
+        u = folded_u;
+    }
+    int normal_u = glm_clamp((int)((u * 0.5f + 0.5f) * IRRADIANCE_CACHE_NORMAL_RESOLUTION), 0, IRRADIANCE_CACHE_NORMAL_RESOLUTION - 1);
+    int normal_v = glm_clamp((int)((v * 0.5f + 0.5f) * IRRADIANCE_CACHE_NORMAL_RESOLUTION), 0, IRRADIANCE_CACHE_NORMAL_RESOLUTION - 1);
+
+    uint32_t values[5] = {
+        (uint32_t)(int32_t)floorf(position[0] / IRRADIANCE_CACHE_CELL_SIZE),
+        (uint32_t)(int32_t)floorf(position[1] / IRRADIANCE_CACHE_CELL_SIZE),
+        (uint32_t)(int32_t)floorf(position[2] / IRRADIANCE_CACHE_CELL_SIZE),
+        (uint32_t)(normal_v * IRRADIANCE_CACHE_NORMAL_RESOLUTION + normal_u),
+        (uint32_t)object_index};
+    uint32_t low = 0, high = 0x2545f491U;
+    for (int i = 0; i < 5; i++)
+    {
+        low = hash_combine(low, values[i]);
+        high = hash_combine(high, values[i]);
+    }
+    uint64_t key = (uint64_t)high << 32 | low;
+    return key != 0 ? key : 1;
+}
+
+// Cell of the key in its bucket, NULL if it isn't cached. The caller holds the bucket's lock.
+irradiance_cache_cell_t *irradiance_cache_find(irradiance_cache_cell_t *bucket, uint64_t key)
+{
+    for (int i = 0; i < IRRADIANCE_CACHE_WAYS; i++)
+    {
+        if (bucket[i].key == key)
+        {
+            return &bucket[i];
+        }
+    }
+    return NULL;
+}
+
+// Average radiance of the key's cell, if it is settled
+bool irradiance_cache_get(irradiance_cache_t *cache, uint64_t key, vec3 radiance_dst)
+{
+    int bucket_index = (int)(key & (uint64_t)(cache->bucket_count - 1));
+    irradiance_cache_cell_t *bucket = &cache->cells[(size_t)bucket_index * IRRADIANCE_CACHE_WAYS];
+    mtx_t *lock = &cache->locks[bucket_index % IRRADIANCE_CACHE_LOCK_COUNT];
+
+    mtx_lock(lock);
+    irradiance_cache_cell_t *cell = irradiance_cache_find(bucket, key);
+    bool settled = cell != NULL && cell->sample_count >= IRRADIANCE_CACHE_SAMPLE_COUNT;
+    if (settled)
+    {
+        cell->last_used = cache->clock;
+        glm_vec3_scale(cell->radiance_sum, 1.0f / (float)cell->sample_count, radiance_dst);
+    }
+    mtx_unlock(lock);
+    return settled;
+}
+
+// Adds one sample of the radiance leaving the key's cell, creating the cell if needed
+void irradiance_cache_add(irradiance_cache_t *cache, uint64_t key, vec3 radiance)
+{
+    int bucket_index = (int)(key & (uint64_t)(cache->bucket_count - 1));
+    irradiance_cache_cell_t *bucket = &cache->cells[(size_t)bucket_index * IRRADIANCE_CACHE_WAYS];
+    mtx_t *lock = &cache->locks[bucket_index % IRRADIANCE_CACHE_LOCK_COUNT];
+
+    mtx_lock(lock);
+    irradiance_cache_cell_t *cell = irradiance_cache_find(bucket, key);
+    if (cell == NULL)
+    {
+        // An empty cell, or else the one unused for the longest time
+        cell = &bucket[0];
+        for (int i = 0; i < IRRADIANCE_CACHE_WAYS && cell->key != 0; i++)
+        {
+            if (bucket[i].key == 0 || cache->clock - bucket[i].last_used > cache->clock - cell->last_used)
+            {
+                cell = &bucket[i];
+            }
+        }
+        *cell = (irradiance_cache_cell_t){.key = key};
+    }
+
+    cell->last_used = cache->clock;
+    if (cell->sample_count == IRRADIANCE_CACHE_MAX_SAMPLE_COUNT)
+    {
+        // Halving keeps the average and turns it into a long moving average
+        cell->sample_count /= 2;
+        glm_vec3_scale(cell->radiance_sum, 0.5f, cell->radiance_sum);
+    }
+    cell->sample_count++;
+    glm_vec3_add(cell->radiance_sum, radiance, cell->radiance_sum);
+    mtx_unlock(lock);
+}
@@ -0,0 +1,189 @@
+#pragma once
+
+#include "camera.h"
+#include "scene.h"
+
+#include <cglm/cglm.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Screen tiles by depth slices, the slices grow exponentially so clusters stay roughly cubic
+#define LIGHT_CLUSTER_COUNT_X 16
+#define LIGHT_CLUSTER_COUNT_Y 9
+#define LIGHT_CLUSTER_COUNT_Z 24
+#define LIGHT_CLUSTER_COUNT (LIGHT_CLUSTER_COUNT_X * LIGHT_CLUSTER_COUNT_Y * LIGHT_CLUSTER_COUNT_Z)
+
+// Lights binned into view space clusters, so shading a point only considers the lights that can reach its cluster
+typedef struct
+{
+    uint32_t cluster_ranges[LIGHT_CLUSTER_COUNT][2]; // offset into light_indices and count, x fastest then y then z
+    uint32_t *light_indices;                         // the global lights first, then each cluster's
+    int light_index_count;
+    int light_index_capacity;
+    int global_light_count; // lights reaching every cluster: directional and unbounded point lights
+    float depth_scale;      // slice = log(depth) * depth_scale + depth_bias
+    float depth_bias;
+} light_clusters_t;
+
+void light_clusters_destroy(light_clusters_t *clusters)
+{
+    free(clusters->light_indices);
+    clusters->light_indices = NULL;
+    clusters->light_index_count = 0;
+    clusters->light_index_capacity = 0;
+}
+
+float get_light_cluster_slice_depth(int slice)
+{
+    return Z_NEAR * powf(Z_FAR / Z_NEAR, (float)slice / LIGHT_CLUSTER_COUNT_Z);
+}
+
+int get_light_cluster_tile(float ndc, int tile_count)
+{
+    int tile = (int)floorf((ndc * 0.5f + 0.5f) * tile_count);
+    return tile < 0 ? 0 : tile >= tile_count ? tile_count - 1 : tile;
+}
+
+// Tiles covered by the view space box around a light sphere between two depths, false if none are
+bool get_light_cluster_tiles(vec3 center, float range, float depth_min, float depth_max, mat4 projection, int tiles_dst[2][2])
+{
+    int tile_counts[2] = {LIGHT_CLUSTER_COUNT_X, LIGHT_CLUSTER_COUNT_Y};
+    for (int axis = 0; axis < 2; axis++)
+    {
+        // x / depth is monotonic in depth, so the extremes are at the ends of the depth range
+        float low = center[axis] - range;
+        float high = center[axis] + range;
+        float scale = projection[axis][axis];
+        float ndc_min = scale * glm_min(low / depth_min, low / depth_max);
+        float ndc_max = scale * glm_max(high / depth_min, high / depth_max);
+        if (ndc_max < -1.0f || ndc_min > 1.0f)
+        {
+            return false;
+        }
+        tiles_dst[axis][0] = get_light_cluster_tile(ndc_min, tile_counts[axis]);
+        tiles_dst[axis][1] = get_light_cluster_tile(ndc_max, tile_counts[axis]);
+    }
+    return true;
+}
+
+// Clusters a bounded point light may reach, conservatively: per depth slice a rectangle of tiles
+typedef struct
+{
+    int slice_min;
+    int slice_max;
+    bool has_tiles[LIGHT_CLUSTER_COUNT_Z];
+    int tiles[LIGHT_CLUSTER_COUNT_Z][2][2]; // [slice][axis][min, max]
+} light_cluster_bounds_t;
+
+int get_light_cluster_slice(float depth, light_clusters_t *clusters)
+{
+    return (int)glm_clamp(floorf(logf(depth) * clusters->depth_scale + clusters->depth_bias), 0.0f, LIGHT_CLUSTER_COUNT_Z - 1);
+}
+
+bool get_light_cluster_bounds(light_clusters_t *clusters, light_t *light, mat4 view, mat4 projection, light_cluster_bounds_t *bounds_dst)
+{
+    vec3 center;
+    glm_mat4_mulv3(view, light->position, 1.0f, center);
+    float depth_min = glm_max(-center[2] - light->range, Z_NEAR);
+    float depth_max = glm_min(-center[2] + light->range, Z_FAR);
+    if (depth_min > depth_max)
+    {
+        return false;
+    }
+
+    bounds_dst->slice_min = get_light_cluster_slice(depth_min, clusters);
+    bounds_dst->slice_max = get_light_cluster_slice(depth_max, clusters);
+    for (int slice = bounds_dst->slice_min; slice <= bounds_dst->slice_max; slice++)
+    {
+        float slice_depth_min = glm_max(get_light_cluster_slice_depth(slice), depth_min);
+        float slice_depth_max = glm_min(get_light_cluster_slice_depth(slice + 1), depth_max);
+        bounds_dst->has_tiles[slice] = get_light_cluster_tiles(center, light->range, slice_depth_min, slice_depth_max, projection, bounds_dst->tiles[slice]);
+    }
+    return true;
+}
+
+// Adds light_index to every cluster in bounds, or only counts it there when light_indices is NULL
+void add_light_to_clusters(light_clusters_t *clusters, light_cluster_bounds_t *bounds, uint32_t light_index, uint32_t *light_indices)
+{
+    for (int slice = bounds->slice_min; slice <= bounds->slice_max; slice++)
+    {
+        if (!bounds->has_tiles[slice])
+        {
+            continue;
+        }
+
+        int(*tiles)[2] = bounds->tiles[slice];
+        for (int tile_y = tiles[1][0]; tile_y <= tiles[1][1]; tile_y++)
+        {
+            for (int tile_x = tiles[0][0]; tile_x <= tiles[0][1]; tile_x++)
+            {
+                uint32_t *range = clusters->cluster_ranges[(slice * LIGHT_CLUSTER_COUNT_Y + tile_y) * LIGHT_CLUSTER_COUNT_X + tile_x];
+                if (light_indices != NULL)
+                {
+                    light_indices[range[0] + range[1]] = light_index;
+                }
+                range[1]++;
+            }
+        }
+    }
+}
+
+void light_clusters_build(light_clusters_t *clusters, light_t *lights, int light_count, mat4 view, mat4 projection)
+{
+    clusters->depth_scale = LIGHT_CLUSTER_COUNT_Z / logf(Z_FAR / Z_NEAR);
+    clusters->depth_bias = -logf(Z_NEAR) * clusters->depth_scale;
+
+    // Count the lights of every cluster, then place the lists back to back after the global lights and fill them
+    memset(clusters->cluster_ranges, 0, sizeof(clusters->cluster_ranges));
+    clusters->global_light_count = 0;
+    for (int i = 0; i < light_count; i++)
+    {
+        light_cluster_bounds_t bounds;
+        if (lights[i].position[3] == 0.0f || lights[i].range <= 0.0f)
+        {
+            clusters->global_light_count++;
+        }
+        else if (get_light_cluster_bounds(clusters, &lights[i], view, projection, &bounds))
+        {
+            add_light_to_clusters(clusters, &bounds, i, NULL);
+        }
+    }
+
+    uint32_t offset = clusters->global_light_count;
+    for (int i = 0; i < LIGHT_CLUSTER_COUNT; i++)
+    {
+        clusters->cluster_ranges[i][0] = offset;
+        offset += clusters->cluster_ranges[i][1];
+        clusters->cluster_ranges[i][1] = 0;
+    }
+
+    if (clusters->light_index_capacity < (int)offset)
+    {
+        clusters->light_index_capacity = offset;
+        clusters->light_indices = (uint32_t *)realloc(clusters->light_indices, offset * sizeof(uint32_t));
+        if (clusters->light_indices == NULL)
+        {
+            fprintf(stderr, "Error: failed to allocate light clusters\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    clusters->light_index_count = offset;
+
+    int global_light_index = 0;
+    for (int i = 0; i < light_count; i++)
+    {
+        light_cluster_bounds_t bounds;
+        if (lights[i].position[3] == 0.0f || lights[i].range <= 0.0f)
+        {
+            clusters->light_indices[global_light_index++] = i;
+        }
+        else if (get_light_cluster_bounds(clusters, &lights[i], view, projection, &bounds))
+        {
+            add_light_to_clusters(clusters, &bounds, i, clusters->light_indices);
+        }
+    }
+}
@@ -0,0 +1,242 @@
+#pragma once
+
+#include "scene.h"
+
+#include <cglm/cglm.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Meshes of the object types, shared by the OpenGL and the software rasterizer. Vertices are a position and a normal, every
+// mesh is one triangle strip.
+#define MESH_VERTEX_SIZE 6
+
+#define SPHERE_SECTOR_COUNT 128
+#define SPHERE_STACK_COUNT 128
+#define SPHERE_VERTEX_COUNT(sector_count, stack_count) (2 + ((sector_count) + 1) * ((stack_count) - 1))
+#define SPHERE_INDEX_COUNT(sector_count, stack_count) (1 + (sector_count) * (1 + 2 * ((stack_count) - 1)))
+
+// Each level of detail halves the sectors and stacks of the previous one, down to 8x8 (112 triangles)
+#define SPHERE_LOD_COUNT 5
+#define SPHERE_LOD_SECTOR_COUNT(level) (SPHERE_SECTOR_COUNT >> (level))
+#define SPHERE_LOD_STACK_COUNT(level) (SPHERE_STACK_COUNT >> (level))
+#define SPHERE_LOD_EDGE_LENGTH 6.0f // target length of a silhouette edge in pixels
+#define SPHERE_LOD_HYSTERESIS 0.25f // extra detail a sphere must lose before it switches to a coarser level
+
+#define PLANE_VERTEX_COUNT 4
+#define CUBE_VERTEX_COUNT 26
+
+static const float plane_vertices[PLANE_VERTEX_COUNT * MESH_VERTEX_SIZE] = {
+    -1.0f, 0.0f, -1.0f, 0.0f, 1.0f, 0.0f,
+    -1.0f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f,
+    1.0f, 0.0f, -1.0f, 0.0f, 1.0f, 0.0f,
+    1.0f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f};
+
+static const float cube_vertices[CUBE_VERTEX_COUNT * MESH_VERTEX_SIZE] = {
+    // left
+    -0.5f, 0.5f, 0.5f, -1.0f, 0.0f, 0.0f,
+    -0.5f, 0.5f, -0.5f, -1.0f, 0.0f, 0.0f,
+    -0.5f, -0.5f, 0.5f, -1.0f, 0.0f, 0.0f,
+    -0.5f, -0.5f, -0.5f, -1.0f, 0.0f, 0.0f,
+    // bottom
+    -0.5f, -0.5f, -0.5f, 0.0f, -1.0f, 0.0f,
+    -0.5f, -0.5f, 0.5f, 0.0f, -1.0f, 0.0f,
+    0.5f, -0.5f, -0.5f, 0.0f, -1.0f, 0.0f,
+    0.5f, -0.5f, 0.5f, 0.0f, -1.0f, 0.0f,
+    // front
+    0.5f, -0.5f, 0.5f, 0.0f, 0.0f, 1.0f,
+    -0.5f, -0.5f, 0.5f, 0.0f, 0.0f, 1.0f,
+    0.5f, 0.5f, 0.5f, 0.0f, 0.0f, 1.0f,
+    -0.5f, 0.5f, 0.5f, 0.0f, 0.0f, 1.0f,
+    // top
+    -0.5f, 0.5f, 0.5f, 0.0f, 1.0f, 0.0f,
+    0.5f, 0.5f, 0.5f, 0.0f, 1.0f, 0.0f,
+    -0.5f, 0.5f, -0.5f, 0.0f, 1.0f, 0.0f,
+    0.5f, 0.5f, -0.5f, 0.0f, 1.0f, 0.0f,
+    // right
+    0.5f, 0.5f, -0.5f, 1.0f, 0.0f, 0.0f,
+    0.5f, -0.5f, -0.5f, 1.0f, 0.0f, 0.0f,
+    0.5f, 0.5f, 0.5f, 1.0f, 0.0f, 0.0f,
+    0.5f, -0.5f, 0.5f, 1.0f, 0.0f, 0.0f,
+    0.5f, -0.5f, 0.5f, 1.0f, 0.0f, 0.0f,
+    // back
+    0.5f, 0.5f, -0.5f, 0.0f, 0.0f, -1.0f,
+    0.5f, 0.5f, -0.5f, 0.0f, 0.0f, -1.0f,
+    0.5f, -0.5f, -0.5f, 0.0f, 0.0f, -1.0f,
+    -0.5f, 0.5f, -0.5f, 0.0f, 0.0f, -1.0f,
+    -0.5f, -0.5f, -0.5f, 0.0f, 0.0f, -1.0f};
+
+// Every level of detail of the unit sphere, back to back in one vertex and one index array
+typedef struct
+{
+    float *vertices;
+    unsigned int *indices;
+    int vertex_count;
+    int index_count;
+    int base_vertices[SPHERE_LOD_COUNT];
+    int first_indices[SPHERE_LOD_COUNT];
+} sphere_meshes_t;
+
+void put_sphere_vertex(float **vertices, float x, float y, float z)
+{
+    *(*vertices)++ = x;
+    *(*vertices)++ = y;
+    *(*vertices)++ = z;
+    *(*vertices)++ = x;
+    *(*vertices)++ = y;
+    *(*vertices)++ = z;
+}
+
+void put_index(unsigned int **indices, unsigned int index)
+{
+    *(*indices)++ = index;
+}
+
+void generate_sphere_vertices(int sector_count, int stack_count, float *vertices, unsigned int *indices)
+{
+    typedef enum
+    {
+        NORTH_TO_SOUTH,
+        SOUTH_TO_NORTH
+    } direction_t;
+
+    float *vertices_start = vertices;
+    unsigned int *indices_start = indices;
+
+    float sector_step = 2 * M_PI / sector_count;
+    float stack_step = M_PI / stack_count;
+
+    int north_pole_index = 0;
+    int south_pole_index = 1;
+    int vertices_per_sector = stack_count - 1;
+
+    put_sphere_vertex(&vertices, 0.0f, 1.0f, 0.0f);
+    put_sphere_vertex(&vertices, 0.0f, -1.0f, 0.0f);
+    put_index(&indices, north_pole_index);
+
+    for (int i = 0; i < sector_count + 1; i++)
+    {
+        direction_t direction = i % 2 == 1 ? NORTH_TO_SOUTH : SOUTH_TO_NORTH;
+        float sector_angle = i * sector_step;
+
+        for (int j = 1; j < stack_count; j++)
+        {
+            float stack_angle = M_PI / 2 - j * stack_step;
+
+            float x = cosf(stack_angle) * cosf(sector_angle);
+            float y = sinf(stack_angle);
+            float z = cosf(stack_angle) * sinf(sector_angle);
+
+            put_sphere_vertex(&vertices, x, y, z);
+
+            if (i == 0)
+            {
+                continue;
+            }
+
+            int sector_index = i;
+            int stack_index = direction == NORTH_TO_SOUTH ? j : stack_count - j;
+
+            put_index(&indices, 2 + (sector_index - 1) * vertices_per_sector + stack_index - 1);
+            put_index(&indices, 2 + sector_index * vertices_per_sector + stack_index - 1);
+        }
+
+        if (i > 0)
+        {
+            put_index(&indices, direction == NORTH_TO_SOUTH ? south_pole_index : north_pole_index);
+        }
+    }
+}
+
+void sphere_meshes_create(sphere_meshes_t *meshes)
+{
+    meshes->vertex_count = 0;
+    meshes->index_count = 0;
+    for (int level = 0; level < SPHERE_LOD_COUNT; level++)
+    {
+        meshes->base_vertices[level] = meshes->vertex_count;
+        meshes->first_indices[level] = meshes->index_count;
+        meshes->vertex_count += SPHERE_VERTEX_COUNT(SPHERE_LOD_SECTOR_COUNT(level), SPHERE_LOD_STACK_COUNT(level));
+        meshes->index_count += SPHERE_INDEX_COUNT(SPHERE_LOD_SECTOR_COUNT(level), SPHERE_LOD_STACK_COUNT(level));
+    }
+    meshes->vertices = (float *)malloc(meshes->vertex_count * MESH_VERTEX_SIZE * sizeof(float));
+    meshes->indices = (unsigned int *)malloc(meshes->index_count * sizeof(unsigned int));
+    if (meshes->vertices == NULL || meshes->indices == NULL)
+    {
+        fprintf(stderr, "Error: failed to allocate sphere meshes\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int level = 0; level < SPHERE_LOD_COUNT; level++)
+    {
+        generate_sphere_vertices(SPHERE_LOD_SECTOR_COUNT(level), SPHERE_LOD_STACK_COUNT(level),
+                                 meshes->vertices + meshes->base_vertices[level] * MESH_VERTEX_SIZE,
+                                 meshes->indices + meshes->first_indices[level]);
+    }
+}
+
+void sphere_meshes_destroy(sphere_meshes_t *meshes)
+{
+    free(meshes->vertices);
+    free(meshes->indices);
+    *meshes = (sphere_meshes_t){0};
+}
+
+// Coarsest level with at least sector_count sectors, or the finest one
+int get_sphere_lod(float sector_count)
+{
+    int level = SPHERE_LOD_COUNT - 1;
+    while (level > 0 && SPHERE_LOD_SECTOR_COUNT(level) < sector_count)
+    {
+        level--;
+    }
+    return level;
+}
+
+// Level of detail for a sphere covering screen_radius pixels. Switching to a coarser level needs a margin, so spheres near
+// a boundary distance don't flicker between levels as the camera moves.
+int select_sphere_lod(float screen_radius, int previous_level)
+{
+    float sector_count = 2.0f * GLM_PI * screen_radius / SPHERE_LOD_EDGE_LENGTH;
+    int level = get_sphere_lod(sector_count);
+    if (previous_level < 0 || level <= previous_level)
+    {
+        return level;
+    }
+
+    int hysteresis_level = get_sphere_lod(sector_count * (1.0f + SPHERE_LOD_HYSTERESIS));
+    return hysteresis_level > previous_level ? hysteresis_level : previous_level;
+}
+
+// Places the object's mesh in the world
+void get_object_model_matrix(object_t *object, mat4 model_dst)
+{
+    mat4 model = GLM_MAT4_IDENTITY_INIT;
+    switch (object->type)
+    {
+    case OBJECT_TYPE_PLANE:
+    {
+        glm_lookat((vec3){0.0f, 0.0f, 0.0f}, (vec3){0.0f, 0.0f, 1.0f}, object->normal, model);
+        glm_translate(model, object->position);
+        glm_scale(model, (vec3){100.0f, 100.0f, 100.0f});
+        break;
+    }
+    case OBJECT_TYPE_SPHERE:
+    {
+        glm_translate(model, object->position);
+        glm_scale(model, (vec3){object->radius, object->radius, object->radius});
+        break;
+    }
+    case OBJECT_TYPE_CUBE:
+    {
+        glm_translate(model, object->position);
+        glm_scale(model, object->size);
+        break;
+    }
+    default:
+    {
+        fprintf(stderr, "Error: unknown object type %d\n", object->type);
+        exit(EXIT_FAILURE);
+    }
+    }
+    glm_mat4_copy(model, model_dst);
+}
@@ -0,0 +1,253 @@
+#include "bvh.h"
+#include "camera.h"
+#include "scene-file.h"
+#include "scene.h"
+
+#include <cglm/cglm.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Converts a text scene, one statement per line, to a binary scene file:
+//   camera <position> <target> <up>
+//   material <name> <r g b> <specular> <shininess>
+//   sphere <center> <radius> <material>
+//   cube <center> <size> <material>
+//   plane <position> <normal> <material>
+//   point_light <position> <r g b> <intensity> <radius> [<range>]
+//   directional_light <direction> <r g b> <intensity> <angular radius in degrees>
+// Vectors are three numbers, and everything after a # is a comment.
+#define MAX_LINE_LENGTH 1024
+#define MAX_MATERIAL_NAME_LENGTH 63
+
+typedef struct
+{
+    char name[MAX_MATERIAL_NAME_LENGTH + 1];
+    material_t material;
+} named_material_t;
+
+typedef struct
+{
+    scene_t scene;
+    named_material_t *materials;
+    int material_count;
+    int material_capacity;
+} text_scene_t;
+
+bool text_scene_find_material(text_scene_t *scene, const char *name, material_t *material_dst)
+{
+    // The latest definition of a name wins
+    for (int i = scene->material_count - 1; i >= 0; i--)
+    {
+        if (strcmp(scene->materials[i].name, name) == 0)
+        {
+            *material_dst = scene->materials[i].material;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Parses one statement, false if it is malformed
+bool parse_statement(text_scene_t *scene, char *line, const char **error_dst)
+{
+    char *comment = strchr(line, '#');
+    if (comment != NULL)
+    {
+        *comment = '\0';
+    }
+
+    char keyword[32], name[MAX_MATERIAL_NAME_LENGTH + 1];
+    int offset = 0;
+    if (sscanf(line, "%31s%n", keyword, &offset) != 1)
+    {
+        return true;
+    }
+    const char *arguments = line + offset;
+
+    float v[11];
+    int end = 0;
+    *error_dst = "malformed statement";
+    if (strcmp(keyword, "camera") == 0)
+    {
+        if (sscanf(arguments, "%f %f %f %f %f %f %f %f %f %n", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7], &v[8], &end) != 9 || arguments[end] != '\0')
+        {
+            return false;
+        }
+        camera_t camera = {.position = {v[0], v[1], v[2]}, .target = {v[3], v[4], v[5]}, .up = {v[6], v[7], v[8]}};
+        glm_vec3_sub(camera.target, camera.position, camera.direction);
+        glm_vec3_normalize(camera.direction);
+        scene_set_camera(&scene->scene, &camera);
+    }
+    else if (strcmp(keyword, "material") == 0)
+    {
+        named_material_t material = {0};
+        if (sscanf(arguments, "%63s %f %f %f %f %f %n", material.name, &v[0], &v[1], &v[2], &v[3], &v[4], &end) != 6 || arguments[end] != '\0')
+        {
+            return false;
+        }
+        material.material = (material_t){.base_color = {v[0], v[1], v[2]}, .specular = v[3], .shininess = v[4]};
+        if (scene->material_count == scene->material_capacity)
+        {
+            scene->material_capacity = scene->material_capacity > 0 ? scene->material_capacity * 2 : 16;
+            scene->materials = realloc(scene->materials, scene->material_capacity * sizeof(named_material_t));
+            if (scene->materials == NULL)
+            {
+                fprintf(stderr, "Error: failed to allocate materials\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        scene->materials[scene->material_count++] = material;
+    }
+    else if (strcmp(keyword, "sphere") == 0 || strcmp(keyword, "cube") == 0 || strcmp(keyword, "plane") == 0)
+    {
+        bool sphere = strcmp(keyword, "sphere") == 0;
+        int value_count = sphere ? 4 : 6;
+        int parsed = sphere ? sscanf(arguments, "%f %f %f %f %63s %n", &v[0], &v[1], &v[2], &v[3], name, &end)
+                            : sscanf(arguments, "%f %f %f %f %f %f %63s %n", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], name, &end);
+        if (parsed != value_count + 1 || arguments[end] != '\0')
+        {
+            return false;
+        }
+
+        material_t material;
+        if (!text_scene_find_material(scene, name, &material))
+        {
+            *error_dst = "unknown material";
+            return false;
+        }
+
+        object_t object;
+        if (sphere)
+        {
+            make_sphere(&object, (vec3){v[0], v[1], v[2]}, v[3], material);
+        }
+        else if (strcmp(keyword, "cube") == 0)
+        {
+            make_cube(&object, (vec3){v[0], v[1], v[2]}, (vec3){v[3], v[4], v[5]}, material);
+        }
+        else
+        {
+            vec3 normal = {v[3], v[4], v[5]};
+            glm_vec3_normalize(normal);
+            make_plane(&object, (vec3){v[0], v[1], v[2]}, normal, material);
+        }
+        scene_add_object(&scene->scene, object);
+    }
+    else if (strcmp(keyword, "point_light") == 0)
+    {
+        v[8] = 0.0f;
+        int parsed = sscanf(arguments, "%f %f %f %f %f %f %f %f %n", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7], &end);
+        if (parsed == 8 && arguments[end] != '\0')
+        {
+            int range_end = 0;
+            parsed += sscanf(arguments + end, "%f %n", &v[8], &range_end);
+            end += range_end;
+        }
+        if (parsed < 8 || arguments[end] != '\0')
+        {
+            return false;
+        }
+        scene_add_point_light_with_range(&scene->scene, (vec3){v[0], v[1], v[2]}, (vec3){v[3], v[4], v[5]}, v[6], v[7], v[8]);
+    }
+    else if (strcmp(keyword, "directional_light") == 0)
+    {
+        if (sscanf(arguments, "%f %f %f %f %f %f %f %f %n", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7], &end) != 8 || arguments[end] != '\0')
+        {
+            return false;
+        }
+        vec3 direction = {v[0], v[1], v[2]};
+        glm_vec3_normalize(direction);
+        scene_add_directional_light(&scene->scene, direction, (vec3){v[3], v[4], v[5]}, v[6], glm_rad(v[7]));
+    }
+    else
+    {
+        *error_dst = "unknown statement";
+        return false;
+    }
+    return true;
+}
+
+bool parse_text_scene(const char *path, text_scene_t *scene_dst)
+{
+    FILE *stream = fopen(path, "r");
+    if (stream == NULL)
+    {
+        fprintf(stderr, "Error: failed to open %s\n", path);
+        return false;
+    }
+
+    char line[MAX_LINE_LENGTH];
+    int line_number = 0;
+    bool parsed = true;
+    while (parsed && fgets(line, sizeof(line), stream) != NULL)
+    {
+        line_number++;
+        const char *error = NULL;
+        if (strchr(line, '\n') == NULL && !feof(stream))
+        {
+            error = "line too long";
+            parsed = false;
+        }
+        else
+        {
+            parsed = parse_statement(scene_dst, line, &error);
+        }
+        if (!parsed)
+        {
+            fprintf(stderr, "Error: %s:%d: %s\n", path, line_number, error);
+        }
+    }
+    fclose(stream);
+    return parsed;
+}
+
+int main(int argc, char **argv)
+{
+    bool build_bvh = true;
+    int first_path = 1;
+    if (argc == 4 && strcmp(argv[1], "--no-bvh") == 0)
+    {
+        build_bvh = false;
+        first_path = 2;
+    }
+    if (argc - first_path != 2)
+    {
+        fprintf(stderr,
+                "Usage: %s [--no-bvh] <input text scene> <output scene file>\n"
+                "  --no-bvh  leave out the BVH, renderers then build it when they load the scene\n",
+                argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    const char *input_path = argv[first_path];
+    const char *output_path = argv[first_path + 1];
+
+    text_scene_t text_scene = {0};
+    camera_t camera = {.position = {0.0f, 0.0f, -2.0f}, .direction = {0.0f, 0.0f, 1.0f}, .up = {0.0f, 1.0f, 0.0f}};
+    scene_set_camera(&text_scene.scene, &camera);
+    if (!parse_text_scene(input_path, &text_scene))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    scene_t *scene = &text_scene.scene;
+    bvh_t bvh = {0};
+    if (build_bvh)
+    {
+        bvh_build(&bvh, scene->objects, scene->object_count);
+    }
+
+    if (!write_scene_file(output_path, &scene->camera, scene->objects, scene->object_count, scene->lights, scene->light_count, build_bvh ? &bvh : NULL))
+    {
+        fprintf(stderr, "Failed to write %s\n", output_path);
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stderr, "Wrote %s: %d objects, %d lights, %d BVH nodes\n", output_path, scene->object_count, scene->light_count, bvh.node_count);
+
+    bvh_destroy(&bvh);
+    scene_destroy(scene);
+    free(text_scene.materials);
+    exit(EXIT_SUCCESS);
+}
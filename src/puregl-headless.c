@@ -0,0 +1,275 @@
+#include "ray-tracing.h"
+#include "software-rasterization.h"
+#include "demo-scene.h"
+#include "imaging.h"
+#include "scene-file.h"
+#include "scene.h"
+#include "timing.h"
+
+#include <cglm/cglm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_SAMPLE_COUNT 64
+#define DEFAULT_OUTPUT_PATH "output.ppm"
+#define DEFAULT_WIDTH 640
+#define DEFAULT_HEIGHT 480
+
+typedef struct
+{
+    int sample_count;
+    const char *output_path;
+    const char *scene_path; // NULL for the built-in demo scene
+    int thread_count;
+    int width;
+    int height;
+    sampler_type_t sampler_type;
+    bool adaptive_sampling;
+    bool denoising;
+    bool irradiance_caching;
+    bool rasterize;
+} options_t;
+
+void print_usage(const char *program)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -n <count>           samples per pixel, or when rasterizing the times the image is rendered (default %d)\n"
+            "  -o <path>            output PPM image (default %s)\n"
+            "  -i <path>            scene file written by puregl-convert-scene (default: the built-in demo scene)\n"
+            "  -t <count>           render threads (default: one per processor)\n"
+            "  -r <width>x<height>  resolution (default %dx%d)\n"
+            "  -s random|sobol      sample sequence (default sobol)\n"
+            "  -a on|off            adaptive sampling, spends the same samples per pixel on average but on noisy pixels (default on)\n"
+            "  -d on|off            denoise the image with a filter guided by the surfaces the pixels see (default on)\n"
+            "  -c on|off            share the diffuse light of bounce hits between nearby hits (default off)\n"
+            "  -m trace|rasterize   ray trace, or rasterize like the viewer's OpenGL rasterizer but without shadows (default trace)\n",
+            program, DEFAULT_SAMPLE_COUNT, DEFAULT_OUTPUT_PATH, DEFAULT_WIDTH, DEFAULT_HEIGHT);
+}
+
+bool parse_options(int argc, char **argv, options_t *options_dst)
+{
+    *options_dst = (options_t){
+        .sample_count = DEFAULT_SAMPLE_COUNT,
+        .output_path = DEFAULT_OUTPUT_PATH,
+        .scene_path = NULL,
+        .thread_count = get_processor_count(),
+        .width = DEFAULT_WIDTH,
+        .height = DEFAULT_HEIGHT,
+        .sampler_type = SAMPLER_TYPE_SOBOL,
+        .adaptive_sampling = true,
+        .denoising = true,
+        .irradiance_caching = false,
+        .rasterize = false};
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (i + 1 >= argc)
+        {
+            return false;
+        }
+
+        const char *value = argv[++i];
+        if (strcmp(argv[i - 1], "-n") == 0)
+        {
+            options_dst->sample_count = atoi(value);
+        }
+        else if (strcmp(argv[i - 1], "-o") == 0)
+        {
+            options_dst->output_path = value;
+        }
+        else if (strcmp(argv[i - 1], "-i") == 0)
+        {
+            options_dst->scene_path = value;
+        }
+        else if (strcmp(argv[i - 1], "-t") == 0)
+        {
+            options_dst->thread_count = atoi(value);
+        }
+        else if (strcmp(argv[i - 1], "-r") == 0)
+        {
+            if (sscanf(value, "%dx%d", &options_dst->width, &options_dst->height) != 2)
+            {
+                return false;
+            }
+        }
+        else if (strcmp(argv[i - 1], "-s") == 0)
+        {
+            if (strcmp(value, "random") == 0)
+            {
+                options_dst->sampler_type = SAMPLER_TYPE_RANDOM;
+            }
+            else if (strcmp(value, "sobol") == 0)
+            {
+                options_dst->sampler_type = SAMPLER_TYPE_SOBOL;
+            }
+            else
+            {
+                return false;
+            }
+        }
+        else if (strcmp(argv[i - 1], "-a") == 0)
+        {
+            if (strcmp(value, "on") == 0)
+            {
+                options_dst->adaptive_sampling = true;
+            }
+            else if (strcmp(value, "off") == 0)
+            {
+                options_dst->adaptive_sampling = false;
+            }
+            else
+            {
+                return false;
+            }
+        }
+        else if (strcmp(argv[i - 1], "-d") == 0)
+        {
+            if (strcmp(value, "on") == 0)
+            {
+                options_dst->denoising = true;
+            }
+            else if (strcmp(value, "off") == 0)
+            {
+                options_dst->denoising = false;
+            }
+            else
+            {
+                return false;
+            }
+        }
+        else if (strcmp(argv[i - 1], "-c") == 0)
+        {
+            if (strcmp(value, "on") == 0)
+            {
+                options_dst->irradiance_caching = true;
+            }
+            else if (strcmp(value, "off") == 0)
+            {
+                options_dst->irradiance_caching = false;
+            }
+            else
+            {
+                return false;
+            }
+        }
+        else if (strcmp(argv[i - 1], "-m") == 0)
+        {
+            if (strcmp(value, "trace") == 0)
+            {
+                options_dst->rasterize = false;
+            }
+            else if (strcmp(value, "rasterize") == 0)
+            {
+                options_dst->rasterize = true;
+            }
+            else
+            {
+                return false;
+            }
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    return options_dst->sample_count > 0 && options_dst->thread_count > 0 && options_dst->width > 0 && options_dst->height > 0;
+}
+
+// Every render is complete, so repeating it only makes the timing more stable
+void rasterize(options_t *options, scene_t *scene, framebuffer_t *framebuffer)
+{
+    software_rasterizer_t rasterizer;
+    software_rasterizer_create(&rasterizer, options->thread_count);
+    double start_time = get_time();
+    for (int i = 0; i < options->sample_count; i++)
+    {
+        software_rasterizer_render(&rasterizer, scene, framebuffer);
+    }
+    double elapsed_time = get_time() - start_time;
+    fprintf(stderr, "%dx%d, rasterized %d times on %d threads in %.3f s (%.2f ms per image)\n",
+            options->width, options->height, options->sample_count, options->thread_count, elapsed_time, elapsed_time * 1000.0 / options->sample_count);
+    fprintf(stderr, "%d triangles, %d objects visible, %d culled\n", rasterizer.triangle_count, rasterizer.visible_object_count, rasterizer.culled_object_count);
+    software_rasterizer_destroy(&rasterizer);
+}
+
+int main(int argc, char **argv)
+{
+    options_t options;
+    if (!parse_options(argc, argv, &options))
+    {
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    static scene_t scene;
+    scene_file_t scene_file = {0};
+    if (options.scene_path != NULL)
+    {
+        double load_start_time = get_time();
+        if (!scene_file_open(&scene_file, options.scene_path))
+        {
+            exit(EXIT_FAILURE);
+        }
+        scene_load_file(&scene, &scene_file);
+        fprintf(stderr, "Loaded %s in %.3f s: %d objects, %d lights, %s\n", options.scene_path, get_time() - load_start_time,
+                scene.object_count, scene.light_count, scene_file.bvh_nodes != NULL ? "prebuilt BVH" : "no BVH");
+    }
+    else
+    {
+        scene_init(&scene);
+    }
+
+    framebuffer_t framebuffer = {0};
+    framebuffer_resize(&framebuffer, options.width, options.height);
+
+    if (options.rasterize)
+    {
+        rasterize(&options, &scene, &framebuffer);
+        if (!write_ppm(options.output_path, &framebuffer))
+        {
+            fprintf(stderr, "Failed to write %s\n", options.output_path);
+            exit(EXIT_FAILURE);
+        }
+        framebuffer_destroy(&framebuffer);
+        scene_destroy(&scene);
+        scene_file_close(&scene_file);
+        fprintf(stderr, "Wrote %s\n", options.output_path);
+        exit(EXIT_SUCCESS);
+    }
+
+    ray_tracer_t ray_tracer;
+    ray_tracer_create(&ray_tracer, options.thread_count);
+    ray_tracer.sampler_type = options.sampler_type;
+    ray_tracer.adaptive_sampling = options.adaptive_sampling;
+    ray_tracer.irradiance_caching = options.irradiance_caching;
+
+    // Every call completes a pass, one more shadow and bounce sample per pixel, on average with adaptive sampling.
+    // A pass traces every pixel, so only the last one needs to feed the denoiser.
+    double start_time = get_time();
+    for (int i = 0; i < options.sample_count; i++)
+    {
+        ray_tracer.denoising = options.denoising && i == options.sample_count - 1;
+        render_to_image(&ray_tracer, &scene, &framebuffer);
+    }
+    double elapsed_time = get_time() - start_time;
+    unsigned long long ray_count = ray_tracer_get_ray_count(&ray_tracer);
+    ray_tracer_destroy(&ray_tracer);
+
+    if (!write_ppm(options.output_path, &framebuffer))
+    {
+        fprintf(stderr, "Failed to write %s\n", options.output_path);
+        exit(EXIT_FAILURE);
+    }
+    framebuffer_destroy(&framebuffer);
+    scene_destroy(&scene);
+    scene_file_close(&scene_file);
+
+    fprintf(stderr, "%dx%d, %d samples per pixel on %d threads in %.3f s (%.3f s per sample)\n",
+            options.width, options.height, options.sample_count, options.thread_count, elapsed_time, elapsed_time / options.sample_count);
+    fprintf(stderr, "%llu rays, %.2f Mrays/s\n", ray_count, ray_count / elapsed_time / 1e6);
+    fprintf(stderr, "Wrote %s\n", options.output_path);
+    exit(EXIT_SUCCESS);
+}
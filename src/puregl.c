@@ -1,6 +1,9 @@
 #include "renderer-ray-tracing.h"
 #include "renderer-rasterization.h"
+#include "renderer-software-rasterization.h"
 #include "scene.h"
+#include "scene-file.h"
+#include "demo-scene.h"
 #include "camera.h"
 
 #define GLFW_INCLUDE_NONE
@@ -22,53 +25,10 @@ typedef struct
 {
     scene_t *scene;
     ui_state_t *ui_state;
+    int framebuffer_width;
+    int framebuffer_height;
 } window_context_t;
 
-void scene_init(scene_t *scene)
-{
-    *scene = (scene_t){0};
-
-    camera_t camera = {
-        .position = {0.0f, 0.0f, -2.0f},
-        .direction = {0.0f, 0.0f, 1.0f},
-        .up = {0.0f, 1.0f, 0.0f},
-        .target = {0.0f, 0.0f, 0.0f}};
-    scene_set_camera(scene, &camera);
-
-    scene_add_point_light(scene, (vec3){-5.0f, 5.0f, 0.0f}, (vec3){1.0f, 0.5f, 0.5f}, 1.0f, 1.0f);
-    scene_add_point_light(scene, (vec3){5.0f, 5.0f, 0.0f}, (vec3){0.5f, 0.5f, 1.0f}, 1.0f, 1.0f);
-    scene_add_directional_light(scene, (vec3){0.0f, 1.0f / sqrt(2.0f), 1.0f / sqrt(2.0f)}, (vec3){0.5f, 0.25f, 0.25f}, 1.0f, 0.5f / 180.0f * M_PI);
-
-    material_t material_yellow = {.base_color = {1.0f, 1.0f, 0.0f}, .specular = 0.3f, .shininess = 128.0f};
-    material_t material_white = {.base_color = {1.0f, 1.0f, 1.0f}, .specular = 0.3f, .shininess = 128.0f};
-
-    scene_add_plane(scene, (vec3){0.0f, -1.0f, 0.0f}, (vec3){0.0f, 1.0f, 0.0f}, material_yellow);
-
-    scene_add_cube(scene, (vec3){0.5f, -0.7f, 2.0f}, (vec3){0.6f, 0.6f, 0.6f}, material_white);
-    scene_add_cube(scene, (vec3){1.5f, -0.2f, 1.0f}, (vec3){0.8f, 1.6f, 0.8f}, material_white);
-
-    scene_add_sphere(scene, (vec3){-1.0f, -1.0, 0.5f}, 0.2f, material_white);
-    scene_add_sphere(scene, (vec3){-1.0f, -0.6, 0.5f}, 0.2f, material_white);
-    scene_add_sphere(scene, (vec3){-1.0f, -0.2, 0.5f}, 0.2f, material_white);
-    scene_add_sphere(scene, (vec3){-1.0f, 0.2, 0.5f}, 0.2f, material_white);
-    scene_add_sphere(scene, (vec3){-1.0f, 0.6, 0.5f}, 0.2f, material_white);
-    scene_add_sphere(scene, (vec3){-1.0f, 1.0, 0.5f}, 0.2f, material_white);
-
-    scene_add_sphere(scene, (vec3){-0.6f, -1.0, 0.5f}, 0.2f, material_white);
-    scene_add_sphere(scene, (vec3){-0.6f, -0.6, 0.5f}, 0.2f, material_white);
-    scene_add_sphere(scene, (vec3){-0.6f, -0.2, 0.5f}, 0.2f, material_white);
-    scene_add_sphere(scene, (vec3){-0.6f, 0.2, 0.5f}, 0.2f, material_white);
-    scene_add_sphere(scene, (vec3){-0.6f, 0.6, 0.5f}, 0.2f, material_white);
-    scene_add_sphere(scene, (vec3){-0.6f, 1.0, 0.5f}, 0.2f, material_white);
-
-    scene_add_sphere(scene, (vec3){-0.2f, -1.0, 0.5f}, 0.2f, material_white);
-    scene_add_sphere(scene, (vec3){-0.2f, -0.6, 0.5f}, 0.2f, material_white);
-    scene_add_sphere(scene, (vec3){-0.2f, -0.2, 0.5f}, 0.2f, material_white);
-    scene_add_sphere(scene, (vec3){-0.2f, 0.2, 0.5f}, 0.2f, material_white);
-    scene_add_sphere(scene, (vec3){-0.2f, 0.6, 0.5f}, 0.2f, material_white);
-    scene_add_sphere(scene, (vec3){-0.2f, 1.0, 0.5f}, 0.2f, material_white);
-}
-
 void error_callback(int error, const char *description)
 {
     fprintf(stderr, "Error: %s\n", description);
@@ -77,13 +37,21 @@ void error_callback(int error, const char *description)
 renderer_ray_tracing_t renderer_ray_tracing = {
     .create = renderer_ray_tracing_create,
     .render = renderer_ray_tracing_render,
+    .resize = renderer_ray_tracing_resize,
     .destroy = renderer_ray_tracing_destroy,
 };
 renderer_rasterization_t renderer_rasterization = {
     .create = renderer_rasterization_create,
     .render = renderer_rasterization_render,
+    .resize = renderer_rasterization_resize,
     .destroy = renderer_rasterization_destroy,
 };
+renderer_software_rasterization_t renderer_software_rasterization = {
+    .create = renderer_software_rasterization_create,
+    .render = renderer_software_rasterization_render,
+    .resize = renderer_software_rasterization_resize,
+    .destroy = renderer_software_rasterization_destroy,
+};
 renderer_t *renderer_current = (renderer_t *)&renderer_ray_tracing;
 
 void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods)
@@ -109,11 +77,16 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
         {
             renderer_current = (renderer_t *)&renderer_rasterization;
         }
+        else if (renderer_current == (renderer_t *)&renderer_rasterization)
+        {
+            renderer_current = (renderer_t *)&renderer_software_rasterization;
+        }
         else
         {
             renderer_current = (renderer_t *)&renderer_ray_tracing;
         }
         renderer_current->create(renderer_current);
+        renderer_current->resize(renderer_current, window_context->framebuffer_width, window_context->framebuffer_height);
         break;
     case GLFW_KEY_W:
         camera_move_forwards(camera, 0.1f, &new_camera);
@@ -134,6 +107,22 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
     }
 }
 
+void framebuffer_size_callback(GLFWwindow *window, int width, int height)
+{
+    window_context_t *window_context = (window_context_t *)glfwGetWindowUserPointer(window);
+
+    // Minimized windows report a zero size, keep rendering at the last one
+    if (width <= 0 || height <= 0)
+    {
+        return;
+    }
+
+    window_context->framebuffer_width = width;
+    window_context->framebuffer_height = height;
+    glViewport(0, 0, width, height);
+    renderer_current->resize(renderer_current, width, height);
+}
+
 void mouse_move_callback(GLFWwindow *window, double xpos, double ypos)
 {
     window_context_t *window_context = (window_context_t *)glfwGetWindowUserPointer(window);
@@ -179,10 +168,32 @@ void mouse_button_callback(GLFWwindow *window, int button, int action, int mods)
     }
 }
 
-int main()
+int main(int argc, char **argv)
 {
     GLFWwindow *window;
 
+    if (argc > 2)
+    {
+        fprintf(stderr, "Usage: %s [scene file written by puregl-convert-scene]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    // The scene reads the file's objects, lights and BVH in place, so it stays mapped until the end
+    scene_t scene = {0};
+    scene_file_t scene_file = {0};
+    if (argc == 2)
+    {
+        if (!scene_file_open(&scene_file, argv[1]))
+        {
+            exit(EXIT_FAILURE);
+        }
+        scene_load_file(&scene, &scene_file);
+    }
+    else
+    {
+        scene_init(&scene);
+    }
+
     glfwSetErrorCallback(error_callback);
 
     if (!glfwInit())
@@ -213,19 +224,17 @@ int main()
     gladLoadGLLoader((GLADloadproc)glfwGetProcAddress);
     glfwSwapInterval(1);
 
-    int window_width;
-    int window_height;
-    glfwGetFramebufferSize(window, &window_width, &window_height);
-    glViewport(0, 0, window_width, window_height);
-
-    scene_t scene;
     ui_state_t ui_state = {0};
     window_context_t window_context = {.scene = &scene, .ui_state = &ui_state};
-    scene_init(&scene);
+
+    glfwGetFramebufferSize(window, &window_context.framebuffer_width, &window_context.framebuffer_height);
+    glViewport(0, 0, window_context.framebuffer_width, window_context.framebuffer_height);
 
     glfwSetWindowUserPointer(window, &window_context);
 
     renderer_current->create(renderer_current);
+    renderer_current->resize(renderer_current, window_context.framebuffer_width, window_context.framebuffer_height);
+    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
 
     double previousTime = glfwGetTime();
     int frameCount = 0;
@@ -241,7 +250,22 @@ int main()
         frameCount++;
         if (currentTime - previousTime >= 1.0)
         {
-            fprintf(stderr, "%d fps\n", frameCount);
+            if (renderer_current == (renderer_t *)&renderer_rasterization)
+            {
+                render_stats_t *stats = &renderer_rasterization.stats;
+                fprintf(stderr, "%d fps, %d draw calls, %d state changes per frame, %d objects visible, %d culled\n", frameCount,
+                        stats->draw_calls, stats->state_changes, renderer_rasterization.visible_object_count, renderer_rasterization.culled_object_count);
+            }
+            else if (renderer_current == (renderer_t *)&renderer_software_rasterization)
+            {
+                software_rasterizer_t *rasterizer = &renderer_software_rasterization.rasterizer;
+                fprintf(stderr, "%d fps, %.1f ms per image, %d triangles, %d objects visible, %d culled\n", frameCount,
+                        renderer_software_rasterization.render_time * 1000.0, rasterizer->triangle_count, rasterizer->visible_object_count, rasterizer->culled_object_count);
+            }
+            else
+            {
+                fprintf(stderr, "%d fps\n", frameCount);
+            }
             frameCount = 0;
             previousTime = currentTime;
         }
@@ -254,5 +278,7 @@ int main()
 
     glfwDestroyWindow(window);
     glfwTerminate();
+    scene_destroy(&scene);
+    scene_file_close(&scene_file);
     exit(EXIT_SUCCESS);
 }
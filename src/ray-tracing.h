@@ -0,0 +1,1724 @@
+#pragma once
+
+#include "scene.h"
+#include "imaging.h"
+#include "math.h"
+#include "thread-pool.h"
+#include "bvh.h"
+#include "denoising.h"
+#include "sampling.h"
+#include "timing.h"
+#include "irradiance-cache.h"
+
+#include <cglm/cglm.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if !defined(RAY_TRACING_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+#define RAY_TRACING_SIMD
+#include <emmintrin.h>
+#endif
+
+void get_object_normal(object_t *object, vec3 p, vec3 normal_dst)
+{
+    vec3 p_normalized;
+
+    switch (object->type)
+    {
+    case OBJECT_TYPE_SPHERE:
+        glm_vec3_copy(p, normal_dst);
+        glm_vec3_normalize(normal_dst);
+        break;
+    case OBJECT_TYPE_CUBE:
+        glm_vec3_copy(p, p_normalized);
+        glm_vec3_div(p_normalized, object->size, p_normalized);
+        if (fabs(p_normalized[0]) > fabs(p_normalized[1]) && fabs(p_normalized[0]) > fabs(p_normalized[2]))
+        {
+            glm_vec3_copy((vec3){glm_signf(p_normalized[0]), 0.0f, 0.0f}, normal_dst);
+        }
+        else if (fabs(p_normalized[1]) > fabs(p_normalized[2]))
+        {
+            glm_vec3_copy((vec3){0.0f, glm_signf(p_normalized[1]), 0.0f}, normal_dst);
+        }
+        else
+        {
+            glm_vec3_copy((vec3){0.0f, 0.0f, glm_signf(p_normalized[2])}, normal_dst);
+        }
+        break;
+    case OBJECT_TYPE_PLANE:
+        glm_vec3_copy(object->normal, normal_dst);
+        break;
+    default:
+        break;
+    }
+}
+
+void intersects_sphere(vec3 ray_origin, vec3 ray_direction, vec3 sphere_position, float sphere_radius, float *t0_dst, float *t1_dst)
+{
+    vec3 ray_origin_model_space;
+    glm_vec3_sub(ray_origin, sphere_position, ray_origin_model_space);
+
+    float a = glm_vec3_norm2(ray_direction);
+    float b = 2.0f * glm_vec3_dot(ray_direction, ray_origin_model_space);
+    float c = glm_vec3_norm2(ray_origin_model_space) - sphere_radius * sphere_radius;
+
+    float discriminant = b * b - 4.0f * a * c;
+    if (discriminant < 0.0f)
+    {
+        *t0_dst = INFINITY;
+        *t1_dst = INFINITY;
+        return;
+    }
+
+    float sqrt_discriminant = sqrtf(discriminant);
+    float q = b < 0.0f ? -0.5f * (b - sqrt_discriminant) : -0.5f * (b + sqrt_discriminant);
+    *t0_dst = q / a;
+    *t1_dst = c / q;
+}
+
+void intersects_plane(vec3 ray_origin, vec3 ray_direction, vec3 plane_normal, float *t0_dst, float *t1_dst)
+{
+    float denominator = glm_vec3_dot(plane_normal, ray_direction);
+    if (fabsf(denominator) < 0.0001f)
+    {
+        *t0_dst = INFINITY;
+        *t1_dst = INFINITY;
+        return;
+    }
+
+    float t = -glm_vec3_dot(ray_origin, plane_normal) / denominator;
+    *t0_dst = t;
+    *t1_dst = t;
+}
+
+void intersects_cube(vec3 ray_origin, vec3 ray_direction, vec3 cube_position, vec3 cube_size, float *t0_dst, float *t1_dst)
+{
+    float t_near = -INFINITY;
+    float t_far = INFINITY;
+
+    for (int i = 0; i < 3; i++)
+    {
+        if (ray_direction[i] == 0.0f)
+        {
+            if (ray_origin[i] < cube_position[i] - cube_size[i] / 2.0f || ray_origin[i] > cube_position[i] + cube_size[i] / 2.0f)
+            {
+                *t0_dst = INFINITY;
+                *t1_dst = INFINITY;
+                return;
+            }
+        }
+        else
+        {
+            float t1 = (cube_position[i] - cube_size[i] / 2.0f - ray_origin[i]) / ray_direction[i];
+            float t2 = (cube_position[i] + cube_size[i] / 2.0f - ray_origin[i]) / ray_direction[i];
+
+            if (t1 > t2)
+            {
+                float tmp = t1;
+                t1 = t2;
+                t2 = tmp;
+            }
+
+            if (t1 > t_near)
+            {
+                t_near = t1;
+            }
+
+            if (t2 < t_far)
+            {
+                t_far = t2;
+            }
+
+            if (t_near > t_far)
+            {
+                *t0_dst = INFINITY;
+                *t1_dst = INFINITY;
+                return;
+            }
+
+            if (t_far < 0.0f)
+            {
+                *t0_dst = INFINITY;
+                *t1_dst = INFINITY;
+                return;
+            }
+        }
+    }
+
+    *t0_dst = t_near;
+    *t1_dst = t_far;
+}
+
+void intersects(vec3 ray_origin, vec3 ray_direction, object_t *object, float *t0_dst, float *t1_dst)
+{
+    vec3 ray_origin_model_space;
+
+    switch (object->type)
+    {
+    case OBJECT_TYPE_SPHERE:
+        intersects_sphere(ray_origin, ray_direction, object->position, object->radius, t0_dst, t1_dst);
+        break;
+    case OBJECT_TYPE_CUBE:
+        glm_vec3_sub(ray_origin, object->position, ray_origin_model_space);
+        intersects_cube(ray_origin_model_space, ray_direction, (vec3){0.0f, 0.0f, 0.0f}, object->size, t0_dst, t1_dst);
+        break;
+    case OBJECT_TYPE_PLANE:
+        glm_vec3_sub(ray_origin, object->position, ray_origin_model_space);
+        intersects_plane(ray_origin_model_space, ray_direction, object->normal, t0_dst, t1_dst);
+        break;
+    default:
+        break;
+    }
+}
+
+typedef struct
+{
+    object_t *object;
+    vec3 position;
+} hit_t;
+
+hit_t make_hit(object_t *object, vec3 position)
+{
+    hit_t hit = (hit_t){.object = object};
+    glm_vec3_copy(position, hit.position);
+    return hit;
+}
+
+void get_light_direction(vec3 hit_position, vec4 light_position, vec3 light_direction_dst)
+{
+    if (light_position[3] == 0.0f)
+    {
+        glm_vec3_copy(light_position, light_direction_dst);
+    }
+    else
+    {
+        glm_vec3_sub(light_position, hit_position, light_direction_dst);
+        glm_vec3_normalize(light_direction_dst);
+    }
+}
+
+// The diffuse term of blinn_phong_shade alone, which is the same from every direction
+void diffuse_shade(vec3 hit_position, vec3 normal, vec4 light_position, vec3 light_color, material_t *material, vec3 color_dst)
+{
+    vec3 light_direction;
+    get_light_direction(hit_position, light_position, light_direction);
+
+    float diffuse_intensity = glm_max(glm_vec3_dot(normal, light_direction), 0.0f);
+    glm_vec3_scale(light_color, diffuse_intensity, color_dst);
+    glm_vec3_mul(color_dst, material->base_color, color_dst);
+}
+
+void blinn_phong_shade(vec3 hit_position, vec3 normal, vec4 light_position, vec3 camera_position, vec3 light_color, material_t *material, vec3 color_dst)
+{
+    vec3 light_direction;
+    get_light_direction(hit_position, light_position, light_direction);
+
+    float diffuse_intensity = glm_max(glm_vec3_dot(normal, light_direction), 0.0f);
+    vec3 diffuse;
+    glm_vec3_scale(light_color, diffuse_intensity, diffuse);
+    glm_vec3_mul(diffuse, material->base_color, diffuse);
+
+    vec3 view_direction;
+    glm_vec3_sub(camera_position, hit_position, view_direction);
+    glm_vec3_normalize(view_direction);
+
+    vec3 halfway_direction;
+    glm_vec3_add(light_direction, view_direction, halfway_direction);
+    glm_vec3_normalize(halfway_direction);
+
+    float specular_intensity = powf(glm_max(glm_vec3_dot(normal, halfway_direction), 0.0f), material->shininess);
+    vec3 specular;
+    glm_vec3_scale(light_color, material->specular * specular_intensity, specular);
+
+    glm_vec3_add(diffuse, specular, color_dst);
+}
+
+// Nearest intersection in front of the ray origin
+bool intersects_nearest(vec3 ray_origin, vec3 ray_direction, object_t *object, float *t_dst)
+{
+    float t0, t1;
+    intersects(ray_origin, ray_direction, object, &t0, &t1);
+
+    if (t0 > t1)
+    {
+        float tmp = t0;
+        t0 = t1;
+        t1 = tmp;
+    }
+
+    if (t0 < 0.0f)
+    {
+        t0 = t1;
+        if (t0 < 0.0f)
+        {
+            return false;
+        }
+    }
+
+    *t_dst = t0;
+    return true;
+}
+
+#ifdef RAY_TRACING_SIMD
+__m128 select_ps(__m128 mask, __m128 a, __m128 b)
+{
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+// Intersects the 4 objects starting at first in a single pass, INFINITY for misses.
+// Mirrors the arithmetic of intersects_sphere, intersects_cube and intersects_nearest operation by operation,
+// so the distances are bit-identical to the scalar path.
+__m128 intersects_nearest_4(vec3 ray_origin, vec3 ray_direction, object_soa_t *soa, int first)
+{
+    __m128 infinity = _mm_set1_ps(INFINITY);
+    __m128 zero = _mm_setzero_ps();
+
+    __m128 origin[3];
+    __m128 direction[3];
+    for (int i = 0; i < 3; i++)
+    {
+        origin[i] = _mm_sub_ps(_mm_set1_ps(ray_origin[i]), _mm_loadu_ps(&soa->position[i][first]));
+        direction[i] = _mm_set1_ps(ray_direction[i]);
+    }
+
+    // Spheres
+    __m128 a = _mm_set1_ps(glm_vec3_norm2(ray_direction));
+    __m128 direction_dot_origin = _mm_add_ps(_mm_add_ps(_mm_mul_ps(direction[0], origin[0]), _mm_mul_ps(direction[1], origin[1])), _mm_mul_ps(direction[2], origin[2]));
+    __m128 b = _mm_mul_ps(_mm_set1_ps(2.0f), direction_dot_origin);
+    __m128 origin_norm2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(origin[0], origin[0]), _mm_mul_ps(origin[1], origin[1])), _mm_mul_ps(origin[2], origin[2]));
+    __m128 c = _mm_sub_ps(origin_norm2, _mm_loadu_ps(&soa->radius_squared[first]));
+
+    __m128 discriminant = _mm_sub_ps(_mm_mul_ps(b, b), _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(4.0f), a), c));
+    __m128 sphere_miss = _mm_cmplt_ps(discriminant, zero);
+    __m128 sqrt_discriminant = _mm_sqrt_ps(discriminant);
+    __m128 q = select_ps(
+        _mm_cmplt_ps(b, zero),
+        _mm_mul_ps(_mm_set1_ps(-0.5f), _mm_sub_ps(b, sqrt_discriminant)),
+        _mm_mul_ps(_mm_set1_ps(-0.5f), _mm_add_ps(b, sqrt_discriminant)));
+    __m128 sphere_t0 = select_ps(sphere_miss, infinity, _mm_div_ps(q, a));
+    __m128 sphere_t1 = select_ps(sphere_miss, infinity, _mm_div_ps(c, q));
+
+    // Cubes
+    __m128 t_near = _mm_set1_ps(-INFINITY);
+    __m128 t_far = infinity;
+    __m128 cube_miss = zero;
+    for (int i = 0; i < 3; i++)
+    {
+        __m128 half_size = _mm_loadu_ps(&soa->half_size[i][first]);
+        __m128 half_size_negative = _mm_sub_ps(zero, half_size);
+
+        if (ray_direction[i] == 0.0f)
+        {
+            cube_miss = _mm_or_ps(cube_miss, _mm_or_ps(_mm_cmplt_ps(origin[i], half_size_negative), _mm_cmpgt_ps(origin[i], half_size)));
+            continue;
+        }
+
+        __m128 t1 = _mm_div_ps(_mm_sub_ps(half_size_negative, origin[i]), direction[i]);
+        __m128 t2 = _mm_div_ps(_mm_sub_ps(half_size, origin[i]), direction[i]);
+        __m128 swap = _mm_cmpgt_ps(t1, t2);
+        __m128 t_min = select_ps(swap, t2, t1);
+        __m128 t_max = select_ps(swap, t1, t2);
+
+        t_near = select_ps(_mm_cmpgt_ps(t_min, t_near), t_min, t_near);
+        t_far = select_ps(_mm_cmplt_ps(t_max, t_far), t_max, t_far);
+        cube_miss = _mm_or_ps(cube_miss, _mm_or_ps(_mm_cmpgt_ps(t_near, t_far), _mm_cmplt_ps(t_far, zero)));
+    }
+    __m128 cube_t0 = select_ps(cube_miss, infinity, t_near);
+    __m128 cube_t1 = select_ps(cube_miss, infinity, t_far);
+
+    __m128i type = _mm_loadu_si128((__m128i *)&soa->type[first]);
+    __m128 is_sphere = _mm_castsi128_ps(_mm_cmpeq_epi32(type, _mm_set1_epi32(OBJECT_TYPE_SPHERE)));
+    __m128 is_cube = _mm_castsi128_ps(_mm_cmpeq_epi32(type, _mm_set1_epi32(OBJECT_TYPE_CUBE)));
+    __m128 t0 = select_ps(is_sphere, sphere_t0, select_ps(is_cube, cube_t0, infinity));
+    __m128 t1 = select_ps(is_sphere, sphere_t1, select_ps(is_cube, cube_t1, infinity));
+
+    // Nearest intersection in front of the ray origin
+    __m128 swap = _mm_cmpgt_ps(t0, t1);
+    __m128 t_min = select_ps(swap, t1, t0);
+    __m128 t_max = select_ps(swap, t0, t1);
+    t0 = select_ps(_mm_cmplt_ps(t_min, zero), t_max, t_min);
+    return select_ps(_mm_cmplt_ps(t0, zero), infinity, t0);
+}
+#endif
+
+bool intersects_aabb(vec3 ray_origin, vec3 ray_direction_inv, vec3 bounds_min, vec3 bounds_max, float max_distance, float *t_dst)
+{
+    float t_near = 0.0f;
+    float t_far = max_distance;
+
+    for (int i = 0; i < 3; i++)
+    {
+        float t1 = (bounds_min[i] - ray_origin[i]) * ray_direction_inv[i];
+        float t2 = (bounds_max[i] - ray_origin[i]) * ray_direction_inv[i];
+        t_near = glm_max(t_near, glm_min(t1, t2));
+        t_far = glm_min(t_far, glm_max(t1, t2));
+    }
+
+    *t_dst = t_near;
+    return t_near <= t_far;
+}
+
+void cast_ray(vec3 origin, vec3 direction, scene_t *scene, bvh_t *bvh, float max_distance, hit_t *hit_dst)
+{
+    float t = max_distance;
+    object_t *hit_object = NULL;
+
+    for (int i = 0; i < bvh->unbounded_object_count; i++)
+    {
+        object_t *object = &scene->objects[bvh->unbounded_object_indices[i]];
+
+        float t_object;
+        if (intersects_nearest(origin, direction, object, &t_object) && t_object < t)
+        {
+            t = t_object;
+            hit_object = object;
+        }
+    }
+
+    vec3 direction_inv = {1.0f / direction[0], 1.0f / direction[1], 1.0f / direction[2]};
+
+    struct
+    {
+        int node_index;
+        float t;
+    } stack[BVH_MAX_DEPTH + 1];
+    int stack_size = 0;
+
+    float t_root;
+    if (bvh->node_count > 0 && intersects_aabb(origin, direction_inv, bvh->nodes[0].bounds_min, bvh->nodes[0].bounds_max, t, &t_root))
+    {
+        stack[stack_size].node_index = 0;
+        stack[stack_size].t = t_root;
+        stack_size++;
+    }
+
+    while (stack_size > 0)
+    {
+        stack_size--;
+        if (stack[stack_size].t > t)
+        {
+            // A closer hit was found after this node was pushed
+            continue;
+        }
+
+        bvh_node_t *node = &bvh->nodes[stack[stack_size].node_index];
+
+        if (node->count > 0)
+        {
+#ifdef RAY_TRACING_SIMD
+            float t_objects[BVH_MAX_LEAF_SIZE];
+            _mm_storeu_ps(t_objects, intersects_nearest_4(origin, direction, &bvh->soa, node->first));
+            for (int i = 0; i < node->count; i++)
+            {
+                if (t_objects[i] < t)
+                {
+                    t = t_objects[i];
+                    hit_object = &scene->objects[bvh->object_indices[node->first + i]];
+                }
+            }
+#else
+            for (int i = node->first; i < node->first + node->count; i++)
+            {
+                object_t *object = &scene->objects[bvh->object_indices[i]];
+
+                float t_object;
+                if (intersects_nearest(origin, direction, object, &t_object) && t_object < t)
+                {
+                    t = t_object;
+                    hit_object = object;
+                }
+            }
+#endif
+            continue;
+        }
+
+        int near_index = node->first;
+        int far_index = node->first + 1;
+        float t_near, t_far;
+        bool near_hit = intersects_aabb(origin, direction_inv, bvh->nodes[near_index].bounds_min, bvh->nodes[near_index].bounds_max, t, &t_near);
+        bool far_hit = intersects_aabb(origin, direction_inv, bvh->nodes[far_index].bounds_min, bvh->nodes[far_index].bounds_max, t, &t_far);
+
+        if (near_hit && far_hit && t_far < t_near)
+        {
+            int tmp_index = near_index;
+            near_index = far_index;
+            far_index = tmp_index;
+            float tmp_t = t_near;
+            t_near = t_far;
+            t_far = tmp_t;
+        }
+
+        // The nearer child is pushed last so it is visited first
+        if (far_hit)
+        {
+            stack[stack_size].node_index = far_index;
+            stack[stack_size].t = t_far;
+            stack_size++;
+        }
+        if (near_hit)
+        {
+            stack[stack_size].node_index = near_index;
+            stack[stack_size].t = t_near;
+            stack_size++;
+        }
+    }
+
+    if (hit_object != NULL)
+    {
+        vec3 ray_position;
+        glm_vec3_scale(direction, t, ray_position);
+        glm_vec3_add(origin, ray_position, ray_position);
+
+        hit_dst->object = hit_object;
+        glm_vec3_copy(ray_position, hit_dst->position);
+    }
+    else
+    {
+        hit_dst->object = NULL;
+    }
+}
+
+#define SHADOW_RAY_BATCH_SIZE 32
+
+// Segment from origin to max_distance along direction, checked for any blocker
+typedef struct
+{
+    vec3 origin;
+    vec3 direction;
+    float max_distance;
+    int *occluder_hint; // object that blocked a nearby ray before, tested first and updated, may be NULL
+    bool occluded;
+} shadow_ray_t;
+
+bool intersects_before(vec3 ray_origin, vec3 ray_direction, object_t *object, float max_distance)
+{
+    float t;
+    return intersects_nearest(ray_origin, ray_direction, object, &t) && t < max_distance;
+}
+
+// Rays of ray_mask whose segments overlap the node's bounds
+uint32_t shadow_rays_intersect_node(shadow_ray_t *rays, int ray_count, vec3 *directions_inv, uint32_t ray_mask, bvh_node_t *node)
+{
+    uint32_t hit_mask = 0;
+    for (int i = 0; i < ray_count; i++)
+    {
+        float t;
+        if ((ray_mask >> i & 1) && intersects_aabb(rays[i].origin, directions_inv[i], node->bounds_min, node->bounds_max, rays[i].max_distance, &t))
+        {
+            hit_mask |= 1u << i;
+        }
+    }
+    return hit_mask;
+}
+
+// Index of any object of the leaf blocking the ray, -1 if none does
+int shadow_ray_intersect_leaf(shadow_ray_t *ray, bvh_t *bvh, bvh_node_t *node, scene_t *scene)
+{
+#ifdef RAY_TRACING_SIMD
+    __m128 t = intersects_nearest_4(ray->origin, ray->direction, &bvh->soa, node->first);
+    int blocked_mask = _mm_movemask_ps(_mm_cmplt_ps(t, _mm_set1_ps(ray->max_distance))) & ((1 << node->count) - 1);
+    for (int i = 0; i < node->count; i++)
+    {
+        if (blocked_mask >> i & 1)
+        {
+            return bvh->object_indices[node->first + i];
+        }
+    }
+#else
+    for (int i = node->first; i < node->first + node->count; i++)
+    {
+        if (intersects_before(ray->origin, ray->direction, &scene->objects[bvh->object_indices[i]], ray->max_distance))
+        {
+            return bvh->object_indices[i];
+        }
+    }
+#endif
+    return -1;
+}
+
+// Any-hit query for up to SHADOW_RAY_BATCH_SIZE rays sharing one BVH traversal, a node is visited once for all rays overlapping it.
+// Rays stop at the first blocker found instead of the nearest one, and the traversal stops once every ray is blocked.
+void occluded_batch(shadow_ray_t *rays, int ray_count, scene_t *scene, bvh_t *bvh)
+{
+    uint32_t active_mask = 0;
+    vec3 directions_inv[SHADOW_RAY_BATCH_SIZE];
+    for (int i = 0; i < ray_count; i++)
+    {
+        shadow_ray_t *ray = &rays[i];
+        ray->occluded = false;
+
+        // Neighbouring shading points are usually blocked by the same object
+        int hint = ray->occluder_hint != NULL ? *ray->occluder_hint : -1;
+        if (hint >= 0 && hint < scene->object_count && intersects_before(ray->origin, ray->direction, &scene->objects[hint], ray->max_distance))
+        {
+            ray->occluded = true;
+            continue;
+        }
+
+        for (int j = 0; j < bvh->unbounded_object_count; j++)
+        {
+            int object_index = bvh->unbounded_object_indices[j];
+            if (intersects_before(ray->origin, ray->direction, &scene->objects[object_index], ray->max_distance))
+            {
+                ray->occluded = true;
+                if (ray->occluder_hint != NULL)
+                {
+                    *ray->occluder_hint = object_index;
+                }
+                break;
+            }
+        }
+
+        if (!ray->occluded)
+        {
+            glm_vec3_copy((vec3){1.0f / ray->direction[0], 1.0f / ray->direction[1], 1.0f / ray->direction[2]}, directions_inv[i]);
+            active_mask |= 1u << i;
+        }
+    }
+
+    struct
+    {
+        int node_index;
+        uint32_t ray_mask; // rays overlapping the node's bounds
+    } stack[BVH_MAX_DEPTH + 1];
+    int stack_size = 0;
+
+    if (bvh->node_count > 0 && active_mask != 0)
+    {
+        stack[stack_size].node_index = 0;
+        stack[stack_size].ray_mask = shadow_rays_intersect_node(rays, ray_count, directions_inv, active_mask, &bvh->nodes[0]);
+        stack_size++;
+    }
+
+    while (stack_size > 0 && active_mask != 0)
+    {
+        stack_size--;
+        bvh_node_t *node = &bvh->nodes[stack[stack_size].node_index];
+        // Rays blocked after the node was pushed are done
+        uint32_t ray_mask = stack[stack_size].ray_mask & active_mask;
+        if (ray_mask == 0)
+        {
+            continue;
+        }
+
+        if (node->count > 0)
+        {
+            for (int i = 0; i < ray_count; i++)
+            {
+                if (!(ray_mask >> i & 1))
+                {
+                    continue;
+                }
+
+                int object_index = shadow_ray_intersect_leaf(&rays[i], bvh, node, scene);
+                if (object_index >= 0)
+                {
+                    rays[i].occluded = true;
+                    if (rays[i].occluder_hint != NULL)
+                    {
+                        *rays[i].occluder_hint = object_index;
+                    }
+                    active_mask &= ~(1u << i);
+                }
+            }
+            continue;
+        }
+
+        for (int child = 0; child < 2; child++)
+        {
+            uint32_t child_mask = shadow_rays_intersect_node(rays, ray_count, directions_inv, ray_mask, &bvh->nodes[node->first + child]);
+            if (child_mask != 0)
+            {
+                stack[stack_size].node_index = node->first + child;
+                stack[stack_size].ray_mask = child_mask;
+                stack_size++;
+            }
+        }
+    }
+}
+
+// Whether anything blocks the segment, occluder_hint as in shadow_ray_t
+bool occluded(vec3 origin, vec3 direction, scene_t *scene, bvh_t *bvh, float max_distance, int *occluder_hint)
+{
+    shadow_ray_t ray = {.max_distance = max_distance, .occluder_hint = occluder_hint};
+    glm_vec3_copy(origin, ray.origin);
+    glm_vec3_copy(direction, ray.direction);
+    occluded_batch(&ray, 1, scene, bvh);
+    return ray.occluded;
+}
+
+#define TILE_SIZE 32
+// Pixels of every INTERLEAVE_SIZE x INTERLEAVE_SIZE block are traced in separate phases of a pass, so a partial pass still covers the image
+#define INTERLEAVE_SIZE 2
+#define INTERLEAVE_PHASE_COUNT (INTERLEAVE_SIZE * INTERLEAVE_SIZE)
+// Work units handed to every worker between checks of the frame time budget
+#define WORK_UNITS_PER_BATCH 4
+
+typedef struct
+{
+    pcg32_t rng;
+    unsigned long long ray_count;
+    int *occluder_hints;       // last object that blocked each light, for primary hits and then for bounce hits
+    vec3 *light_contributions; // scratch space for one pixel's shading of every light
+    char padding[24];          // keeps workers on separate cache lines
+} ray_tracing_worker_t;
+
+// Visibility of one light from one pixel's primary hit
+typedef struct
+{
+    uint16_t sample_count;
+    uint16_t hit_count;
+} shadow_sample_t;
+
+typedef struct
+{
+    vec3 mean;
+    unsigned int sample_count;
+} bounce_sample_t;
+
+// Primary hit of one pixel, a G-buffer entry: every pass of its generation shades it instead of casting the primary ray
+// again, and the next camera's pixels are matched against it when reprojecting
+typedef struct
+{
+    vec3 position;
+    float depth; // distance from the camera
+    vec3 normal;
+    int object_index;    // -1 if the primary ray missed
+    uint32_t generation; // the pixel's samples belong to this ray tracer generation
+} surface_t;
+
+// Running luminance statistics of one pixel's samples (Welford), adaptive sampling estimates the pixel's error from them
+typedef struct
+{
+    float mean;
+    float m2;        // sum of squared differences from the mean
+    float max_value; // luminance of a sample that sees every light unoccluded
+    uint32_t sample_count;
+    uint32_t sample_index; // next index in the pixel's sample sequence
+} pixel_statistics_t;
+
+// Samples accumulated for one camera, light_count shadow samples per pixel followed by the next pixel's
+typedef struct
+{
+    shadow_sample_t *shadow_samples;
+    bounce_sample_t *bounce_samples;
+    pixel_statistics_t *statistics;
+    surface_t *surfaces;
+    mat4 projection_view;
+    vec3 camera_position;
+} accumulation_buffer_t;
+
+#define HISTORY_MAX_SAMPLE_COUNT 32
+// Reprojected samples are only reused if the previous pixel saw the same point at the same distance and orientation
+#define HISTORY_DEPTH_TOLERANCE 0.05f
+#define HISTORY_NORMAL_TOLERANCE 0.9f
+
+// Pixels take at least ADAPTIVE_MIN_SAMPLE_COUNT samples before their variance is trusted,
+// and are frozen once the bound on the standard error of their luminance is below one display level
+#define ADAPTIVE_MIN_SAMPLE_COUNT 8
+#define ADAPTIVE_MAX_SAMPLES_PER_PASS 8
+#define ADAPTIVE_ERROR_THRESHOLD (1.0f / 255.0f)
+#define ADAPTIVE_ERROR_BOUND_WEIGHT 0.1f
+#define ADAPTIVE_MIN_RANGE 0.25f
+
+typedef struct
+{
+    thread_pool_t thread_pool;
+    ray_tracing_worker_t *workers;
+    bvh_t bvh;
+    unsigned int bvh_content_id; // scene content the BVH was built for
+    irradiance_cache_t irradiance_cache; // of bounce hits, kept until the scene content changes
+
+    // Samples for the current camera and for the previous one, which pixels start from after a camera move.
+    // Tiles never overlap, so every pixel's entries are only touched by the worker rendering its tile.
+    accumulation_buffer_t accumulation;
+    accumulation_buffer_t history;
+    int cache_width;
+    int cache_height;
+    int cache_light_count;
+    unsigned int cache_id;         // scene the samples were taken in
+    unsigned int cache_content_id; // scene content the samples were taken in
+    // Incremented on camera moves and by 2 on any other change, so only history from the previous camera matches generation - 1
+    uint32_t generation;
+
+    sampler_type_t sampler_type;
+
+    // A pass traces every pixel once, in INTERLEAVE_PHASE_COUNT * tile count work units ordered by phase then tile.
+    // With a frame time budget, render_to_image stops before the batch that would exceed it and the next call resumes the pass.
+    float frame_time_budget; // milliseconds, 0 to finish a whole pass every call
+    int next_work_unit;
+    unsigned long long pass_start_ray_count;
+    bool converged; // the last complete pass traced no rays, so passes change nothing until the scene or size does
+
+    // Adaptive sampling spreads samples_per_pass * pixel count samples over the pixels by their estimated error,
+    // otherwise every pixel takes one sample per pass
+    bool adaptive_sampling;
+    float samples_per_pass;
+    float samples_per_error; // adaptive samples a pixel takes per unit of its error in the current pass
+    float *pixel_errors; // standard error of every pixel's luminance, 0 for frozen pixels
+    double *tile_errors;        // sum of pixel_errors per tile
+    double *tile_sample_budgets; // samples a tile's error-driven pixels get, what its surface pixels are owed minus the forced samples
+
+    // Filters the noise left in the accumulated shadows and bounces of every image before it is returned, see denoising.h
+    bool denoising;
+    denoiser_t denoiser;
+    float denoising_time; // milliseconds the last image took to denoise, kept out of the frame time budget's tracing
+
+    // Shares the diffuse light of bounce hits between nearby hits, off by default because it doesn't pay off yet, see
+    // irradiance-cache.h
+    bool irradiance_caching;
+} ray_tracer_t;
+
+// State shared by all tiles of a frame
+typedef struct
+{
+    ray_tracer_t *ray_tracer;
+    scene_t *scene;
+    framebuffer_t *framebuffer;
+    int width;
+    int height;
+    mat4 projection_inv;
+    mat4 view_inv;
+    int first_work_unit; // of the batch being rendered
+} render_frame_t;
+
+void accumulation_buffer_destroy(accumulation_buffer_t *buffer)
+{
+    free(buffer->shadow_samples);
+    free(buffer->bounce_samples);
+    free(buffer->statistics);
+    free(buffer->surfaces);
+    *buffer = (accumulation_buffer_t){0};
+}
+
+void accumulation_buffer_resize(accumulation_buffer_t *buffer, size_t pixel_count, int light_count)
+{
+    accumulation_buffer_destroy(buffer);
+    buffer->shadow_samples = malloc(sizeof(shadow_sample_t) * pixel_count * light_count);
+    buffer->bounce_samples = malloc(sizeof(bounce_sample_t) * pixel_count);
+    buffer->statistics = malloc(sizeof(pixel_statistics_t) * pixel_count);
+    // Zeroed generations mark every pixel as not rendered yet
+    buffer->surfaces = calloc(pixel_count, sizeof(surface_t));
+    if ((buffer->shadow_samples == NULL && pixel_count * light_count > 0) || (buffer->bounce_samples == NULL && pixel_count > 0) ||
+        (buffer->statistics == NULL && pixel_count > 0) || (buffer->surfaces == NULL && pixel_count > 0))
+    {
+        fprintf(stderr, "Error: failed to allocate ray tracing caches\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void ray_tracer_create(ray_tracer_t *ray_tracer, int thread_count)
+{
+    *ray_tracer = (ray_tracer_t){.sampler_type = SAMPLER_TYPE_SOBOL, .adaptive_sampling = true, .samples_per_pass = 1.0f, .denoising = true};
+    thread_pool_create(&ray_tracer->thread_pool, thread_count);
+    irradiance_cache_create(&ray_tracer->irradiance_cache);
+    ray_tracer->workers = calloc(ray_tracer->thread_pool.worker_count, sizeof(ray_tracing_worker_t));
+    if (ray_tracer->workers == NULL)
+    {
+        fprintf(stderr, "Error: failed to allocate ray tracing workers\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < ray_tracer->thread_pool.worker_count; i++)
+    {
+        pcg32_seed(&ray_tracer->workers[i].rng, 0x853c49e6748fea9bULL, i);
+    }
+}
+
+void ray_tracer_destroy(ray_tracer_t *ray_tracer)
+{
+    for (int i = 0; i < ray_tracer->thread_pool.worker_count; i++)
+    {
+        free(ray_tracer->workers[i].occluder_hints);
+        free(ray_tracer->workers[i].light_contributions);
+    }
+    thread_pool_destroy(&ray_tracer->thread_pool);
+    free(ray_tracer->workers);
+    accumulation_buffer_destroy(&ray_tracer->accumulation);
+    accumulation_buffer_destroy(&ray_tracer->history);
+    free(ray_tracer->pixel_errors);
+    free(ray_tracer->tile_errors);
+    free(ray_tracer->tile_sample_budgets);
+    denoiser_destroy(&ray_tracer->denoiser);
+    irradiance_cache_destroy(&ray_tracer->irradiance_cache);
+    bvh_destroy(&ray_tracer->bvh);
+    *ray_tracer = (ray_tracer_t){.sampler_type = SAMPLER_TYPE_SOBOL, .adaptive_sampling = true, .samples_per_pass = 1.0f, .denoising = true};
+}
+
+unsigned long long ray_tracer_get_ray_count(ray_tracer_t *ray_tracer)
+{
+    unsigned long long ray_count = 0;
+    for (int i = 0; i < ray_tracer->thread_pool.worker_count; i++)
+    {
+        ray_count += ray_tracer->workers[i].ray_count;
+    }
+    return ray_count;
+}
+
+void shadow_sample_add(shadow_sample_t *shadow_sample, bool light_visible)
+{
+    if (shadow_sample->sample_count == UINT16_MAX)
+    {
+        // Halving both counters keeps the estimate and turns it into a long moving average
+        shadow_sample->sample_count /= 2;
+        shadow_sample->hit_count /= 2;
+    }
+
+    shadow_sample->sample_count++;
+    if (light_visible)
+    {
+        shadow_sample->hit_count++;
+    }
+}
+
+void bounce_sample_add(bounce_sample_t *bounce_sample, vec3 value)
+{
+    if (bounce_sample->sample_count < UINT16_MAX)
+    {
+        bounce_sample->sample_count++;
+    }
+
+    // Running mean, so the value never grows with the sample count
+    vec3 delta;
+    glm_vec3_sub(value, bounce_sample->mean, delta);
+    glm_vec3_scale(delta, 1.0f / (float)bounce_sample->sample_count, delta);
+    glm_vec3_add(bounce_sample->mean, delta, bounce_sample->mean);
+}
+
+void pixel_statistics_add(pixel_statistics_t *statistics, float value)
+{
+    statistics->sample_count++;
+    float delta = value - statistics->mean;
+    statistics->mean += delta / statistics->sample_count;
+    statistics->m2 += delta * (value - statistics->mean);
+}
+
+// Standard error of the pixel's mean luminance
+float pixel_statistics_get_error(pixel_statistics_t *statistics)
+{
+    return sqrtf(statistics->m2 / (statistics->sample_count - 1) / statistics->sample_count);
+}
+
+// Pessimistic standard error: one more sample at whichever end of the possible range is farther from the mean is assumed,
+// so a few samples that happened to agree (a penumbra pixel that only saw the light so far) aren't taken for convergence
+float pixel_statistics_get_error_bound(pixel_statistics_t *statistics)
+{
+    // Bounce light isn't bounded by the lights' direct contribution
+    float range = glm_max(statistics->max_value, ADAPTIVE_MIN_RANGE);
+    float outlier = statistics->mean > range / 2.0f ? 0.0f : range;
+    float sample_count = statistics->sample_count + 1.0f;
+    float delta = outlier - statistics->mean;
+    float m2 = statistics->m2 + delta * delta * (sample_count - 1.0f) / sample_count;
+    return sqrtf(m2 / (sample_count - 1.0f) / sample_count);
+}
+
+// Sizes the sample caches to the frame and the scene's lights and starts a new generation when the scene changed.
+// Pixels reset their samples lazily once they see the new generation, see reproject_pixel.
+void ray_tracer_update_caches(ray_tracer_t *ray_tracer, scene_t *scene, int width, int height, mat4 projection_view)
+{
+    bool resized = ray_tracer->cache_width != width || ray_tracer->cache_height != height || ray_tracer->cache_light_count != scene->light_count;
+    if (resized)
+    {
+        size_t pixel_count = (size_t)width * height;
+        accumulation_buffer_resize(&ray_tracer->accumulation, pixel_count, scene->light_count);
+        accumulation_buffer_resize(&ray_tracer->history, pixel_count, scene->light_count);
+        ray_tracer->cache_width = width;
+        ray_tracer->cache_height = height;
+        ray_tracer->cache_light_count = scene->light_count;
+
+        for (int i = 0; i < ray_tracer->thread_pool.worker_count; i++)
+        {
+            ray_tracing_worker_t *worker = &ray_tracer->workers[i];
+            free(worker->occluder_hints);
+            free(worker->light_contributions);
+            worker->occluder_hints = malloc(sizeof(int) * 2 * scene->light_count);
+            worker->light_contributions = malloc(sizeof(vec3) * scene->light_count);
+            if ((worker->occluder_hints == NULL || worker->light_contributions == NULL) && scene->light_count > 0)
+            {
+                fprintf(stderr, "Error: failed to allocate ray tracing caches\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        int tile_count = ((width + TILE_SIZE - 1) / TILE_SIZE) * ((height + TILE_SIZE - 1) / TILE_SIZE);
+        free(ray_tracer->pixel_errors);
+        free(ray_tracer->tile_errors);
+        free(ray_tracer->tile_sample_budgets);
+        ray_tracer->pixel_errors = malloc(sizeof(float) * pixel_count);
+        ray_tracer->tile_errors = malloc(sizeof(double) * tile_count);
+        ray_tracer->tile_sample_budgets = malloc(sizeof(double) * tile_count);
+        if ((ray_tracer->pixel_errors == NULL && pixel_count > 0) ||
+            ((ray_tracer->tile_errors == NULL || ray_tracer->tile_sample_budgets == NULL) && tile_count > 0))
+        {
+            fprintf(stderr, "Error: failed to allocate ray tracing caches\n");
+            exit(EXIT_FAILURE);
+        }
+
+        denoiser_resize(&ray_tracer->denoiser, width, height);
+    }
+
+    if (resized || ray_tracer->cache_content_id != scene->content_id)
+    {
+        // Objects or lights changed, so no earlier sample is valid
+        ray_tracer->generation += 2;
+        if (ray_tracer->cache_content_id != scene->content_id)
+        {
+            // Light leaving bounce hits only depends on the scene content, a resize keeps it
+            irradiance_cache_clear(&ray_tracer->irradiance_cache);
+        }
+
+        for (int i = 0; i < ray_tracer->thread_pool.worker_count; i++)
+        {
+            for (int j = 0; j < 2 * scene->light_count; j++)
+            {
+                ray_tracer->workers[i].occluder_hints[j] = -1;
+            }
+        }
+    }
+    else if (ray_tracer->cache_id != scene->id)
+    {
+        // Only the camera moved, the samples become the history the new camera's pixels are reprojected from
+        accumulation_buffer_t accumulation = ray_tracer->accumulation;
+        ray_tracer->accumulation = ray_tracer->history;
+        ray_tracer->history = accumulation;
+        ray_tracer->generation++;
+    }
+    else
+    {
+        return;
+    }
+
+    ray_tracer->cache_id = scene->id;
+    ray_tracer->cache_content_id = scene->content_id;
+    ray_tracer->next_work_unit = 0;
+    ray_tracer->converged = false;
+    glm_mat4_copy(projection_view, ray_tracer->accumulation.projection_view);
+    glm_vec3_copy(scene->camera.position, ray_tracer->accumulation.camera_position);
+}
+
+// Starts a pixel's samples for the current generation from the previous camera's pixel that saw the same surface point,
+// or from scratch if none did. History is capped so stale view-dependent shading fades out quickly.
+void reproject_pixel(render_frame_t *frame, size_t pixel_index)
+{
+    ray_tracer_t *ray_tracer = frame->ray_tracer;
+    int light_count = frame->scene->light_count;
+    surface_t *surface = &ray_tracer->accumulation.surfaces[pixel_index];
+    shadow_sample_t *shadow_samples = &ray_tracer->accumulation.shadow_samples[pixel_index * light_count];
+    bounce_sample_t *bounce_sample = &ray_tracer->accumulation.bounce_samples[pixel_index];
+
+    pixel_statistics_t *statistics = &ray_tracer->accumulation.statistics[pixel_index];
+
+    memset(shadow_samples, 0, sizeof(shadow_sample_t) * light_count);
+    *bounce_sample = (bounce_sample_t){0};
+    *statistics = (pixel_statistics_t){0};
+
+    if (surface->object_index < 0)
+    {
+        return;
+    }
+
+    accumulation_buffer_t *history = &ray_tracer->history;
+    vec4 previous_clip_space;
+    glm_mat4_mulv(history->projection_view, (vec4){surface->position[0], surface->position[1], surface->position[2], 1.0f}, previous_clip_space);
+    if (previous_clip_space[3] <= 0.0f)
+    {
+        return;
+    }
+    perspective_division(previous_clip_space, previous_clip_space);
+
+    vec2 previous_pixel;
+    viewport_transform(previous_clip_space, (vec2){frame->width, frame->height}, previous_pixel);
+    int previous_x = (int)floorf(previous_pixel[0]);
+    int previous_y = (int)floorf(previous_pixel[1]);
+    if (previous_x < 0 || previous_x >= frame->width || previous_y < 0 || previous_y >= frame->height)
+    {
+        return;
+    }
+
+    size_t previous_index = (size_t)previous_y * frame->width + previous_x;
+    surface_t *previous_surface = &history->surfaces[previous_index];
+    if (previous_surface->generation != ray_tracer->generation - 1 || previous_surface->object_index != surface->object_index)
+    {
+        return;
+    }
+
+    // Rejects points that were occluded for the previous camera or seen at a different part of the object
+    float previous_depth = glm_vec3_distance(history->camera_position, surface->position);
+    if (fabsf(previous_surface->depth - previous_depth) > HISTORY_DEPTH_TOLERANCE * previous_depth ||
+        glm_vec3_dot(previous_surface->normal, surface->normal) < HISTORY_NORMAL_TOLERANCE)
+    {
+        return;
+    }
+
+    shadow_sample_t *previous_shadow_samples = &history->shadow_samples[previous_index * light_count];
+    for (int i = 0; i < light_count; i++)
+    {
+        shadow_sample_t previous = previous_shadow_samples[i];
+        if (previous.sample_count > HISTORY_MAX_SAMPLE_COUNT)
+        {
+            previous.hit_count = (uint16_t)((previous.hit_count * HISTORY_MAX_SAMPLE_COUNT + previous.sample_count / 2) / previous.sample_count);
+            previous.sample_count = HISTORY_MAX_SAMPLE_COUNT;
+        }
+        shadow_samples[i] = previous;
+    }
+
+    *bounce_sample = history->bounce_samples[previous_index];
+    if (bounce_sample->sample_count > HISTORY_MAX_SAMPLE_COUNT)
+    {
+        bounce_sample->sample_count = HISTORY_MAX_SAMPLE_COUNT;
+    }
+
+    // The pixel's own sample sequence starts over, only the estimates are carried over
+    pixel_statistics_t *previous_statistics = &history->statistics[previous_index];
+    if (previous_statistics->sample_count > 1)
+    {
+        uint32_t sample_count = previous_statistics->sample_count < HISTORY_MAX_SAMPLE_COUNT ? previous_statistics->sample_count : HISTORY_MAX_SAMPLE_COUNT;
+        statistics->mean = previous_statistics->mean;
+        statistics->max_value = previous_statistics->max_value;
+        statistics->m2 = previous_statistics->m2 * (sample_count - 1) / (previous_statistics->sample_count - 1);
+        statistics->sample_count = sample_count;
+    }
+}
+
+void trace_ray(render_frame_t *frame, ray_tracing_worker_t *worker, vec3 origin, vec3 direction, float max_distance, hit_t *hit_dst)
+{
+    worker->ray_count++;
+    cast_ray(origin, direction, frame->scene, &frame->ray_tracer->bvh, max_distance, hit_dst);
+}
+
+// Samples the pixel takes this pass, after it was reprojected if it is new to this generation
+int get_pixel_sample_count(render_frame_t *frame, ray_tracing_worker_t *worker, size_t pixel_index, pixel_statistics_t *statistics)
+{
+    if (!frame->ray_tracer->adaptive_sampling || statistics->sample_count < ADAPTIVE_MIN_SAMPLE_COUNT)
+    {
+        return 1;
+    }
+
+    // Randomized rounding keeps the expected sample count proportional to the error
+    float sample_count = frame->ray_tracer->pixel_errors[pixel_index] * frame->ray_tracer->samples_per_error;
+    int whole_sample_count = (int)sample_count;
+    if (pcg32_next_float(&worker->rng) < sample_count - whole_sample_count)
+    {
+        whole_sample_count++;
+    }
+    return glm_min(whole_sample_count, ADAPTIVE_MAX_SAMPLES_PER_PASS);
+}
+
+void trace_shadow_rays(render_frame_t *frame, ray_tracing_worker_t *worker, shadow_ray_t *rays, int ray_count)
+{
+    worker->ray_count += ray_count;
+    occluded_batch(rays, ray_count, frame->scene, &frame->ray_tracer->bvh);
+}
+
+// Casts the ray through the pixel's center and stores what it hit in the pixel's surface for the current generation
+void trace_primary_ray(render_frame_t *frame, ray_tracing_worker_t *worker, int x, int y, surface_t *surface_dst)
+{
+    scene_t *scene = frame->scene;
+
+    vec4 pixel_center_clip_space;
+    viewport_transform_inverse((vec2){0.5f + x, 0.5f + y}, (vec2){frame->width, frame->height}, pixel_center_clip_space);
+    pixel_center_clip_space[2] = -1.0f;
+    pixel_center_clip_space[3] = 1.0f;
+    vec4 pixel_center_view_space;
+    glm_mat4_mulv(frame->projection_inv, pixel_center_clip_space, pixel_center_view_space);
+    vec4 pixel_center_world_space;
+    glm_mat4_mulv(frame->view_inv, pixel_center_view_space, pixel_center_world_space);
+    perspective_division(pixel_center_world_space, pixel_center_world_space);
+
+    vec4 ray_direction_view_space;
+    glm_vec4_copy(pixel_center_view_space, ray_direction_view_space);
+    // Setting w to 0 prevents translation, so it behaves like a direction vector
+    ray_direction_view_space[3] = 0.0f;
+
+    vec4 ray_direction_world_space;
+    glm_mat4_mulv(frame->view_inv, ray_direction_view_space, ray_direction_world_space);
+    glm_vec4_normalize(ray_direction_world_space);
+
+    hit_t hit;
+    trace_ray(frame, worker, pixel_center_world_space, ray_direction_world_space, INFINITY, &hit);
+
+    surface_dst->generation = frame->ray_tracer->generation;
+    if (hit.object == NULL)
+    {
+        surface_dst->object_index = -1;
+        return;
+    }
+
+    vec3 hit_position_model_space;
+    glm_vec3_sub(hit.position, hit.object->position, hit_position_model_space);
+    glm_vec3_copy(hit.position, surface_dst->position);
+    surface_dst->depth = glm_vec3_distance(scene->camera.position, hit.position);
+    get_object_normal(hit.object, hit_position_model_space, surface_dst->normal);
+    surface_dst->object_index = (int)(hit.object - scene->objects);
+}
+
+void trace_pixel(render_frame_t *frame, ray_tracing_worker_t *worker, int x, int y)
+{
+    scene_t *scene = frame->scene;
+    size_t pixel_index = (size_t)y * frame->width + x;
+    accumulation_buffer_t *accumulation = &frame->ray_tracer->accumulation;
+    shadow_sample_t *shadow_samples = &accumulation->shadow_samples[pixel_index * scene->light_count];
+    bounce_sample_t *bounce_sample = &accumulation->bounce_samples[pixel_index];
+    surface_t *surface = &accumulation->surfaces[pixel_index];
+    pixel_statistics_t *statistics = &accumulation->statistics[pixel_index];
+
+    // The primary ray only runs on the pixel's first pass of a generation, later passes shade the surface it stored
+    if (surface->generation != frame->ray_tracer->generation)
+    {
+        trace_primary_ray(frame, worker, x, y, surface);
+        if (surface->object_index >= 0)
+        {
+            reproject_pixel(frame, pixel_index);
+        }
+    }
+
+    vec3 color = {0.0f, 0.0f, 0.0f};
+    if (surface->object_index >= 0)
+    {
+        object_t *object = &scene->objects[surface->object_index];
+        vec3 *object_position = &object->position;
+        vec3 *hit_position = &surface->position;
+        float *normal = surface->normal;
+
+        vec3 hit_position_model_space;
+        glm_vec3_sub(*hit_position, *object_position, hit_position_model_space);
+
+        vec3 *camera_position_world_space = &scene->camera.position;
+        vec3 camera_position_model_space;
+        glm_vec3_sub(*camera_position_world_space, *object_position, camera_position_model_space);
+
+        // Unshadowed shading of every light, the light's shadow samples scale it by its visibility
+        vec3 *light_contributions = worker->light_contributions;
+        for (int i = 0; i < scene->light_count; i++)
+        {
+            light_t *light = &scene->lights[i];
+
+            vec4 light_position_model_space;
+            glm_vec4_copy(light->position, light_position_model_space);
+            if (light_position_model_space[3] == 1.0f)
+            {
+                glm_vec4_sub(light_position_model_space, (vec4){*object_position[0], *object_position[1], *object_position[2], 0.0f}, light_position_model_space);
+            }
+
+            vec3 light_color;
+            glm_vec3_scale(light->color, get_light_falloff(light, *hit_position), light_color);
+
+            blinn_phong_shade(
+                hit_position_model_space,
+                normal,
+                light_position_model_space,
+                camera_position_model_space,
+                light_color,
+                &object->material,
+                light_contributions[i]);
+        }
+
+        statistics->max_value = 0.0f;
+        for (int i = 0; i < scene->light_count; i++)
+        {
+            statistics->max_value += luminance(light_contributions[i]);
+        }
+
+        int sample_count = get_pixel_sample_count(frame, worker, pixel_index, statistics);
+        for (int s = 0; s < sample_count; s++)
+        {
+            // Bounce sample i uses sample dimension 2 * i, light sample n uses 2 * n + 1
+            pixel_sampler_t sampler;
+            pixel_sampler_init(&sampler, frame->ray_tracer->sampler_type, &worker->rng, (uint32_t)pixel_index, statistics->sample_index++);
+            // Luminance of this sample's own estimate of the pixel, for the variance
+            float sample_luminance = 0.0f;
+
+            // Shadow rays of all lights are traced together, light sample n is the pixel's shadow ray n
+            int SAMPLES_TAKEN_PER_FRAME = 1;
+            int shadow_ray_count = scene->light_count * SAMPLES_TAKEN_PER_FRAME;
+            for (int first = 0; first < shadow_ray_count; first += SHADOW_RAY_BATCH_SIZE)
+            {
+                shadow_ray_t shadow_rays[SHADOW_RAY_BATCH_SIZE];
+                int batch_size = glm_min(SHADOW_RAY_BATCH_SIZE, shadow_ray_count - first);
+                for (int n = 0; n < batch_size; n++)
+                {
+                    int i = (first + n) / SAMPLES_TAKEN_PER_FRAME;
+                    light_t *light = &scene->lights[i];
+                    shadow_ray_t *shadow_ray = &shadow_rays[n];
+
+                    vec2 u;
+                    pixel_sampler_get_2d(&sampler, 2 * (first + n) + 1, u);
+
+                    if (light->position[3] == 0.0f)
+                    {
+                        // Directional lights cover a cone of angular_radius around their direction
+                        vec3 light_direction;
+                        glm_vec3_normalize_to(light->position, light_direction);
+                        sample_cone(u, light_direction, light->angular_radius, shadow_ray->direction);
+                        shadow_ray->max_distance = INFINITY;
+                    }
+                    else
+                    {
+                        // Point lights are spheres, seen from the hit as a disk facing it
+                        vec3 direction_to_light_center;
+                        glm_vec3_sub(light->position, surface->position, direction_to_light_center);
+                        glm_vec3_normalize(direction_to_light_center);
+                        vec3 light_sample_position;
+                        sample_disk(u, light->position, direction_to_light_center, light->radius, light_sample_position);
+
+                        glm_vec3_sub(light_sample_position, surface->position, shadow_ray->direction);
+                        shadow_ray->max_distance = glm_vec3_norm(shadow_ray->direction);
+                        glm_vec3_normalize(shadow_ray->direction);
+                    }
+
+                    // FIXME: is this good?
+                    glm_vec3_scale(shadow_ray->direction, 0.0001f, shadow_ray->origin);
+                    glm_vec3_add(surface->position, shadow_ray->origin, shadow_ray->origin);
+                    shadow_ray->occluder_hint = &worker->occluder_hints[i];
+                }
+
+                trace_shadow_rays(frame, worker, shadow_rays, batch_size);
+
+                for (int n = 0; n < batch_size; n++)
+                {
+                    int i = (first + n) / SAMPLES_TAKEN_PER_FRAME;
+                    shadow_sample_add(&shadow_samples[i], !shadow_rays[n].occluded);
+                    if (!shadow_rays[n].occluded)
+                    {
+                        sample_luminance += luminance(light_contributions[i]) / SAMPLES_TAKEN_PER_FRAME;
+                    }
+                }
+            }
+
+            int BOUNCE_SAMPLE_COUNT = 1;
+            vec3 bounce_contribution = {0};
+            for (int i = 0; i < BOUNCE_SAMPLE_COUNT; i++)
+            {
+                // Directions below the surface never reach a lit point, so only the hemisphere above it is sampled
+                vec2 u;
+                pixel_sampler_get_2d(&sampler, 2 * i, u);
+                vec3 random_direction;
+                sample_hemisphere(u, normal, random_direction);
+                vec3 bounce_ray_origin;
+                glm_vec3_scale(random_direction, 0.0001f, bounce_ray_origin);
+                glm_vec3_add(surface->position, bounce_ray_origin, bounce_ray_origin);
+                hit_t bounce_hit;
+                trace_ray(frame, worker, bounce_ray_origin, random_direction, INFINITY, &bounce_hit);
+                if (bounce_hit.object != NULL && bounce_hit.object != object)
+                {
+                    vec3 *bounce_object_position = &bounce_hit.object->position;
+                    vec3 *bounce_hit_position = &bounce_hit.position;
+
+                    vec3 bounce_hit_position_bounce_model_space;
+                    glm_vec3_sub(*bounce_hit_position, *bounce_object_position, bounce_hit_position_bounce_model_space);
+
+                    vec3 bounce_normal;
+                    get_object_normal(bounce_hit.object, bounce_hit_position_bounce_model_space, bounce_normal);
+
+                    // A settled cell of the irradiance cache stands in for the shadow rays and shading of every light with
+                    // the diffuse light it averaged. Some hits in settled cells are still traced and added, so cells keep converging.
+                    vec3 bounce_value_sample = {0};
+                    uint64_t cache_key = 0;
+                    bool cached = false;
+                    if (frame->ray_tracer->irradiance_caching)
+                    {
+                        cache_key = irradiance_cache_get_key(bounce_hit.position, bounce_normal, (int)(bounce_hit.object - scene->objects));
+                        cached = pcg32_next_float(&worker->rng) >= IRRADIANCE_CACHE_REFRESH_PROBABILITY &&
+                                 irradiance_cache_get(&frame->ray_tracer->irradiance_cache, cache_key, bounce_value_sample);
+                    }
+
+                    if (!cached)
+                    {
+                        vec3 bounce_diffuse_sample = {0};
+                        for (int first = 0; first < scene->light_count; first += SHADOW_RAY_BATCH_SIZE)
+                        {
+                            shadow_ray_t shadow_rays[SHADOW_RAY_BATCH_SIZE];
+                            int batch_size = glm_min(SHADOW_RAY_BATCH_SIZE, scene->light_count - first);
+                            for (int n = 0; n < batch_size; n++)
+                            {
+                                shadow_ray_t *shadow_ray = &shadow_rays[n];
+                                glm_vec3_sub(scene->lights[first + n].position, bounce_hit.position, shadow_ray->direction);
+                                shadow_ray->max_distance = glm_vec3_norm(shadow_ray->direction);
+                                glm_vec3_normalize(shadow_ray->direction);
+
+                                // FIXME: is this good?
+                                glm_vec3_scale(shadow_ray->direction, 0.0001f, shadow_ray->origin);
+                                glm_vec3_add(bounce_hit.position, shadow_ray->origin, shadow_ray->origin);
+                                shadow_ray->occluder_hint = &worker->occluder_hints[scene->light_count + first + n];
+                            }
+
+                            trace_shadow_rays(frame, worker, shadow_rays, batch_size);
+
+                            for (int n = 0; n < batch_size; n++)
+                            {
+                                light_t *light = &scene->lights[first + n];
+                                if (shadow_rays[n].occluded)
+                                {
+                                    continue;
+                                }
+
+                                vec4 bounce_light_position_bounce_model_space;
+                                glm_vec4_copy(light->position, bounce_light_position_bounce_model_space);
+                                if (bounce_light_position_bounce_model_space[3] == 1.0f)
+                                {
+                                    glm_vec4_sub(bounce_light_position_bounce_model_space, (vec4){*bounce_object_position[0], *bounce_object_position[1], *bounce_object_position[2], 0.0f}, bounce_light_position_bounce_model_space);
+                                }
+
+                                vec3 hit_position_bounce_model_space;
+                                glm_vec3_sub(*hit_position, *bounce_object_position, hit_position_bounce_model_space);
+
+                                vec3 bounce_light_color;
+                                glm_vec3_scale(light->color, get_light_falloff(light, bounce_hit.position), bounce_light_color);
+
+                                vec3 bounce_value_sample_light_contribution = {0};
+                                blinn_phong_shade(
+                                    bounce_hit_position_bounce_model_space,
+                                    bounce_normal,
+                                    bounce_light_position_bounce_model_space,
+                                    hit_position_bounce_model_space,
+                                    bounce_light_color,
+                                    &bounce_hit.object->material,
+                                    bounce_value_sample_light_contribution);
+
+                                glm_vec3_add(bounce_value_sample, bounce_value_sample_light_contribution, bounce_value_sample);
+
+                                if (frame->ray_tracer->irradiance_caching)
+                                {
+                                    // Only the diffuse part is cached, the specular part depends on where the hit is seen from
+                                    diffuse_shade(
+                                        bounce_hit_position_bounce_model_space,
+                                        bounce_normal,
+                                        bounce_light_position_bounce_model_space,
+                                        bounce_light_color,
+                                        &bounce_hit.object->material,
+                                        bounce_value_sample_light_contribution);
+                                    glm_vec3_add(bounce_diffuse_sample, bounce_value_sample_light_contribution, bounce_diffuse_sample);
+                                }
+                            }
+                        }
+
+                        if (frame->ray_tracer->irradiance_caching)
+                        {
+                            irradiance_cache_add(&frame->ray_tracer->irradiance_cache, cache_key, bounce_diffuse_sample);
+                        }
+                    }
+
+                    vec4 bounce_hit_position_model_space = {0.0f, 0.0f, 0.0f, 1.0f};
+                    glm_vec3_sub(bounce_hit.position, *object_position, bounce_hit_position_model_space);
+
+                    vec3 bounce_contribution_sample = {0};
+                    blinn_phong_shade(
+                        hit_position_model_space,
+                        normal,
+                        bounce_hit_position_model_space,
+                        camera_position_model_space,
+                        bounce_value_sample,
+                        &object->material,
+                        bounce_contribution_sample);
+
+                    // Halved to keep the estimate of the whole sphere of directions the bounce light was defined over
+                    glm_vec3_scale(bounce_contribution_sample, 0.5f, bounce_contribution_sample);
+                    glm_vec3_add(bounce_contribution, bounce_contribution_sample, bounce_contribution);
+                }
+            }
+
+            glm_vec3_scale(bounce_contribution, 1.0f / (float)BOUNCE_SAMPLE_COUNT, bounce_contribution);
+            bounce_sample_add(bounce_sample, bounce_contribution);
+            sample_luminance += luminance(bounce_contribution);
+            pixel_statistics_add(statistics, sample_luminance);
+        }
+
+        for (int i = 0; i < scene->light_count; i++)
+        {
+            shadow_sample_t *shadow_sample = &shadow_samples[i];
+            if (shadow_sample->hit_count > 0)
+            {
+                glm_vec3_muladds(light_contributions[i], (float)shadow_sample->hit_count / shadow_sample->sample_count, color);
+            }
+        }
+        glm_vec3_add(color, bounce_sample->mean, color);
+
+        if (frame->ray_tracer->denoising)
+        {
+            float error_bound = pixel_statistics_get_error_bound(statistics);
+            denoiser_set_input(&frame->ray_tracer->denoiser, x, y, color, object->material.base_color, error_bound * error_bound);
+        }
+    }
+    set_pixel(frame->framebuffer, x, y, color);
+}
+
+// Traces the pixels of one phase in one tile. The first phase also fills the rest of each block while it still shows
+// an older camera or scene, so the image refines from coarse to fine instead of mixing views.
+void render_work_unit(void *context, int worker_index, int job_index)
+{
+    render_frame_t *frame = (render_frame_t *)context;
+    ray_tracer_t *ray_tracer = frame->ray_tracer;
+    ray_tracing_worker_t *worker = &ray_tracer->workers[worker_index];
+
+    int tile_count_x = (frame->width + TILE_SIZE - 1) / TILE_SIZE;
+    int tile_count_y = (frame->height + TILE_SIZE - 1) / TILE_SIZE;
+    int work_unit = frame->first_work_unit + job_index;
+    int phase = work_unit / (tile_count_x * tile_count_y);
+    int tile_index = work_unit % (tile_count_x * tile_count_y);
+
+    // The diagonal neighbour comes second, so half the pixels form a checkerboard after two phases
+    static const int phase_offsets[INTERLEAVE_PHASE_COUNT][2] = {{0, 0}, {1, 1}, {1, 0}, {0, 1}};
+    int x_start = tile_index % tile_count_x * TILE_SIZE;
+    int y_start = tile_index / tile_count_x * TILE_SIZE;
+    int x_end = glm_min(x_start + TILE_SIZE, frame->width);
+    int y_end = glm_min(y_start + TILE_SIZE, frame->height);
+
+    for (int y = y_start + phase_offsets[phase][1]; y < y_end; y += INTERLEAVE_SIZE)
+    {
+        for (int x = x_start + phase_offsets[phase][0]; x < x_end; x += INTERLEAVE_SIZE)
+        {
+            trace_pixel(frame, worker, x, y);
+
+            if (phase != 0)
+            {
+                continue;
+            }
+
+            for (int i = 1; i < INTERLEAVE_PHASE_COUNT; i++)
+            {
+                int block_x = x + phase_offsets[i][0], block_y = y + phase_offsets[i][1];
+                if (block_x < x_end && block_y < y_end &&
+                    ray_tracer->accumulation.surfaces[(size_t)block_y * frame->width + block_x].generation != ray_tracer->generation)
+                {
+                    copy_pixel(frame->framebuffer, x, y, block_x, block_y);
+                }
+            }
+        }
+    }
+}
+
+// Stores the error of every pixel of the tile and the tile's share of the frame's sample budget.
+// Pixels that missed every object or are frozen take no samples, so they add nothing to the budget.
+void estimate_tile_error(void *context, int worker_index, int tile_index)
+{
+    render_frame_t *frame = (render_frame_t *)context;
+    ray_tracer_t *ray_tracer = frame->ray_tracer;
+
+    int tile_count_x = (frame->width + TILE_SIZE - 1) / TILE_SIZE;
+    int x_start = tile_index % tile_count_x * TILE_SIZE;
+    int y_start = tile_index / tile_count_x * TILE_SIZE;
+    int x_end = glm_min(x_start + TILE_SIZE, frame->width);
+    int y_end = glm_min(y_start + TILE_SIZE, frame->height);
+
+    double tile_error = 0.0;
+    double sample_budget = 0.0;
+    for (int y = y_start; y < y_end; y++)
+    {
+        for (int x = x_start; x < x_end; x++)
+        {
+            size_t pixel_index = (size_t)y * frame->width + x;
+            surface_t *surface = &ray_tracer->accumulation.surfaces[pixel_index];
+            pixel_statistics_t *statistics = &ray_tracer->accumulation.statistics[pixel_index];
+
+            float error = 0.0f;
+            if (surface->generation != ray_tracer->generation || (surface->object_index >= 0 && statistics->sample_count < ADAPTIVE_MIN_SAMPLE_COUNT))
+            {
+                // Not reprojected yet or too few samples to trust, takes one sample regardless
+                sample_budget += ray_tracer->samples_per_pass - 1.0f;
+            }
+            else if (surface->object_index >= 0)
+            {
+                // Samples go where the error is, but pixels without observed variance keep a share until they are frozen
+                float error_bound = pixel_statistics_get_error_bound(statistics);
+                if (error_bound >= ADAPTIVE_ERROR_THRESHOLD)
+                {
+                    error = glm_max(pixel_statistics_get_error(statistics), ADAPTIVE_ERROR_BOUND_WEIGHT * error_bound);
+                    sample_budget += ray_tracer->samples_per_pass;
+                }
+            }
+
+            ray_tracer->pixel_errors[pixel_index] = error;
+            tile_error += error;
+        }
+    }
+
+    ray_tracer->tile_errors[tile_index] = tile_error;
+    ray_tracer->tile_sample_budgets[tile_index] = sample_budget;
+}
+
+// Shares out the pass's samples by the error of every pixel
+void ray_tracer_plan_pass(ray_tracer_t *ray_tracer, render_frame_t *frame, int tile_count)
+{
+    thread_pool_run(&ray_tracer->thread_pool, tile_count, estimate_tile_error, frame);
+
+    double total_error = 0.0;
+    double sample_budget = 0.0;
+    for (int i = 0; i < tile_count; i++)
+    {
+        total_error += ray_tracer->tile_errors[i];
+        sample_budget += ray_tracer->tile_sample_budgets[i];
+    }
+
+    ray_tracer->samples_per_error = total_error > 0.0 && sample_budget > 0.0 ? (float)(sample_budget / total_error) : 0.0f;
+}
+
+// Gives the denoiser the primary hit of every pixel traced in the current generation and excludes the rest, which either
+// missed every object or still show an older camera or scene
+void prepare_denoising_rows(void *context, int worker_index, int job_index)
+{
+    render_frame_t *frame = (render_frame_t *)context;
+    ray_tracer_t *ray_tracer = frame->ray_tracer;
+
+    int y_end = glm_min((job_index + 1) * DENOISING_ROWS_PER_JOB, frame->height);
+    for (int y = job_index * DENOISING_ROWS_PER_JOB; y < y_end; y++)
+    {
+        for (int x = 0; x < frame->width; x++)
+        {
+            surface_t *surface = &ray_tracer->accumulation.surfaces[(size_t)y * frame->width + x];
+            if (surface->generation == ray_tracer->generation && surface->object_index >= 0)
+            {
+                denoiser_set_guide(&ray_tracer->denoiser, x, y, surface->position, surface->normal, surface->depth);
+            }
+            else
+            {
+                denoiser_clear_guide(&ray_tracer->denoiser, x, y);
+            }
+        }
+    }
+}
+
+// Replaces the accumulated color of every pixel the denoiser had a guide for with the filtered one. Pixels that aren't traced
+// yet show their block's first pixel, see render_work_unit, so they take its filtered color too.
+void finish_denoising_rows(void *context, int worker_index, int job_index)
+{
+    render_frame_t *frame = (render_frame_t *)context;
+    ray_tracer_t *ray_tracer = frame->ray_tracer;
+
+    int y_end = glm_min((job_index + 1) * DENOISING_ROWS_PER_JOB, frame->height);
+    for (int y = job_index * DENOISING_ROWS_PER_JOB; y < y_end; y++)
+    {
+        for (int x = 0; x < frame->width; x++)
+        {
+            int source_x = x, source_y = y;
+            if (ray_tracer->accumulation.surfaces[(size_t)y * frame->width + x].generation != ray_tracer->generation)
+            {
+                source_x = x - x % INTERLEAVE_SIZE;
+                source_y = y - y % INTERLEAVE_SIZE;
+            }
+
+            surface_t *surface = &ray_tracer->accumulation.surfaces[(size_t)source_y * frame->width + source_x];
+            if (surface->generation == ray_tracer->generation && surface->object_index >= 0)
+            {
+                vec3 color;
+                denoiser_get_output(&ray_tracer->denoiser, source_x, source_y, color);
+                set_pixel(frame->framebuffer, x, y, color);
+            }
+        }
+    }
+}
+
+void denoise_image(ray_tracer_t *ray_tracer, render_frame_t *frame)
+{
+    int job_count = (frame->height + DENOISING_ROWS_PER_JOB - 1) / DENOISING_ROWS_PER_JOB;
+    thread_pool_run(&ray_tracer->thread_pool, job_count, prepare_denoising_rows, frame);
+    denoiser_run(&ray_tracer->denoiser, &ray_tracer->thread_pool);
+    thread_pool_run(&ray_tracer->thread_pool, job_count, finish_denoising_rows, frame);
+}
+
+// Continues the current pass, or starts a new one, until it is complete or the frame time budget is spent. False if the
+// image can't differ from the last one, because every pixel is frozen and no ray was traced.
+bool render_to_image(ray_tracer_t *ray_tracer, scene_t *scene, framebuffer_t *framebuffer)
+{
+    int width = framebuffer->width, height = framebuffer->height;
+
+    render_frame_t frame = {.ray_tracer = ray_tracer, .scene = scene, .framebuffer = framebuffer, .width = width, .height = height};
+
+    mat4 projection;
+    glm_perspective(45.0f, (float)width / (float)height, Z_NEAR, Z_FAR, projection);
+    mat4 view;
+    glm_look(scene->camera.position, scene->camera.direction, scene->camera.up, view);
+    glm_mat4_inv(projection, frame.projection_inv);
+    glm_mat4_inv(view, frame.view_inv);
+    mat4 projection_view;
+    glm_mat4_mul(projection, view, projection_view);
+
+    ray_tracer_update_caches(ray_tracer, scene, width, height, projection_view);
+    ray_tracer->irradiance_cache.clock++;
+
+    if (ray_tracer->bvh_content_id != scene->content_id)
+    {
+        prebuilt_bvh_t *prebuilt = &scene->prebuilt_bvh;
+        if (prebuilt->nodes != NULL && prebuilt->content_id == scene->content_id)
+        {
+            bvh_adopt(&ray_tracer->bvh, scene->objects, scene->object_count, prebuilt->nodes, prebuilt->node_count, prebuilt->object_indices, prebuilt->object_count);
+        }
+        else
+        {
+            bvh_build(&ray_tracer->bvh, scene->objects, scene->object_count);
+        }
+        ray_tracer->bvh_content_id = scene->content_id;
+    }
+
+    int tile_count_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+    int tile_count_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+    int tile_count = tile_count_x * tile_count_y;
+    int work_unit_count = tile_count * INTERLEAVE_PHASE_COUNT;
+    if (work_unit_count == 0)
+    {
+        return false;
+    }
+    double start_time = get_time();
+    unsigned long long start_ray_count = ray_tracer_get_ray_count(ray_tracer);
+    int batch_count = 0;
+
+    for (;;)
+    {
+        if (ray_tracer->next_work_unit == 0)
+        {
+            ray_tracer->pass_start_ray_count = ray_tracer_get_ray_count(ray_tracer);
+            if (ray_tracer->adaptive_sampling)
+            {
+                ray_tracer_plan_pass(ray_tracer, &frame, tile_count);
+            }
+        }
+
+        // Batches stop at phase boundaries, so a first-phase pixel never fills a block pixel that is being traced
+        int phase_end = (ray_tracer->next_work_unit / tile_count + 1) * tile_count;
+        int batch_size = phase_end - ray_tracer->next_work_unit;
+        if (ray_tracer->frame_time_budget > 0.0f)
+        {
+            batch_size = glm_min(batch_size, ray_tracer->thread_pool.worker_count * WORK_UNITS_PER_BATCH);
+        }
+
+        frame.first_work_unit = ray_tracer->next_work_unit;
+        thread_pool_run(&ray_tracer->thread_pool, batch_size, render_work_unit, &frame);
+        ray_tracer->next_work_unit += batch_size;
+
+        bool pass_complete = ray_tracer->next_work_unit == work_unit_count;
+        if (pass_complete)
+        {
+            ray_tracer->next_work_unit = 0;
+            ray_tracer->converged = ray_tracer_get_ray_count(ray_tracer) == ray_tracer->pass_start_ray_count;
+        }
+
+        if (ray_tracer->frame_time_budget <= 0.0f || (pass_complete && ray_tracer->converged))
+        {
+            if (pass_complete)
+            {
+                break;
+            }
+            continue;
+        }
+
+        // Stops before a batch that would likely overrun the budget, judging by the batches so far
+        batch_count++;
+        double elapsed_time = (get_time() - start_time) * 1000.0;
+        float denoising_time = ray_tracer->denoising ? ray_tracer->denoising_time : 0.0f;
+        if (elapsed_time + elapsed_time / batch_count + denoising_time > ray_tracer->frame_time_budget)
+        {
+            break;
+        }
+    }
+
+    // Pixels traced so far are filtered even in the middle of a pass, the others keep what the framebuffer shows
+    if (ray_tracer->denoising)
+    {
+        double denoising_start_time = get_time();
+        denoise_image(ray_tracer, &frame);
+        ray_tracer->denoising_time = (float)((get_time() - denoising_start_time) * 1000.0);
+    }
+    return !ray_tracer->converged || ray_tracer_get_ray_count(ray_tracer) != start_ray_count;
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#define GLFW_INCLUDE_NONE
+#include <glad/glad.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// One instanced draw with the state it needs
+typedef struct
+{
+    uint64_t sort_key;
+    GLuint shader_program;
+    GLuint vao;
+    GLenum mode;
+    GLint first; // first vertex, or first index when indexed
+    GLsizei vertex_count;
+    bool indexed;
+    GLint base_vertex; // added to every index
+    GLsizei instance_count;
+} render_command_t;
+
+// Per frame submission cost
+typedef struct
+{
+    int draw_calls;
+    int state_changes;
+} render_stats_t;
+
+// Draw commands sorted so consecutive ones share as much state as possible, built when the scene changes and
+// submitted every frame
+typedef struct
+{
+    render_command_t *commands;
+    int command_count;
+    int command_capacity;
+} render_queue_t;
+
+// Most expensive state changes in the highest bits: program, then vertex array, then whatever the caller adds
+uint64_t make_sort_key(GLuint shader_program, GLuint vao, uint32_t material_key)
+{
+    return ((uint64_t)(shader_program & 0xffff) << 48) | ((uint64_t)(vao & 0xffff) << 32) | material_key;
+}
+
+void render_queue_destroy(render_queue_t *queue)
+{
+    free(queue->commands);
+    *queue = (render_queue_t){0};
+}
+
+void render_queue_clear(render_queue_t *queue)
+{
+    queue->command_count = 0;
+}
+
+void render_queue_add(render_queue_t *queue, render_command_t *command)
+{
+    if (command->instance_count == 0)
+    {
+        return;
+    }
+
+    if (queue->command_count == queue->command_capacity)
+    {
+        queue->command_capacity = queue->command_capacity == 0 ? 16 : queue->command_capacity * 2;
+        queue->commands = (render_command_t *)realloc(queue->commands, queue->command_capacity * sizeof(render_command_t));
+        if (queue->commands == NULL)
+        {
+            fprintf(stderr, "Error: failed to allocate render commands\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    queue->commands[queue->command_count++] = *command;
+}
+
+int compare_render_commands(const void *a, const void *b)
+{
+    uint64_t key_a = ((const render_command_t *)a)->sort_key;
+    uint64_t key_b = ((const render_command_t *)b)->sort_key;
+    return (key_a > key_b) - (key_a < key_b);
+}
+
+void render_queue_sort(render_queue_t *queue)
+{
+    qsort(queue->commands, queue->command_count, sizeof(render_command_t), compare_render_commands);
+}
+
+// Draws every command, binding a program or vertex array only when it differs from the previous command's, and adds the
+// cost to stats_dst so a frame can sum several queues
+void render_queue_submit(render_queue_t *queue, render_stats_t *stats_dst)
+{
+    GLuint bound_shader_program = 0;
+    GLuint bound_vao = 0;
+    for (int i = 0; i < queue->command_count; i++)
+    {
+        render_command_t *command = &queue->commands[i];
+        if (command->shader_program != bound_shader_program)
+        {
+            glUseProgram(command->shader_program);
+            bound_shader_program = command->shader_program;
+            stats_dst->state_changes++;
+        }
+        if (command->vao != bound_vao)
+        {
+            glBindVertexArray(command->vao);
+            bound_vao = command->vao;
+            stats_dst->state_changes++;
+        }
+
+        if (command->indexed)
+        {
+            glDrawElementsInstancedBaseVertex(command->mode, command->vertex_count, GL_UNSIGNED_INT, (void *)(command->first * sizeof(GLuint)),
+                                              command->instance_count, command->base_vertex);
+        }
+        else
+        {
+            glDrawArraysInstanced(command->mode, command->first, command->vertex_count, command->instance_count);
+        }
+        stats_dst->draw_calls++;
+    }
+}
@@ -2,175 +2,401 @@
 
 #define Q(x) #x
 #define QUOTE(x) Q(x)
-#define LIGHTS_COUNT 3
-#define LIGHTS_COUNT_STR QUOTE(LIGHTS_COUNT)
 
 #include "renderer.h"
+#include "render-queue.h"
+#include "frustum-culling.h"
+#include "light-clusters.h"
+#include "meshes.h"
+#include "shadow-maps.h"
 #include "scene.h"
 #include <cglm/cglm.h>
+#include <float.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-#define SPHERE_SECTOR_COUNT 128
-#define SPHERE_STACK_COUNT 128
-#define SPHERE_VERTEX_COUNT (2 + (SPHERE_SECTOR_COUNT + 1) * (SPHERE_STACK_COUNT - 1))
-#define SPHERE_INDEX_COUNT (1 + SPHERE_SECTOR_COUNT * (1 + 2 * (SPHERE_STACK_COUNT - 1)))
+#define SHADOW_SPHERE_LOD 2 // shadow edges are filtered anyway, so casters can be coarse
+
+// Shadow filtering, the radii are in shadow map texture coordinates
+#define SHADOW_SAMPLE_COUNT 16
+#define SHADOW_MIN_FILTER_RADIUS (1.5f / SHADOW_MAP_SIZE)
+#define SHADOW_MAX_FILTER_RADIUS 0.02f
+#define SHADOW_MAX_BLOCKER_DISTANCE 4.0f // how far from a receiver blockers of a directional light are searched for
+
+// Per-instance vertex attributes, one draw call renders every object of a type
+typedef struct
+{
+    mat4 model;
+    vec3 base_color;
+    float specular;
+    float shininess;
+} instance_t;
 
 typedef struct
 {
     void (*create)(renderer_t *renderer);
     void (*render)(renderer_t *renderer, scene_t *scene);
+    void (*resize)(renderer_t *renderer, int width, int height);
     void (*destroy)(renderer_t *renderer);
+    int width;
+    int height;
     GLuint shader_program;
+    GLint projection_location;
+    GLint view_location;
     GLuint plane_vao;
     GLuint plane_vbo;
-    GLuint sphere_vao;
+    GLuint sphere_vaos[SPHERE_LOD_COUNT];
     GLuint sphere_vbo;
     GLuint sphere_ebo;
     GLuint cube_vao;
     GLuint cube_vbo;
-    GLuint ubo_lights;
+
+    // Texture buffers with the lights in view space, every cluster's range of light indices and the indices
+    GLuint light_data_tbo;
+    GLuint light_data_texture;
+    GLuint light_clusters_tbo;
+    GLuint light_clusters_texture;
+    GLuint light_indices_tbo;
+    GLuint light_indices_texture;
+    GLint global_light_count_location;
+    GLint cluster_tile_scale_location;
+    GLint cluster_depth_scale_location;
+    GLint cluster_depth_bias_location;
+    light_clusters_t light_clusters;
+    bool has_light_clusters;
+    unsigned int light_clusters_id;
+    vec4 *light_data; // staging for light_data_tbo, three texels per light
+    int light_data_capacity;
+
+    GLuint plane_instance_vbo;
+    GLuint sphere_instance_vbos[SPHERE_LOD_COUNT];
+    GLuint cube_instance_vbo;
+    int plane_instance_count;
+    int sphere_instance_counts[SPHERE_LOD_COUNT];
+    int cube_instance_count;
+    int sphere_lod_first_indices[SPHERE_LOD_COUNT];
+    int sphere_lod_base_vertices[SPHERE_LOD_COUNT];
+
+    // Per object, rebuilt when the objects change
+    instance_t *object_instances;
+    bounding_spheres_t bounding_spheres;
+    signed char *sphere_lods; // the level each sphere was last drawn at or -1
+    bool *visible;
+    int object_capacity;
+    bool has_objects;
+    unsigned int objects_content_id;
+
+    // Visible objects grouped by draw, rebuilt when anything in the scene or the viewport changes
+    instance_t *instances;
+    bool has_instances;
+    unsigned int instances_id;
+    int visible_object_count;
+    int culled_object_count;
+    render_queue_t render_queue;
+    render_stats_t stats; // of the last frame
+
+    // Every object as a shadow caster, whether it's in view or not, drawn into the shadow maps by a depth only program
+    GLuint shadow_program;
+    GLint light_view_projection_location;
+    GLuint caster_vaos[3]; // by object type
+    GLuint caster_instance_vbos[3];
+    render_queue_t caster_render_queue;
+    shadow_maps_t shadow_maps;
+    GLint shadow_matrices_location;
+    GLint shadow_layer_params_location;
+    GLint shadow_cascade_splits_location;
+    GLint view_to_world_location;
 } renderer_rasterization_t;
 
-void put_sphere_vertex(float **vertices, float x, float y, float z)
+void make_instance(object_t *object, instance_t *instance_dst)
 {
-    *(*vertices)++ = x;
-    *(*vertices)++ = y;
-    *(*vertices)++ = z;
-    *(*vertices)++ = x;
-    *(*vertices)++ = y;
-    *(*vertices)++ = z;
+    get_object_model_matrix(object, instance_dst->model);
+    glm_vec3_copy(object->material.base_color, instance_dst->base_color);
+    instance_dst->specular = object->material.specular;
+    instance_dst->shininess = object->material.shininess;
 }
 
-void put_index(unsigned int **indices, unsigned int index)
+// Sets up the instance attributes of the bound vertex array to read from instance_vbo
+void setup_instance_attributes(GLuint instance_vbo)
 {
-    *(*indices)++ = index;
+    glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+    for (int column = 0; column < 4; column++)
+    {
+        glVertexAttribPointer(2 + column, 4, GL_FLOAT, GL_FALSE, sizeof(instance_t), (void *)(offsetof(instance_t, model) + column * sizeof(vec4)));
+        glEnableVertexAttribArray(2 + column);
+        glVertexAttribDivisor(2 + column, 1);
+    }
+    glVertexAttribPointer(6, 3, GL_FLOAT, GL_FALSE, sizeof(instance_t), (void *)offsetof(instance_t, base_color));
+    glEnableVertexAttribArray(6);
+    glVertexAttribDivisor(6, 1);
+    glVertexAttribPointer(7, 2, GL_FLOAT, GL_FALSE, sizeof(instance_t), (void *)offsetof(instance_t, specular));
+    glEnableVertexAttribArray(7);
+    glVertexAttribDivisor(7, 1);
 }
 
-void generate_sphere_vertices(int sector_count, int stack_count, float *vertices, unsigned int *indices)
+void upload_instances(GLuint instance_vbo, instance_t *instances, int instance_count)
 {
-    typedef enum
-    {
-        NORTH_TO_SOUTH,
-        SOUTH_TO_NORTH
-    } direction_t;
-
-    float *vertices_start = vertices;
-    unsigned int *indices_start = indices;
-
-    float sector_step = 2 * M_PI / sector_count;
-    float stack_step = M_PI / stack_count;
+    // Respecifying the whole buffer orphans the old storage instead of waiting for draws still reading it
+    glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+    glBufferData(GL_ARRAY_BUFFER, instance_count * sizeof(instance_t), instances, GL_DYNAMIC_DRAW);
+}
 
-    int north_pole_index = 0;
-    int south_pole_index = 1;
-    int indices_per_sector = stack_count * 2 - 2;
+// Groups every object by type into the caster instance buffers, through the scratch instances that are regrouped before
+// the visible objects are drawn
+void update_casters(renderer_rasterization_t *renderer, scene_t *scene)
+{
+    int type_counts[3] = {0};
+    for (int i = 0; i < scene->object_count; i++)
+    {
+        type_counts[scene->objects[i].type]++;
+    }
+    int type_offsets[3];
+    for (int type = 0, offset = 0; type < 3; type++)
+    {
+        type_offsets[type] = offset;
+        offset += type_counts[type];
+    }
+    for (int i = 0; i < scene->object_count; i++)
+    {
+        renderer->instances[type_offsets[scene->objects[i].type]++] = renderer->object_instances[i];
+    }
+    for (int type = 0; type < 3; type++)
+    {
+        upload_instances(renderer->caster_instance_vbos[type], renderer->instances + type_offsets[type] - type_counts[type], type_counts[type]);
+    }
 
-    put_sphere_vertex(&vertices, 0.0f, 1.0f, 0.0f);
-    put_sphere_vertex(&vertices, 0.0f, -1.0f, 0.0f);
-    put_index(&indices, north_pole_index);
+    GLuint program = renderer->shadow_program;
+    GLuint *vaos = renderer->caster_vaos;
+    render_queue_t *queue = &renderer->caster_render_queue;
+    render_queue_clear(queue);
+    render_queue_add(queue, &(render_command_t){.sort_key = make_sort_key(program, vaos[OBJECT_TYPE_PLANE], 0), .shader_program = program, .vao = vaos[OBJECT_TYPE_PLANE], .mode = GL_TRIANGLE_STRIP, .vertex_count = PLANE_VERTEX_COUNT, .instance_count = type_counts[OBJECT_TYPE_PLANE]});
+    render_queue_add(queue, &(render_command_t){.sort_key = make_sort_key(program, vaos[OBJECT_TYPE_SPHERE], 0), .shader_program = program, .vao = vaos[OBJECT_TYPE_SPHERE], .mode = GL_TRIANGLE_STRIP, .first = renderer->sphere_lod_first_indices[SHADOW_SPHERE_LOD], .vertex_count = SPHERE_INDEX_COUNT(SPHERE_LOD_SECTOR_COUNT(SHADOW_SPHERE_LOD), SPHERE_LOD_STACK_COUNT(SHADOW_SPHERE_LOD)), .indexed = true, .base_vertex = renderer->sphere_lod_base_vertices[SHADOW_SPHERE_LOD], .instance_count = type_counts[OBJECT_TYPE_SPHERE]});
+    render_queue_add(queue, &(render_command_t){.sort_key = make_sort_key(program, vaos[OBJECT_TYPE_CUBE], 0), .shader_program = program, .vao = vaos[OBJECT_TYPE_CUBE], .mode = GL_TRIANGLE_STRIP, .vertex_count = CUBE_VERTEX_COUNT, .instance_count = type_counts[OBJECT_TYPE_CUBE]});
+    render_queue_sort(queue);
+}
 
-    for (int i = 0; i < sector_count + 1; i++)
+void update_objects(renderer_rasterization_t *renderer, scene_t *scene)
+{
+    if (renderer->has_objects && renderer->objects_content_id == scene->content_id)
     {
-        direction_t direction = i % 2 == 1 ? NORTH_TO_SOUTH : SOUTH_TO_NORTH;
-        float sector_angle = i * sector_step;
+        return;
+    }
+    renderer->has_objects = true;
+    renderer->objects_content_id = scene->content_id;
+    renderer->has_instances = false;
 
-        for (int j = 1; j < stack_count; j++)
+    if (renderer->object_capacity < scene->object_count)
+    {
+        int capacity = scene->object_count;
+        renderer->object_instances = (instance_t *)realloc(renderer->object_instances, capacity * sizeof(instance_t));
+        renderer->instances = (instance_t *)realloc(renderer->instances, capacity * sizeof(instance_t));
+        renderer->sphere_lods = (signed char *)realloc(renderer->sphere_lods, capacity * sizeof(signed char));
+        renderer->visible = (bool *)realloc(renderer->visible, capacity * sizeof(bool));
+        if (renderer->object_instances == NULL || renderer->instances == NULL || renderer->sphere_lods == NULL || renderer->visible == NULL)
         {
-            float stack_angle = M_PI / 2 - j * stack_step;
-
-            float x = cosf(stack_angle) * cosf(sector_angle);
-            float y = sinf(stack_angle);
-            float z = cosf(stack_angle) * sinf(sector_angle);
+            fprintf(stderr, "Error: failed to allocate instances\n");
+            exit(EXIT_FAILURE);
+        }
+        renderer->object_capacity = capacity;
+    }
 
-            put_sphere_vertex(&vertices, x, y, z);
+    for (int i = 0; i < scene->object_count; i++)
+    {
+        make_instance(&scene->objects[i], &renderer->object_instances[i]);
+    }
+    memset(renderer->sphere_lods, -1, scene->object_count * sizeof(signed char));
+    bounding_spheres_build(&renderer->bounding_spheres, scene->objects, scene->object_count);
+    update_casters(renderer, scene);
+}
 
-            if (i == 0)
-            {
-                continue;
-            }
+// Draw groups in draw order: planes, spheres from the finest level of detail to the coarsest, cubes
+#define GROUP_PLANE 0
+#define GROUP_SPHERE 1
+#define GROUP_CUBE (GROUP_SPHERE + SPHERE_LOD_COUNT)
+#define GROUP_COUNT (GROUP_CUBE + 1)
 
-            int sector_index = i;
-            int stack_index = direction == NORTH_TO_SOUTH ? j : stack_count - j;
+int get_object_group(renderer_rasterization_t *renderer, scene_t *scene, int object_index)
+{
+    switch (scene->objects[object_index].type)
+    {
+    case OBJECT_TYPE_PLANE:
+        return GROUP_PLANE;
+    case OBJECT_TYPE_SPHERE:
+        return GROUP_SPHERE + renderer->sphere_lods[object_index];
+    default:
+        return GROUP_CUBE;
+    }
+}
 
-            put_index(&indices, 2 + (sector_index - 1) * (indices_per_sector) + stack_index);
-            put_index(&indices, 2 + sector_index * (indices_per_sector) + stack_index);
+// Culls the objects against the view frustum, groups the visible ones by type, and spheres by level of detail, into the
+// instance buffers and queues a draw per group
+void update_render_queue(renderer_rasterization_t *renderer, scene_t *scene, mat4 view, mat4 projection)
+{
+    update_objects(renderer, scene);
+    if (renderer->has_instances && renderer->instances_id == scene->id)
+    {
+        return;
+    }
+    renderer->has_instances = true;
+    renderer->instances_id = scene->id;
+
+    mat4 projection_view;
+    glm_mat4_mul(projection, view, projection_view);
+    frustum_t frustum;
+    frustum_from_matrix(projection_view, &frustum);
+    renderer->visible_object_count = frustum_cull(&frustum, &renderer->bounding_spheres, renderer->visible);
+    renderer->culled_object_count = scene->object_count - renderer->visible_object_count;
+
+    // Pixels per world unit at unit view depth
+    float pixel_scale = projection[1][1] * 0.5f * renderer->height;
+    int group_counts[GROUP_COUNT] = {0};
+    for (int i = 0; i < scene->object_count; i++)
+    {
+        object_t *object = &scene->objects[i];
+        if (!renderer->visible[i])
+        {
+            continue;
         }
 
-        if (i > 0)
+        if (object->type == OBJECT_TYPE_SPHERE)
         {
-            put_index(&indices, direction == NORTH_TO_SOUTH ? south_pole_index : north_pole_index);
+            vec3 view_position;
+            glm_mat4_mulv3(view, object->position, 1.0f, view_position);
+            float depth = -view_position[2];
+            float screen_radius = depth > object->radius ? object->radius * pixel_scale / depth : FLT_MAX;
+            renderer->sphere_lods[i] = (signed char)select_sphere_lod(screen_radius, renderer->sphere_lods[i]);
         }
+        group_counts[get_object_group(renderer, scene, i)]++;
     }
-}
 
-void render_sphere(renderer_rasterization_t *renderer, object_t *object)
-{
-    mat4 model = GLM_MAT4_IDENTITY_INIT;
-    glm_translate(model, object->position);
-    glm_scale(model, (vec3){object->radius, object->radius, object->radius});
-    glUniformMatrix4fv(glGetUniformLocation(renderer->shader_program, "model"), 1, GL_FALSE, &model[0][0]);
-    glUniform3fv(glGetUniformLocation(renderer->shader_program, "material.base_color"), 1, &object->material.base_color[0]);
-    glUniform1f(glGetUniformLocation(renderer->shader_program, "material.specular"), object->material.specular);
-    glUniform1f(glGetUniformLocation(renderer->shader_program, "material.shininess"), object->material.shininess);
-    glBindVertexArray(renderer->sphere_vao);
-
-    glDrawElements(GL_TRIANGLE_STRIP, SPHERE_INDEX_COUNT, GL_UNSIGNED_INT, 0);
-}
+    // Counting sort by group, then one buffer per group
+    int group_offsets[GROUP_COUNT];
+    for (int group = 0, offset = 0; group < GROUP_COUNT; group++)
+    {
+        group_offsets[group] = offset;
+        offset += group_counts[group];
+    }
+    for (int i = 0; i < scene->object_count; i++)
+    {
+        if (renderer->visible[i])
+        {
+            renderer->instances[group_offsets[get_object_group(renderer, scene, i)]++] = renderer->object_instances[i];
+        }
+    }
 
-void render_cube(renderer_rasterization_t *renderer, object_t *object)
-{
-    mat4 model = GLM_MAT4_IDENTITY_INIT;
-    glm_translate(model, object->position);
-    glm_scale(model, object->size);
-    glUniformMatrix4fv(glGetUniformLocation(renderer->shader_program, "model"), 1, GL_FALSE, &model[0][0]);
-    glUniform3fv(glGetUniformLocation(renderer->shader_program, "material.base_color"), 1, &object->material.base_color[0]);
-    glUniform1f(glGetUniformLocation(renderer->shader_program, "material.specular"), object->material.specular);
-    glUniform1f(glGetUniformLocation(renderer->shader_program, "material.shininess"), object->material.shininess);
-    glBindVertexArray(renderer->cube_vao);
-
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 26);
-}
+    int *group_instance_counts[GROUP_COUNT];
+    GLuint group_instance_vbos[GROUP_COUNT];
+    group_instance_counts[GROUP_PLANE] = &renderer->plane_instance_count;
+    group_instance_vbos[GROUP_PLANE] = renderer->plane_instance_vbo;
+    for (int level = 0; level < SPHERE_LOD_COUNT; level++)
+    {
+        group_instance_counts[GROUP_SPHERE + level] = &renderer->sphere_instance_counts[level];
+        group_instance_vbos[GROUP_SPHERE + level] = renderer->sphere_instance_vbos[level];
+    }
+    group_instance_counts[GROUP_CUBE] = &renderer->cube_instance_count;
+    group_instance_vbos[GROUP_CUBE] = renderer->cube_instance_vbo;
+    for (int group = 0; group < GROUP_COUNT; group++)
+    {
+        // The offsets now point at the end of each group
+        int instance_count = group_counts[group];
+        upload_instances(group_instance_vbos[group], renderer->instances + group_offsets[group] - instance_count, instance_count);
+        *group_instance_counts[group] = instance_count;
+    }
 
-void render_plane(renderer_rasterization_t *renderer, object_t *object)
-{
-    mat4 model = GLM_MAT4_IDENTITY_INIT;
-    glm_lookat((vec3){0.0f, 0.0f, 0.0f}, (vec3){0.0f, 0.0f, 1.0f}, object->normal, model);
-    glm_translate(model, object->position);
-    glm_scale(model, (vec3){100.0f, 100.0f, 100.0f});
-    glUniformMatrix4fv(glGetUniformLocation(renderer->shader_program, "model"), 1, GL_FALSE, &model[0][0]);
-    glUniform3fv(glGetUniformLocation(renderer->shader_program, "material.base_color"), 1, &object->material.base_color[0]);
-    glUniform1f(glGetUniformLocation(renderer->shader_program, "material.specular"), object->material.specular);
-    glUniform1f(glGetUniformLocation(renderer->shader_program, "material.shininess"), object->material.shininess);
-    glBindVertexArray(renderer->plane_vao);
-
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    // Materials are instance attributes, so they never change state between draws
+    GLuint program = renderer->shader_program;
+    render_queue_t *queue = &renderer->render_queue;
+    render_queue_clear(queue);
+    render_queue_add(queue, &(render_command_t){.sort_key = make_sort_key(program, renderer->plane_vao, 0), .shader_program = program, .vao = renderer->plane_vao, .mode = GL_TRIANGLE_STRIP, .vertex_count = PLANE_VERTEX_COUNT, .instance_count = renderer->plane_instance_count});
+    for (int level = 0; level < SPHERE_LOD_COUNT; level++)
+    {
+        GLuint vao = renderer->sphere_vaos[level];
+        render_queue_add(queue, &(render_command_t){.sort_key = make_sort_key(program, vao, 0), .shader_program = program, .vao = vao, .mode = GL_TRIANGLE_STRIP, .first = renderer->sphere_lod_first_indices[level], .vertex_count = SPHERE_INDEX_COUNT(SPHERE_LOD_SECTOR_COUNT(level), SPHERE_LOD_STACK_COUNT(level)), .indexed = true, .base_vertex = renderer->sphere_lod_base_vertices[level], .instance_count = renderer->sphere_instance_counts[level]});
+    }
+    render_queue_add(queue, &(render_command_t){.sort_key = make_sort_key(program, renderer->cube_vao, 0), .shader_program = program, .vao = renderer->cube_vao, .mode = GL_TRIANGLE_STRIP, .vertex_count = CUBE_VERTEX_COUNT, .instance_count = renderer->cube_instance_count});
+    render_queue_sort(queue);
 }
 
-void render_object(renderer_rasterization_t *renderer, object_t *object)
+// Bins the lights into clusters and uploads them with their view space positions, needed whenever the camera moves
+void update_light_clusters(renderer_rasterization_t *renderer, scene_t *scene, mat4 view, mat4 projection)
 {
-    switch (object->type)
+    if (renderer->has_light_clusters && renderer->light_clusters_id == scene->id)
     {
-    case OBJECT_TYPE_PLANE:
-    {
-        render_plane(renderer, object);
-        break;
+        return;
     }
-    case OBJECT_TYPE_SPHERE:
+    renderer->has_light_clusters = true;
+    renderer->light_clusters_id = scene->id;
+
+    light_clusters_t *clusters = &renderer->light_clusters;
+    light_clusters_build(clusters, scene->lights, scene->light_count, view, projection);
+
+    // The shadow size is how far the penumbra spreads per unit between blocker and receiver, relative to the blocker's
+    // distance from a point light
+    if (renderer->light_data_capacity < scene->light_count)
     {
-        render_sphere(renderer, object);
-        break;
+        renderer->light_data_capacity = scene->light_count;
+        renderer->light_data = (vec4 *)realloc(renderer->light_data, renderer->light_data_capacity * 3 * sizeof(vec4));
+        if (renderer->light_data == NULL)
+        {
+            fprintf(stderr, "Error: failed to allocate light data\n");
+            exit(EXIT_FAILURE);
+        }
     }
-    case OBJECT_TYPE_CUBE:
+    vec4 *light_data = renderer->light_data;
+    for (int i = 0; i < scene->light_count; i++)
     {
-        render_cube(renderer, object);
-        break;
+        light_t *light = &scene->lights[i];
+        glm_mat4_mulv3(view, light->position, light->position[3], light_data[3 * i]);
+        light_data[3 * i][3] = light->position[3];
+        glm_vec4(light->color, light->range, light_data[3 * i + 1]);
+        float shadow_size = light->position[3] == 0.0f ? tanf(light->angular_radius) : light->radius;
+        glm_vec4_copy((vec4){(float)renderer->shadow_maps.light_layers[i], shadow_size, 0.0f, 0.0f}, light_data[3 * i + 2]);
     }
-    default:
+
+    // Texture buffers must not be empty, so there is always room for one element
+    glBindBuffer(GL_TEXTURE_BUFFER, renderer->light_data_tbo);
+    glBufferData(GL_TEXTURE_BUFFER, (scene->light_count * 3 + 1) * sizeof(vec4), light_data, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, renderer->light_clusters_tbo);
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(clusters->cluster_ranges), clusters->cluster_ranges, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, renderer->light_indices_tbo);
+    glBufferData(GL_TEXTURE_BUFFER, (clusters->light_index_count + 1) * sizeof(uint32_t), NULL, GL_DYNAMIC_DRAW);
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, clusters->light_index_count * sizeof(uint32_t), clusters->light_indices);
+
+    glUniform1i(renderer->global_light_count_location, clusters->global_light_count);
+    glUniform2f(renderer->cluster_tile_scale_location, (float)LIGHT_CLUSTER_COUNT_X / renderer->width, (float)LIGHT_CLUSTER_COUNT_Y / renderer->height);
+    glUniform1f(renderer->cluster_depth_scale_location, clusters->depth_scale);
+    glUniform1f(renderer->cluster_depth_bias_location, clusters->depth_bias);
+}
+
+// Renders the shadow maps that are out of date and hands their light spaces to the shading program, which works in view space
+void update_shadows(renderer_rasterization_t *renderer, scene_t *scene, mat4 view, mat4 projection)
+{
+    update_objects(renderer, scene);
+    shadow_maps_t *shadow_maps = &renderer->shadow_maps;
+    if (!shadow_maps_update(shadow_maps, scene, view, projection, &renderer->caster_render_queue, renderer->shadow_program,
+                            renderer->light_view_projection_location, &renderer->stats))
     {
-        fprintf(stderr, "Error: unknown object type %d\n", object->type);
-        exit(EXIT_FAILURE);
+        return;
     }
+
+    mat4 view_inverse;
+    glm_mat4_inv(view, view_inverse);
+    mat4 shadow_matrices[SHADOW_LAYER_COUNT];
+    for (int layer = 0; layer < SHADOW_LAYER_COUNT; layer++)
+    {
+        glm_mat4_mul(shadow_maps->layer_matrices[layer], view_inverse, shadow_matrices[layer]);
     }
+    mat3 view_to_world;
+    glm_mat4_pick3(view_inverse, view_to_world);
+
+    glUseProgram(renderer->shader_program);
+    glUniformMatrix4fv(renderer->shadow_matrices_location, SHADOW_LAYER_COUNT, GL_FALSE, &shadow_matrices[0][0][0]);
+    glUniform4fv(renderer->shadow_layer_params_location, SHADOW_LAYER_COUNT, &shadow_maps->layer_params[0][0]);
+    glUniform1fv(renderer->shadow_cascade_splits_location, SHADOW_CASCADE_COUNT + 1, shadow_maps->cascade_splits);
+    glUniformMatrix3fv(renderer->view_to_world_location, 1, GL_FALSE, &view_to_world[0][0]);
 }
 
 void renderer_rasterization_create(renderer_t *renderer)
@@ -181,143 +407,311 @@ void renderer_rasterization_create(renderer_t *renderer)
         "#version 330 core\n"
         "layout (location = 0) in vec3 a_position;\n"
         "layout (location = 1) in vec3 a_normal;\n"
+        "layout (location = 2) in mat4 a_model;\n"
+        "layout (location = 6) in vec3 a_base_color;\n"
+        "layout (location = 7) in vec2 a_specular_shininess;\n"
 
         "uniform mat4 projection;\n"
         "uniform mat4 view;\n"
-        "uniform mat4 model;\n"
         "out vec3 position;\n"
         "out vec3 normal;\n"
+        "flat out vec3 base_color;\n"
+        "flat out vec2 specular_shininess;\n"
 
         "void main()\n"
         "{\n"
-        "    gl_Position = projection * view * model * vec4(a_position, 1.0);\n"
-        "    position = vec3(view * model * vec4(a_position, 1.0));\n"
-        "    normal = normalize(vec3(view * model * vec4(a_normal, 0.0)));\n"
+        "    gl_Position = projection * view * a_model * vec4(a_position, 1.0);\n"
+        "    position = vec3(view * a_model * vec4(a_position, 1.0));\n"
+        "    normal = normalize(vec3(view * a_model * vec4(a_normal, 0.0)));\n"
+        "    base_color = a_base_color;\n"
+        "    specular_shininess = a_specular_shininess;\n"
         "}\n";
 
     const char *fragment_shader_source =
         "#version 330 core\n"
-        "#define LIGHTS_COUNT " LIGHTS_COUNT_STR "\n"
+        "#define CLUSTER_COUNT_X " QUOTE(LIGHT_CLUSTER_COUNT_X) "\n"
+        "#define CLUSTER_COUNT_Y " QUOTE(LIGHT_CLUSTER_COUNT_Y) "\n"
+        "#define CLUSTER_COUNT_Z " QUOTE(LIGHT_CLUSTER_COUNT_Z) "\n"
+        "#define SHADOW_MAP_SIZE " QUOTE(SHADOW_MAP_SIZE) "\n"
+        "#define SHADOW_LAYER_COUNT " QUOTE(SHADOW_LAYER_COUNT) "\n"
+        "#define SHADOW_CASCADE_COUNT " QUOTE(SHADOW_CASCADE_COUNT) "\n"
+        "#define SHADOW_SAMPLE_COUNT " QUOTE(SHADOW_SAMPLE_COUNT) "\n"
+        "#define SHADOW_MIN_FILTER_RADIUS " QUOTE(SHADOW_MIN_FILTER_RADIUS) "\n"
+        "#define SHADOW_MAX_FILTER_RADIUS " QUOTE(SHADOW_MAX_FILTER_RADIUS) "\n"
+        "#define SHADOW_MAX_BLOCKER_DISTANCE " QUOTE(SHADOW_MAX_BLOCKER_DISTANCE) "\n"
         "struct material_t\n"
         "{\n"
         "    vec3 base_color;\n"
         "    float specular;\n"
         "    float shininess;\n"
         "};\n"
-        "struct light_t\n"
-        "{\n"
-        "    vec4 position;\n"
-        "    vec3 color;\n"
-        "};\n"
         "out vec4 FragColor;\n"
         "in vec3 normal;\n"
         "in vec3 position;\n"
-        "layout (std140) uniform ub_lights\n"
+        "flat in vec3 base_color;\n"
+        "flat in vec2 specular_shininess;\n"
+        "uniform samplerBuffer light_data;\n"      // per light: view space position or direction and w, color and range, first shadow layer and shadow size
+        "uniform usamplerBuffer light_clusters;\n" // per cluster: offset and count in light_indices
+        "uniform usamplerBuffer light_indices;\n"
+        "uniform int global_light_count;\n"
+        "uniform vec2 cluster_tile_scale;\n"
+        "uniform float cluster_depth_scale;\n"
+        "uniform float cluster_depth_bias;\n"
+        "uniform sampler2DArrayShadow shadow_maps;\n"
+        "uniform sampler2DArray shadow_depths;\n"                 // the same maps without comparison
+        "uniform mat4 shadow_matrices[SHADOW_LAYER_COUNT];\n"     // view space to light clip space
+        "uniform vec4 shadow_layer_params[SHADOW_LAYER_COUNT];\n" // 1 for perspective, near, far, orthographic width
+        "uniform float shadow_cascade_splits[SHADOW_CASCADE_COUNT + 1];\n"
+        "uniform mat3 view_to_world;\n"
+        "uniform vec2 shadow_samples[SHADOW_SAMPLE_COUNT];\n" // spread evenly over the unit disk
+        "float get_shadow_distance(float depth, vec4 params)\n"
         "{\n"
-        "    light_t lights[LIGHTS_COUNT];\n"
-        "};\n"
-        "uniform material_t material;\n"
+        "    return params.x == 0.0 ? mix(params.y, params.z, depth) : params.y * params.z / (params.z - depth * (params.z - params.y));\n"
+        "}\n"
+        // Fraction of the light reaching the fragment. Like the tracer sampling the light's area, the penumbra grows with the
+        // light's size and the distance from the blockers, which are averaged over the area that could shadow the fragment.
+        "float get_shadow(vec4 light_position, vec4 light_shadow)\n"
+        "{\n"
+        "    int layer = int(light_shadow.x);\n"
+        "    if (layer < 0)\n"
+        "    {\n"
+        "        return 1.0;\n"
+        "    }\n"
+        "    float uv_scale;\n" // shadow map coordinates per world unit at the fragment
+        "    if (light_position.w == 0.0)\n"
+        "    {\n"
+        "        int cascade = 0;\n"
+        "        while (cascade < SHADOW_CASCADE_COUNT && -position.z > shadow_cascade_splits[cascade + 1])\n"
+        "        {\n"
+        "            cascade++;\n"
+        "        }\n"
+        "        if (cascade == SHADOW_CASCADE_COUNT)\n"
+        "        {\n"
+        "            return 1.0;\n"
+        "        }\n"
+        "        layer += cascade;\n"
+        "        uv_scale = 1.0 / shadow_layer_params[layer].w;\n"
+        "    }\n"
+        "    else\n"
+        "    {\n"
+        "        vec3 direction = view_to_world * (position - light_position.xyz);\n"
+        "        vec3 extent = abs(direction);\n"
+        "        layer += extent.x >= extent.y && extent.x >= extent.z ? (direction.x > 0.0 ? 0 : 1) : extent.y >= extent.z ? (direction.y > 0.0 ? 2 : 3) : (direction.z > 0.0 ? 4 : 5);\n"
+        "        uv_scale = 0.5 / max(max(extent.x, extent.y), extent.z);\n"
+        "    }\n"
+        "    vec4 params = shadow_layer_params[layer];\n"
+        // Moving the fragment off the surface by about a texel keeps it from shadowing itself
+        "    vec4 clip = shadow_matrices[layer] * vec4(position + normal * (1.5 / (uv_scale * SHADOW_MAP_SIZE)), 1.0);\n"
+        "    vec3 coord = clip.xyz / clip.w * 0.5 + 0.5;\n"
+        "    if (coord.z >= 1.0)\n"
+        "    {\n"
+        "        return 1.0;\n"
+        "    }\n"
+        "    float receiver_distance = get_shadow_distance(coord.z, params);\n"
+        // Every pixel turns the samples differently, trading banding for noise
+        "    float angle = 6.28318531 * fract(52.9829189 * fract(dot(gl_FragCoord.xy, vec2(0.06711056, 0.00583715))));\n"
+        "    mat2 rotation = mat2(cos(angle), sin(angle), -sin(angle), cos(angle));\n"
+        "    float search_radius = light_shadow.y * (params.x == 0.0 ? SHADOW_MAX_BLOCKER_DISTANCE : 1.0) * uv_scale;\n"
+        "    search_radius = clamp(search_radius, SHADOW_MIN_FILTER_RADIUS, SHADOW_MAX_FILTER_RADIUS);\n"
+        "    float blocker_distance = 0.0;\n"
+        "    int blocker_count = 0;\n"
+        "    for (int i = 0; i < SHADOW_SAMPLE_COUNT; i++)\n"
+        "    {\n"
+        "        float depth = textureLod(shadow_depths, vec3(coord.xy + rotation * shadow_samples[i] * search_radius, float(layer)), 0.0).r;\n"
+        "        if (depth < coord.z)\n"
+        "        {\n"
+        "            blocker_distance += get_shadow_distance(depth, params);\n"
+        "            blocker_count++;\n"
+        "        }\n"
+        "    }\n"
+        "    if (blocker_count == 0 || blocker_count == SHADOW_SAMPLE_COUNT)\n"
+        "    {\n"
+        "        return blocker_count == 0 ? 1.0 : 0.0;\n"
+        "    }\n"
+        "    blocker_distance /= float(blocker_count);\n"
+        "    float penumbra = light_shadow.y * (receiver_distance - blocker_distance) / (params.x == 0.0 ? 1.0 : blocker_distance);\n"
+        "    float filter_radius = clamp(penumbra * uv_scale, SHADOW_MIN_FILTER_RADIUS, SHADOW_MAX_FILTER_RADIUS);\n"
+        "    float light = 0.0;\n"
+        "    for (int i = 0; i < SHADOW_SAMPLE_COUNT; i++)\n"
+        "    {\n"
+        "        light += texture(shadow_maps, vec4(coord.xy + rotation * shadow_samples[i] * filter_radius, float(layer), coord.z));\n"
+        "    }\n"
+        "    return light / float(SHADOW_SAMPLE_COUNT);\n"
+        "}\n"
+        "vec3 shade(int light_index, material_t material)\n"
+        "{\n"
+        "    vec4 light_position = texelFetch(light_data, 3 * light_index);\n"
+        "    vec4 light_color_range = texelFetch(light_data, 3 * light_index + 1);\n"
+        "    vec3 light_color = light_color_range.rgb;\n"
+        "    if (light_position.w != 0.0 && light_color_range.a > 0.0)\n"
+        "    {\n"
+        "        float distance_ratio = length(light_position.xyz - position) / light_color_range.a;\n"
+        "        float window = clamp(1.0 - pow(distance_ratio, 4.0), 0.0, 1.0);\n"
+        "        light_color *= window * window;\n"
+        "    }\n"
+        "    vec3 light_direction = light_position.w == 0.0 ? light_position.xyz : normalize(light_position.xyz - position);\n"
+        "    float diffuse_intensity = max(dot(normal, light_direction), 0.0);\n"
+        // Surfaces facing away from a shadowed light are in their own shadow
+        "    vec4 light_shadow = texelFetch(light_data, 3 * light_index + 2);\n"
+        "    light_color *= diffuse_intensity > 0.0 ? get_shadow(light_position, light_shadow) : light_shadow.x < 0.0 ? 1.0 : 0.0;\n"
+        "    vec3 diffuse = diffuse_intensity * material.base_color * light_color;\n"
+        "    vec3 view_direction = normalize(-position);\n"
+        "    vec3 halfway_direction = normalize(light_direction + view_direction);\n"
+        "    float specular_intensity = pow(max(dot(normal, halfway_direction), 0.0), material.shininess);\n"
+        "    vec3 specular = specular_intensity * light_color;\n"
+        "    return diffuse + material.specular * specular;\n"
+        "}\n"
         "void main()\n"
         "{\n"
-        "    FragColor = vec4(0.0, 0.0, 0.0, 1.0);\n"
-        "    for (int i = 0; i < LIGHTS_COUNT; i++)\n"
+        "    material_t material = material_t(base_color, specular_shininess.x, specular_shininess.y);\n"
+        "    vec3 color = vec3(0.0);\n"
+        "    for (int i = 0; i < global_light_count; i++)\n"
+        "    {\n"
+        "        color += shade(int(texelFetch(light_indices, i).r), material);\n"
+        "    }\n"
+        "    ivec2 tile = min(ivec2(gl_FragCoord.xy * cluster_tile_scale), ivec2(CLUSTER_COUNT_X - 1, CLUSTER_COUNT_Y - 1));\n"
+        "    int slice = clamp(int(floor(log(-position.z) * cluster_depth_scale + cluster_depth_bias)), 0, CLUSTER_COUNT_Z - 1);\n"
+        "    uvec2 range = texelFetch(light_clusters, (slice * CLUSTER_COUNT_Y + tile.y) * CLUSTER_COUNT_X + tile.x).rg;\n"
+        "    for (uint i = 0u; i < range.y; i++)\n"
         "    {\n"
-        "        vec3 light_direction = lights[i].position.w == 0.0 ? lights[i].position.xyz : normalize(lights[i].position.xyz - position);\n"
-        "        float diffuse_intensity = max(dot(normal, light_direction), 0.0);\n"
-        "        vec3 diffuse = diffuse_intensity * material.base_color * lights[i].color;\n"
-        "        vec3 view_direction = normalize(-position);\n"
-        "        vec3 halfway_direction = normalize(light_direction + view_direction);\n"
-        "        float specular_intensity = pow(max(dot(normal, halfway_direction), 0.0), material.shininess);\n"
-        "        vec3 specular = specular_intensity * lights[i].color;\n"
-        "        FragColor += vec4(diffuse + material.specular * specular, 1.0);\n"
+        "        color += shade(int(texelFetch(light_indices, int(range.x + i)).r), material);\n"
         "    }\n"
+        "    FragColor = vec4(color, 1.0);\n"
         "}\n";
 
     renderer_rasterization->shader_program = create_shader_program(vertex_shader_source, fragment_shader_source);
     glUseProgram(renderer_rasterization->shader_program);
+    renderer_rasterization->projection_location = glGetUniformLocation(renderer_rasterization->shader_program, "projection");
+    renderer_rasterization->view_location = glGetUniformLocation(renderer_rasterization->shader_program, "view");
+    renderer_rasterization->global_light_count_location = glGetUniformLocation(renderer_rasterization->shader_program, "global_light_count");
+    renderer_rasterization->cluster_tile_scale_location = glGetUniformLocation(renderer_rasterization->shader_program, "cluster_tile_scale");
+    renderer_rasterization->cluster_depth_scale_location = glGetUniformLocation(renderer_rasterization->shader_program, "cluster_depth_scale");
+    renderer_rasterization->cluster_depth_bias_location = glGetUniformLocation(renderer_rasterization->shader_program, "cluster_depth_bias");
+    glUniform1i(glGetUniformLocation(renderer_rasterization->shader_program, "light_data"), 0);
+    glUniform1i(glGetUniformLocation(renderer_rasterization->shader_program, "light_clusters"), 1);
+    glUniform1i(glGetUniformLocation(renderer_rasterization->shader_program, "light_indices"), 2);
+    glUniform1i(glGetUniformLocation(renderer_rasterization->shader_program, "shadow_maps"), 3);
+    glUniform1i(glGetUniformLocation(renderer_rasterization->shader_program, "shadow_depths"), 4);
+    renderer_rasterization->shadow_matrices_location = glGetUniformLocation(renderer_rasterization->shader_program, "shadow_matrices");
+    renderer_rasterization->shadow_layer_params_location = glGetUniformLocation(renderer_rasterization->shader_program, "shadow_layer_params");
+    renderer_rasterization->shadow_cascade_splits_location = glGetUniformLocation(renderer_rasterization->shader_program, "shadow_cascade_splits");
+    renderer_rasterization->view_to_world_location = glGetUniformLocation(renderer_rasterization->shader_program, "view_to_world");
+    vec2 shadow_samples[SHADOW_SAMPLE_COUNT];
+    for (int i = 0; i < SHADOW_SAMPLE_COUNT; i++)
+    {
+        float angle = i * GLM_PI * (3.0f - sqrtf(5.0f));
+        float radius = sqrtf((i + 0.5f) / SHADOW_SAMPLE_COUNT);
+        shadow_samples[i][0] = radius * cosf(angle);
+        shadow_samples[i][1] = radius * sinf(angle);
+    }
+    glUniform2fv(glGetUniformLocation(renderer_rasterization->shader_program, "shadow_samples"), SHADOW_SAMPLE_COUNT, &shadow_samples[0][0]);
 
-    float plane_vertices[] = {
-        -1.0f, 0.0f, -1.0f, 0.0f, 1.0f, 0.0f,
-        -1.0f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f,
-        1.0f, 0.0f, -1.0f, 0.0f, 1.0f, 0.0f,
-        1.0f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f};
+    const char *shadow_vertex_shader_source =
+        "#version 330 core\n"
+        "layout (location = 0) in vec3 a_position;\n"
+        "layout (location = 2) in mat4 a_model;\n"
+        "uniform mat4 light_view_projection;\n"
+        "void main()\n"
+        "{\n"
+        "    gl_Position = light_view_projection * a_model * vec4(a_position, 1.0);\n"
+        "}\n";
+
+    const char *shadow_fragment_shader_source =
+        "#version 330 core\n"
+        "void main()\n"
+        "{\n"
+        "}\n";
+
+    renderer_rasterization->shadow_program = create_shader_program(shadow_vertex_shader_source, shadow_fragment_shader_source);
+    renderer_rasterization->light_view_projection_location = glGetUniformLocation(renderer_rasterization->shadow_program, "light_view_projection");
 
     glGenVertexArrays(1, &renderer_rasterization->plane_vao);
     glGenBuffers(1, &renderer_rasterization->plane_vbo);
+    glGenBuffers(1, &renderer_rasterization->plane_instance_vbo);
     glBindVertexArray(renderer_rasterization->plane_vao);
     glBindBuffer(GL_ARRAY_BUFFER, renderer_rasterization->plane_vbo);
     glBufferData(GL_ARRAY_BUFFER, sizeof(plane_vertices), plane_vertices, GL_STATIC_DRAW);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void *)0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, MESH_VERTEX_SIZE * sizeof(float), (void *)0);
     glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void *)(3 * sizeof(float)));
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, MESH_VERTEX_SIZE * sizeof(float), (void *)(3 * sizeof(float)));
     glEnableVertexAttribArray(1);
+    setup_instance_attributes(renderer_rasterization->plane_instance_vbo);
 
-    static float sphere_vertices[SPHERE_VERTEX_COUNT * 6];
-    static unsigned int sphere_indices[SPHERE_INDEX_COUNT];
-    generate_sphere_vertices(SPHERE_SECTOR_COUNT, SPHERE_STACK_COUNT, sphere_vertices, sphere_indices);
+    // All levels of detail share one vertex and one index buffer, every level has its own instances
+    sphere_meshes_t sphere_meshes;
+    sphere_meshes_create(&sphere_meshes);
+    for (int level = 0; level < SPHERE_LOD_COUNT; level++)
+    {
+        renderer_rasterization->sphere_lod_base_vertices[level] = sphere_meshes.base_vertices[level];
+        renderer_rasterization->sphere_lod_first_indices[level] = sphere_meshes.first_indices[level];
+    }
 
-    glGenVertexArrays(1, &renderer_rasterization->sphere_vao);
     glGenBuffers(1, &renderer_rasterization->sphere_vbo);
-    glGenBuffers(1, &renderer_rasterization->sphere_ebo);
-    glBindVertexArray(renderer_rasterization->sphere_vao);
     glBindBuffer(GL_ARRAY_BUFFER, renderer_rasterization->sphere_vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(sphere_vertices), sphere_vertices, GL_STATIC_DRAW);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, renderer_rasterization->sphere_ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(sphere_indices), sphere_indices, GL_STATIC_DRAW);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void *)0);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void *)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
+    glBufferData(GL_ARRAY_BUFFER, sphere_meshes.vertex_count * MESH_VERTEX_SIZE * sizeof(float), sphere_meshes.vertices, GL_STATIC_DRAW);
+    glGenBuffers(1, &renderer_rasterization->sphere_ebo);
+    glGenVertexArrays(SPHERE_LOD_COUNT, renderer_rasterization->sphere_vaos);
+    glGenBuffers(SPHERE_LOD_COUNT, renderer_rasterization->sphere_instance_vbos);
+    for (int level = 0; level < SPHERE_LOD_COUNT; level++)
+    {
+        glBindVertexArray(renderer_rasterization->sphere_vaos[level]);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, renderer_rasterization->sphere_ebo);
+        if (level == 0)
+        {
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, sphere_meshes.index_count * sizeof(unsigned int), sphere_meshes.indices, GL_STATIC_DRAW);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, renderer_rasterization->sphere_vbo);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, MESH_VERTEX_SIZE * sizeof(float), (void *)0);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, MESH_VERTEX_SIZE * sizeof(float), (void *)(3 * sizeof(float)));
+        glEnableVertexAttribArray(1);
+        setup_instance_attributes(renderer_rasterization->sphere_instance_vbos[level]);
+    }
+    sphere_meshes_destroy(&sphere_meshes);
 
-    float cube_vertices[] = {
-        // left
-        -0.5f, 0.5f, 0.5f, -1.0f, 0.0f, 0.0f,
-        -0.5f, 0.5f, -0.5f, -1.0f, 0.0f, 0.0f,
-        -0.5f, -0.5f, 0.5f, -1.0f, 0.0f, 0.0f,
-        -0.5f, -0.5f, -0.5f, -1.0f, 0.0f, 0.0f,
-        // bottom
-        -0.5f, -0.5f, -0.5f, 0.0f, -1.0f, 0.0f,
-        -0.5f, -0.5f, 0.5f, 0.0f, -1.0f, 0.0f,
-        0.5f, -0.5f, -0.5f, 0.0f, -1.0f, 0.0f,
-        0.5f, -0.5f, 0.5f, 0.0f, -1.0f, 0.0f,
-        // front
-        0.5f, -0.5f, 0.5f, 0.0f, 0.0f, 1.0f,
-        -0.5f, -0.5f, 0.5f, 0.0f, 0.0f, 1.0f,
-        0.5f, 0.5f, 0.5f, 0.0f, 0.0f, 1.0f,
-        -0.5f, 0.5f, 0.5f, 0.0f, 0.0f, 1.0f,
-        // top
-        -0.5f, 0.5f, 0.5f, 0.0f, 1.0f, 0.0f,
-        0.5f, 0.5f, 0.5f, 0.0f, 1.0f, 0.0f,
-        -0.5f, 0.5f, -0.5f, 0.0f, 1.0f, 0.0f,
-        0.5f, 0.5f, -0.5f, 0.0f, 1.0f, 0.0f,
-        // right
-        0.5f, 0.5f, -0.5f, 1.0f, 0.0f, 0.0f,
-        0.5f, -0.5f, -0.5f, 1.0f, 0.0f, 0.0f,
-        0.5f, 0.5f, 0.5f, 1.0f, 0.0f, 0.0f,
-        0.5f, -0.5f, 0.5f, 1.0f, 0.0f, 0.0f,
-        0.5f, -0.5f, 0.5f, 1.0f, 0.0f, 0.0f,
-        // back
-        0.5f, 0.5f, -0.5f, 0.0f, 0.0f, -1.0f,
-        0.5f, 0.5f, -0.5f, 0.0f, 0.0f, -1.0f,
-        0.5f, -0.5f, -0.5f, 0.0f, 0.0f, -1.0f,
-        -0.5f, 0.5f, -0.5f, 0.0f, 0.0f, -1.0f,
-        -0.5f, -0.5f, -0.5f, 0.0f, 0.0f, -1.0f};
     glGenVertexArrays(1, &renderer_rasterization->cube_vao);
     glGenBuffers(1, &renderer_rasterization->cube_vbo);
+    glGenBuffers(1, &renderer_rasterization->cube_instance_vbo);
     glBindVertexArray(renderer_rasterization->cube_vao);
     glBindBuffer(GL_ARRAY_BUFFER, renderer_rasterization->cube_vbo);
     glBufferData(GL_ARRAY_BUFFER, sizeof(cube_vertices), cube_vertices, GL_STATIC_DRAW);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void *)0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, MESH_VERTEX_SIZE * sizeof(float), (void *)0);
     glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void *)(3 * sizeof(float)));
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, MESH_VERTEX_SIZE * sizeof(float), (void *)(3 * sizeof(float)));
     glEnableVertexAttribArray(1);
+    setup_instance_attributes(renderer_rasterization->cube_instance_vbo);
+
+    GLuint *light_tbos[] = {&renderer_rasterization->light_data_tbo, &renderer_rasterization->light_clusters_tbo, &renderer_rasterization->light_indices_tbo};
+    GLuint *light_textures[] = {&renderer_rasterization->light_data_texture, &renderer_rasterization->light_clusters_texture, &renderer_rasterization->light_indices_texture};
+    GLenum light_formats[] = {GL_RGBA32F, GL_RG32UI, GL_R32UI};
+    for (int i = 0; i < 3; i++)
+    {
+        glGenBuffers(1, light_tbos[i]);
+        glBindBuffer(GL_TEXTURE_BUFFER, *light_tbos[i]);
+        glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_DYNAMIC_DRAW);
+        glGenTextures(1, light_textures[i]);
+        glBindTexture(GL_TEXTURE_BUFFER, *light_textures[i]);
+        glTexBuffer(GL_TEXTURE_BUFFER, light_formats[i], *light_tbos[i]);
+    }
+    renderer_rasterization->has_light_clusters = false;
 
-    unsigned int uniform_block_index = glGetUniformBlockIndex(renderer_rasterization->shader_program, "ub_lights");
-    glUniformBlockBinding(renderer_rasterization->shader_program, uniform_block_index, 0);
-    glGenBuffers(1, &renderer_rasterization->ubo_lights);
-    glBindBuffer(GL_UNIFORM_BUFFER, renderer_rasterization->ubo_lights);
-    glBufferData(GL_UNIFORM_BUFFER, 32 * LIGHTS_COUNT, NULL, GL_STATIC_DRAW);
-    glBindBufferBase(GL_UNIFORM_BUFFER, 0, renderer_rasterization->ubo_lights);
+    // Caster vertex arrays share the meshes but read every object's instance
+    GLuint caster_vbos[3] = {renderer_rasterization->plane_vbo, renderer_rasterization->sphere_vbo, renderer_rasterization->cube_vbo};
+    glGenVertexArrays(3, renderer_rasterization->caster_vaos);
+    glGenBuffers(3, renderer_rasterization->caster_instance_vbos);
+    for (int type = 0; type < 3; type++)
+    {
+        glBindVertexArray(renderer_rasterization->caster_vaos[type]);
+        if (type == OBJECT_TYPE_SPHERE)
+        {
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, renderer_rasterization->sphere_ebo);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, caster_vbos[type]);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, MESH_VERTEX_SIZE * sizeof(float), (void *)0);
+        glEnableVertexAttribArray(0);
+        setup_instance_attributes(renderer_rasterization->caster_instance_vbos[type]);
+    }
+    shadow_maps_create(&renderer_rasterization->shadow_maps);
 }
 
 void renderer_rasterization_render(renderer_t *renderer, scene_t *scene)
@@ -328,29 +722,52 @@ void renderer_rasterization_render(renderer_t *renderer, scene_t *scene)
     glEnable(GL_DEPTH_TEST);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    int width = 640, height = 480;
+    if (renderer_rasterization->width == 0 || renderer_rasterization->height == 0)
+    {
+        return;
+    }
+
     mat4 projection;
-    glm_perspective(45.0f, (float)width / (float)height, Z_NEAR, Z_FAR, projection);
+    glm_perspective(45.0f, (float)renderer_rasterization->width / (float)renderer_rasterization->height, Z_NEAR, Z_FAR, projection);
     mat4 view;
     glm_look(scene->camera.position, scene->camera.direction, scene->camera.up, view);
 
+    renderer_rasterization->stats = (render_stats_t){0};
+    update_shadows(renderer_rasterization, scene, view, projection);
+
     glUseProgram(renderer_rasterization->shader_program);
-    glUniformMatrix4fv(glGetUniformLocation(renderer_rasterization->shader_program, "projection"), 1, GL_FALSE, &projection[0][0]);
-    glUniformMatrix4fv(glGetUniformLocation(renderer_rasterization->shader_program, "view"), 1, GL_FALSE, &view[0][0]);
+    glUniformMatrix4fv(renderer_rasterization->projection_location, 1, GL_FALSE, &projection[0][0]);
+    glUniformMatrix4fv(renderer_rasterization->view_location, 1, GL_FALSE, &view[0][0]);
 
-    glBindBuffer(GL_UNIFORM_BUFFER, renderer_rasterization->ubo_lights);
-    for (int i = 0; i < scene->light_count; i++)
+    update_light_clusters(renderer_rasterization, scene, view, projection);
+    GLuint light_textures[] = {renderer_rasterization->light_data_texture, renderer_rasterization->light_clusters_texture, renderer_rasterization->light_indices_texture};
+    for (int i = 0; i < 3; i++)
     {
-        light_t light_view_space = scene->lights[i];
-        glm_mat4_mulv3(view, light_view_space.position, 1.0f, light_view_space.position);
-        glBufferSubData(GL_UNIFORM_BUFFER, i * 32, sizeof(light_view_space.position), &light_view_space.position[0]);
-        glBufferSubData(GL_UNIFORM_BUFFER, i * 32 + 16, sizeof(light_view_space.color), &light_view_space.color[0]);
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_BUFFER, light_textures[i]);
     }
 
-    for (int i = 0; i < scene->object_count; i++)
-    {
-        render_object(renderer_rasterization, &scene->objects[i]);
-    }
+    // One texture, sampled both with and without depth comparison
+    shadow_maps_t *shadow_maps = &renderer_rasterization->shadow_maps;
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, shadow_maps->texture);
+    glBindSampler(3, shadow_maps->compare_sampler);
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, shadow_maps->texture);
+    glBindSampler(4, shadow_maps->depth_sampler);
+
+    update_render_queue(renderer_rasterization, scene, view, projection);
+    render_queue_submit(&renderer_rasterization->render_queue, &renderer_rasterization->stats);
+}
+
+void renderer_rasterization_resize(renderer_t *renderer, int width, int height)
+{
+    renderer_rasterization_t *renderer_rasterization = (renderer_rasterization_t *)renderer;
+    renderer_rasterization->width = width;
+    renderer_rasterization->height = height;
+    renderer_rasterization->has_instances = false; // culling and screen sizes changed
+    renderer_rasterization->has_light_clusters = false;
+    renderer_rasterization->shadow_maps.has_cascades = false; // they fit the view frustum
 }
 
 void renderer_rasterization_destroy(renderer_t *renderer)
@@ -359,8 +776,42 @@ void renderer_rasterization_destroy(renderer_t *renderer)
     glDeleteBuffers(1, &((renderer_rasterization_t *)renderer)->plane_vbo);
     glDeleteBuffers(1, &((renderer_rasterization_t *)renderer)->sphere_vbo);
     glDeleteBuffers(1, &((renderer_rasterization_t *)renderer)->sphere_ebo);
-    glDeleteBuffers(1, &((renderer_rasterization_t *)renderer)->sphere_vao);
+    glDeleteVertexArrays(SPHERE_LOD_COUNT, ((renderer_rasterization_t *)renderer)->sphere_vaos);
     glDeleteBuffers(1, &((renderer_rasterization_t *)renderer)->cube_vbo);
-    glDeleteBuffers(1, &((renderer_rasterization_t *)renderer)->cube_vao);
+    glDeleteVertexArrays(1, &((renderer_rasterization_t *)renderer)->cube_vao);
+    glDeleteBuffers(1, &((renderer_rasterization_t *)renderer)->plane_instance_vbo);
+    glDeleteBuffers(SPHERE_LOD_COUNT, ((renderer_rasterization_t *)renderer)->sphere_instance_vbos);
+    glDeleteBuffers(1, &((renderer_rasterization_t *)renderer)->cube_instance_vbo);
     glDeleteProgram(((renderer_rasterization_t *)renderer)->shader_program);
+
+    // Scene caches start over on the next create
+    renderer_rasterization_t *renderer_rasterization = (renderer_rasterization_t *)renderer;
+    free(renderer_rasterization->object_instances);
+    free(renderer_rasterization->instances);
+    free(renderer_rasterization->sphere_lods);
+    free(renderer_rasterization->visible);
+    renderer_rasterization->object_instances = NULL;
+    renderer_rasterization->instances = NULL;
+    renderer_rasterization->sphere_lods = NULL;
+    renderer_rasterization->visible = NULL;
+    renderer_rasterization->object_capacity = 0;
+    renderer_rasterization->has_objects = false;
+    renderer_rasterization->has_instances = false;
+    bounding_spheres_destroy(&renderer_rasterization->bounding_spheres);
+    light_clusters_destroy(&renderer_rasterization->light_clusters);
+    free(renderer_rasterization->light_data);
+    renderer_rasterization->light_data = NULL;
+    renderer_rasterization->light_data_capacity = 0;
+    glDeleteBuffers(1, &renderer_rasterization->light_data_tbo);
+    glDeleteBuffers(1, &renderer_rasterization->light_clusters_tbo);
+    glDeleteBuffers(1, &renderer_rasterization->light_indices_tbo);
+    glDeleteTextures(1, &renderer_rasterization->light_data_texture);
+    glDeleteTextures(1, &renderer_rasterization->light_clusters_texture);
+    glDeleteTextures(1, &renderer_rasterization->light_indices_texture);
+    render_queue_destroy(&renderer_rasterization->render_queue);
+    glDeleteProgram(renderer_rasterization->shadow_program);
+    glDeleteVertexArrays(3, renderer_rasterization->caster_vaos);
+    glDeleteBuffers(3, renderer_rasterization->caster_instance_vbos);
+    render_queue_destroy(&renderer_rasterization->caster_render_queue);
+    shadow_maps_destroy(&renderer_rasterization->shadow_maps);
 }
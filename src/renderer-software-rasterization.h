@@ -0,0 +1,143 @@
+#pragma once
+
+#include "renderer.h"
+#include "scene.h"
+#include "software-rasterization.h"
+#include "texture-stream.h"
+#include "timing.h"
+#include "gl-utils.h"
+
+#define GLFW_INCLUDE_NONE
+#include <glad/glad.h>
+#include <cglm/cglm.h>
+#include <stdbool.h>
+
+typedef struct
+{
+    void (*create)(renderer_t *renderer);
+    void (*render)(renderer_t *renderer, scene_t *scene);
+    void (*resize)(renderer_t *renderer, int width, int height);
+    void (*destroy)(renderer_t *renderer);
+    GLuint shader_program;
+    GLuint quad_vao;
+    GLuint quad_vbo;
+    texture_stream_t texture_stream;
+    bool has_texture_stream;
+
+    // Frames are rendered on the GL thread, only when the scene changed, and shown like the ray tracer's images
+    software_rasterizer_t rasterizer;
+    framebuffer_t image;
+    bool has_image;
+    unsigned int image_scene_id;
+    double render_time; // of the last image, in seconds
+} renderer_software_rasterization_t;
+
+void renderer_software_rasterization_create(renderer_t *renderer)
+{
+    renderer_software_rasterization_t *renderer_software_rasterization = (renderer_software_rasterization_t *)renderer;
+
+    software_rasterizer_create(&renderer_software_rasterization->rasterizer, get_processor_count());
+    renderer_software_rasterization->image = (framebuffer_t){0};
+    renderer_software_rasterization->has_image = false;
+    renderer_software_rasterization->has_texture_stream = false;
+
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glDisable(GL_DEPTH_TEST);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    const char *vertex_shader_source =
+        "#version 330 core\n"
+        "layout (location = 0) in vec3 a_pos;\n"
+        "layout (location = 1) in vec2 a_tex_coord;\n"
+        "out vec2 tex_coord;\n"
+        "void main()\n"
+        "{\n"
+        "    gl_Position = vec4(a_pos, 1.0);\n"
+        "    tex_coord = a_tex_coord;\n"
+        "}";
+
+    const char *fragment_shader_source =
+        "#version 330 core\n"
+        "out vec4 FragColor;\n"
+        "in vec2 tex_coord;\n"
+        "uniform sampler2D u_texture;\n"
+        "void main()\n"
+        "{\n"
+        "    FragColor = texture(u_texture, tex_coord);\n"
+        "}";
+
+    renderer_software_rasterization->shader_program = create_shader_program(vertex_shader_source, fragment_shader_source);
+    glUseProgram(renderer_software_rasterization->shader_program);
+    glUniform1i(glGetUniformLocation(renderer_software_rasterization->shader_program, "u_texture"), 0);
+
+    float quad_vertices[] = {
+        -1.0f, -1.0f, 0.0f, 0.0f, 0.0f,
+        -1.0f, 1.0f, 0.0f, 0.0f, 1.0f,
+        1.0f, -1.0f, 0.0f, 1.0f, 0.0f,
+        1.0f, 1.0f, 0.0f, 1.0f, 1.0f};
+
+    glGenVertexArrays(1, &renderer_software_rasterization->quad_vao);
+    glGenBuffers(1, &renderer_software_rasterization->quad_vbo);
+    glBindVertexArray(renderer_software_rasterization->quad_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, renderer_software_rasterization->quad_vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(quad_vertices), quad_vertices, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void *)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void *)(3 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+}
+
+void renderer_software_rasterization_render(renderer_t *renderer, scene_t *scene)
+{
+    renderer_software_rasterization_t *renderer_software_rasterization = (renderer_software_rasterization_t *)renderer;
+    if (!renderer_software_rasterization->has_texture_stream)
+    {
+        return;
+    }
+
+    // Without a change the texture still holds the last image
+    if (!renderer_software_rasterization->has_image || renderer_software_rasterization->image_scene_id != scene->id)
+    {
+        double start_time = get_time();
+        software_rasterizer_render(&renderer_software_rasterization->rasterizer, scene, &renderer_software_rasterization->image);
+        renderer_software_rasterization->render_time = get_time() - start_time;
+        texture_stream_upload(&renderer_software_rasterization->texture_stream, renderer_software_rasterization->image.pixels);
+        renderer_software_rasterization->has_image = true;
+        renderer_software_rasterization->image_scene_id = scene->id;
+    }
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, renderer_software_rasterization->texture_stream.texture);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
+
+void renderer_software_rasterization_resize(renderer_t *renderer, int width, int height)
+{
+    renderer_software_rasterization_t *renderer_software_rasterization = (renderer_software_rasterization_t *)renderer;
+
+    framebuffer_resize(&renderer_software_rasterization->image, width, height);
+    renderer_software_rasterization->has_image = false;
+
+    // Immutable texture storage cannot change size, so a resize starts a new stream
+    if (renderer_software_rasterization->has_texture_stream)
+    {
+        texture_stream_destroy(&renderer_software_rasterization->texture_stream);
+    }
+    texture_stream_create(&renderer_software_rasterization->texture_stream, width, height);
+    renderer_software_rasterization->has_texture_stream = true;
+}
+
+void renderer_software_rasterization_destroy(renderer_t *renderer)
+{
+    renderer_software_rasterization_t *renderer_software_rasterization = (renderer_software_rasterization_t *)renderer;
+
+    glDeleteVertexArrays(1, &renderer_software_rasterization->quad_vao);
+    glDeleteBuffers(1, &renderer_software_rasterization->quad_vbo);
+    glDeleteProgram(renderer_software_rasterization->shader_program);
+    if (renderer_software_rasterization->has_texture_stream)
+    {
+        texture_stream_destroy(&renderer_software_rasterization->texture_stream);
+    }
+    software_rasterizer_destroy(&renderer_software_rasterization->rasterizer);
+    framebuffer_destroy(&renderer_software_rasterization->image);
+}
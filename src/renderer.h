@@ -6,5 +6,6 @@ typedef struct renderer_t
 {
     void (*create)(struct renderer_t *context);
     void (*render)(struct renderer_t *context, scene_t *scene);
+    void (*resize)(struct renderer_t *context, int width, int height);
     void (*destroy)(struct renderer_t *context);
 } renderer_t;
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <cglm/cglm.h>
+#include <stdint.h>
+#include <math.h>
+
+typedef enum
+{
+    SAMPLER_TYPE_RANDOM = 0,
+    SAMPLER_TYPE_SOBOL = 1
+} sampler_type_t;
+
+// PCG32 (XSH RR), one per thread so sampling never shares state
+typedef struct
+{
+    uint64_t state;
+    uint64_t increment;
+} pcg32_t;
+
+uint32_t pcg32_next(pcg32_t *rng)
+{
+    uint64_t state = rng->state;
+    rng->state = state * 6364136223846793005ULL + rng->increment;
+    uint32_t xorshifted = (uint32_t)(((state >> 18u) ^ state) >> 27u);
+    uint32_t rotation = (uint32_t)(state >> 59u);
+    return (xorshifted >> rotation) | (xorshifted << ((-rotation) & 31));
+}
+
+void pcg32_seed(pcg32_t *rng, uint64_t seed, uint64_t stream)
+{
+    rng->state = 0;
+    rng->increment = (stream << 1u) | 1u;
+    pcg32_next(rng);
+    rng->state += seed;
+    pcg32_next(rng);
+}
+
+// Uniform in [0, 1)
+float uint_to_unit_float(uint32_t value)
+{
+    return (value >> 8) * (1.0f / 16777216.0f);
+}
+
+float pcg32_next_float(pcg32_t *rng)
+{
+    return uint_to_unit_float(pcg32_next(rng));
+}
+
+uint32_t hash_uint(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+uint32_t hash_combine(uint32_t seed, uint32_t value)
+{
+    return seed ^ (hash_uint(value) + 0x9e3779b9U + (seed << 6) + (seed >> 2));
+}
+
+uint32_t reverse_bits(uint32_t x)
+{
+    x = ((x >> 1) & 0x55555555U) | ((x & 0x55555555U) << 1);
+    x = ((x >> 2) & 0x33333333U) | ((x & 0x33333333U) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fU) | ((x & 0x0f0f0f0fU) << 4);
+    x = ((x >> 8) & 0x00ff00ffU) | ((x & 0x00ff00ffU) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+// First two Sobol dimensions: van der Corput and the Pascal matrix sequence, a (0, 2)-sequence in base 2
+void sobol_2d(uint32_t index, uint32_t *x_dst, uint32_t *y_dst)
+{
+    uint32_t x = 0, y = 0;
+    uint32_t direction = 0x80000000U;
+    for (int bit = 0; index != 0; bit++, index >>= 1)
+    {
+        if (index & 1)
+        {
+            x ^= 0x80000000U >> bit;
+            y ^= direction;
+        }
+        direction ^= direction >> 1;
+    }
+    *x_dst = x;
+    *y_dst = y;
+}
+
+// Hash-based Owen scrambling (Burley 2020), randomizes the points while keeping their stratification
+uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed)
+{
+    x = reverse_bits(x);
+    x += seed;
+    x ^= x * 0x6c50b47cU;
+    x ^= x * 0xb82f1e52U;
+    x ^= x * 0xc7afe638U;
+    x ^= x * 0x8d22f6e6U;
+    return reverse_bits(x);
+}
+
+// Sample source for one pixel: dimension selects an independent 2D sequence, sample_index advances along it
+typedef struct
+{
+    sampler_type_t type;
+    pcg32_t *rng;
+    uint32_t pixel_seed;
+    uint32_t sample_index;
+} pixel_sampler_t;
+
+void pixel_sampler_init(pixel_sampler_t *sampler, sampler_type_t type, pcg32_t *rng, uint32_t pixel_index, uint32_t sample_index)
+{
+    sampler->type = type;
+    sampler->rng = rng;
+    sampler->pixel_seed = hash_uint(pixel_index);
+    sampler->sample_index = sample_index;
+}
+
+void pixel_sampler_get_2d(pixel_sampler_t *sampler, uint32_t dimension, vec2 sample_dst)
+{
+    if (sampler->type == SAMPLER_TYPE_RANDOM)
+    {
+        sample_dst[0] = pcg32_next_float(sampler->rng);
+        sample_dst[1] = pcg32_next_float(sampler->rng);
+        return;
+    }
+
+    // Shuffling the index per dimension decorrelates the dimensions, scrambling the values decorrelates the pixels
+    uint32_t seed = hash_combine(sampler->pixel_seed, dimension);
+    uint32_t index = nested_uniform_scramble(sampler->sample_index, seed);
+    uint32_t x, y;
+    sobol_2d(index, &x, &y);
+    sample_dst[0] = uint_to_unit_float(nested_uniform_scramble(x, hash_combine(seed, 0)));
+    sample_dst[1] = uint_to_unit_float(nested_uniform_scramble(y, hash_combine(seed, 1)));
+}
+
+// Two unit vectors perpendicular to n and to each other (Duff et al. 2017)
+void make_orthonormal_basis(vec3 n, vec3 tangent_dst, vec3 bitangent_dst)
+{
+    float sign = copysignf(1.0f, n[2]);
+    float a = -1.0f / (sign + n[2]);
+    float b = n[0] * n[1] * a;
+    glm_vec3_copy((vec3){1.0f + sign * n[0] * n[0] * a, sign * b, -sign * n[0]}, tangent_dst);
+    glm_vec3_copy((vec3){b, sign + n[1] * n[1] * a, -n[1]}, bitangent_dst);
+}
+
+// Concentric mapping of the unit square to the unit disk, keeps strata compact
+void sample_unit_disk(vec2 u, vec2 point_dst)
+{
+    float a = 2.0f * u[0] - 1.0f;
+    float b = 2.0f * u[1] - 1.0f;
+    if (a == 0.0f && b == 0.0f)
+    {
+        point_dst[0] = 0.0f;
+        point_dst[1] = 0.0f;
+        return;
+    }
+
+    float radius, angle;
+    if (fabsf(a) > fabsf(b))
+    {
+        radius = a;
+        angle = (GLM_PI / 4.0f) * (b / a);
+    }
+    else
+    {
+        radius = b;
+        angle = (GLM_PI / 2.0f) - (GLM_PI / 4.0f) * (a / b);
+    }
+    point_dst[0] = radius * cosf(angle);
+    point_dst[1] = radius * sinf(angle);
+}
+
+// Uniform direction within angle of axis
+void sample_cone(vec2 u, vec3 axis, float angle, vec3 direction_dst)
+{
+    float cos_theta = 1.0f - u[0] * (1.0f - cosf(angle));
+    float sin_theta = sqrtf(glm_max(0.0f, 1.0f - cos_theta * cos_theta));
+    float phi = 2.0f * GLM_PI * u[1];
+
+    vec3 tangent, bitangent;
+    make_orthonormal_basis(axis, tangent, bitangent);
+
+    glm_vec3_scale(axis, cos_theta, direction_dst);
+    glm_vec3_muladds(tangent, sin_theta * cosf(phi), direction_dst);
+    glm_vec3_muladds(bitangent, sin_theta * sinf(phi), direction_dst);
+}
+
+// Uniform point on the disk of the given radius facing direction, the silhouette of a spherical light seen along it
+void sample_disk(vec2 u, vec3 center, vec3 direction, float radius, vec3 point_dst)
+{
+    vec2 disk_point;
+    sample_unit_disk(u, disk_point);
+
+    vec3 tangent, bitangent;
+    make_orthonormal_basis(direction, tangent, bitangent);
+
+    glm_vec3_copy(center, point_dst);
+    glm_vec3_muladds(tangent, radius * disk_point[0], point_dst);
+    glm_vec3_muladds(bitangent, radius * disk_point[1], point_dst);
+}
+
+// Uniform direction on the hemisphere around normal
+void sample_hemisphere(vec2 u, vec3 normal, vec3 direction_dst)
+{
+    sample_cone(u, normal, GLM_PI / 2.0f, direction_dst);
+}
@@ -0,0 +1,308 @@
+#pragma once
+
+#include "bvh.h"
+#include "camera.h"
+#include "scene.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Binary scene files hold the scene's arrays exactly as renderers use them, so they are mapped into memory and read in
+// place instead of being parsed. A header with the camera and a table of sections comes first, every section starts at a
+// multiple of SCENE_FILE_ALIGNMENT. The records are the in-memory structs, so a file only loads on platforms with the same
+// byte order and struct layout; the header records both. Materials are stored within their objects, like in object_t.
+#define SCENE_FILE_MAGIC "PGLSCENE"
+#define SCENE_FILE_VERSION 1
+#define SCENE_FILE_BYTE_ORDER 0x01020304U
+#define SCENE_FILE_ALIGNMENT 64
+
+typedef enum
+{
+    SCENE_FILE_SECTION_OBJECTS,
+    SCENE_FILE_SECTION_LIGHTS,
+    SCENE_FILE_SECTION_BVH_NODES,          // optional, empty if the file has no BVH
+    SCENE_FILE_SECTION_BVH_OBJECT_INDICES, // bounded objects in leaf order, present with the nodes
+    SCENE_FILE_SECTION_COUNT
+} scene_file_section_type_t;
+
+typedef struct
+{
+    uint64_t offset; // from the start of the file
+    uint64_t count;  // of records
+} scene_file_section_t;
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order; // SCENE_FILE_BYTE_ORDER as written
+    uint32_t record_sizes[SCENE_FILE_SECTION_COUNT];
+    uint32_t camera_size;
+    camera_t camera;
+    scene_file_section_t sections[SCENE_FILE_SECTION_COUNT];
+} scene_file_header_t;
+
+typedef struct
+{
+    void *data;
+    size_t size;
+#ifdef _WIN32
+    HANDLE mapping;
+#endif
+    camera_t camera;
+    const object_t *objects;
+    int object_count;
+    const light_t *lights;
+    int light_count;
+    const bvh_node_t *bvh_nodes;
+    int bvh_node_count;
+    const int *bvh_object_indices;
+    int bvh_object_count;
+} scene_file_t;
+
+void get_scene_file_record_sizes(uint32_t *record_sizes_dst)
+{
+    record_sizes_dst[SCENE_FILE_SECTION_OBJECTS] = sizeof(object_t);
+    record_sizes_dst[SCENE_FILE_SECTION_LIGHTS] = sizeof(light_t);
+    record_sizes_dst[SCENE_FILE_SECTION_BVH_NODES] = sizeof(bvh_node_t);
+    record_sizes_dst[SCENE_FILE_SECTION_BVH_OBJECT_INDICES] = sizeof(int);
+}
+
+// Maps the whole file read-only, pages are only read from disk once they are touched
+bool scene_file_map(scene_file_t *file, const char *path)
+{
+#ifdef _WIN32
+    HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(handle, &size) || size.QuadPart == 0)
+    {
+        CloseHandle(handle);
+        return false;
+    }
+    file->size = (size_t)size.QuadPart;
+    file->mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(handle);
+    if (file->mapping == NULL)
+    {
+        return false;
+    }
+    file->data = MapViewOfFile(file->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (file->data == NULL)
+    {
+        CloseHandle(file->mapping);
+        return false;
+    }
+    return true;
+#else
+    int descriptor = open(path, O_RDONLY);
+    if (descriptor < 0)
+    {
+        return false;
+    }
+    struct stat status;
+    if (fstat(descriptor, &status) != 0 || status.st_size == 0)
+    {
+        close(descriptor);
+        return false;
+    }
+    file->size = (size_t)status.st_size;
+    file->data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    // The mapping keeps the file open
+    close(descriptor);
+    if (file->data == MAP_FAILED)
+    {
+        file->data = NULL;
+        return false;
+    }
+    return true;
+#endif
+}
+
+void scene_file_close(scene_file_t *file)
+{
+    if (file->data != NULL)
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(file->data);
+        CloseHandle(file->mapping);
+#else
+        munmap(file->data, file->size);
+#endif
+    }
+    *file = (scene_file_t){0};
+}
+
+// Start of a section's records, NULL if they don't lie within the file
+const void *scene_file_get_section(scene_file_t *file, const scene_file_header_t *header, scene_file_section_type_t type, int *count_dst)
+{
+    const scene_file_section_t *section = &header->sections[type];
+    uint64_t record_size = header->record_sizes[type];
+    if (section->offset % SCENE_FILE_ALIGNMENT != 0 || section->offset > file->size || section->count > INT32_MAX ||
+        section->count > (file->size - section->offset) / record_size)
+    {
+        return NULL;
+    }
+    *count_dst = (int)section->count;
+    return (const char *)file->data + section->offset;
+}
+
+// Maps a scene file and checks everything renderers rely on, so a broken file is rejected here instead of crashing them.
+// The arrays point into the mapping and stay valid until scene_file_close.
+bool scene_file_open(scene_file_t *file, const char *path)
+{
+    *file = (scene_file_t){0};
+    if (!scene_file_map(file, path))
+    {
+        fprintf(stderr, "Error: failed to map %s\n", path);
+        return false;
+    }
+
+    const scene_file_header_t *header = (const scene_file_header_t *)file->data;
+    if (file->size < sizeof(scene_file_header_t) || memcmp(header->magic, SCENE_FILE_MAGIC, sizeof(header->magic)) != 0)
+    {
+        fprintf(stderr, "Error: %s is not a scene file\n", path);
+        scene_file_close(file);
+        return false;
+    }
+    if (header->version != SCENE_FILE_VERSION)
+    {
+        fprintf(stderr, "Error: %s has version %u, only version %d is supported\n", path, (unsigned int)header->version, SCENE_FILE_VERSION);
+        scene_file_close(file);
+        return false;
+    }
+
+    uint32_t record_sizes[SCENE_FILE_SECTION_COUNT];
+    get_scene_file_record_sizes(record_sizes);
+    if (header->byte_order != SCENE_FILE_BYTE_ORDER || header->camera_size != sizeof(camera_t) ||
+        memcmp(header->record_sizes, record_sizes, sizeof(record_sizes)) != 0)
+    {
+        fprintf(stderr, "Error: %s was written on a platform with a different byte order or struct layout\n", path);
+        scene_file_close(file);
+        return false;
+    }
+
+    file->camera = header->camera;
+    file->objects = scene_file_get_section(file, header, SCENE_FILE_SECTION_OBJECTS, &file->object_count);
+    file->lights = scene_file_get_section(file, header, SCENE_FILE_SECTION_LIGHTS, &file->light_count);
+    file->bvh_nodes = scene_file_get_section(file, header, SCENE_FILE_SECTION_BVH_NODES, &file->bvh_node_count);
+    file->bvh_object_indices = scene_file_get_section(file, header, SCENE_FILE_SECTION_BVH_OBJECT_INDICES, &file->bvh_object_count);
+    if (file->objects == NULL || file->lights == NULL || file->bvh_nodes == NULL || file->bvh_object_indices == NULL)
+    {
+        fprintf(stderr, "Error: %s is truncated\n", path);
+        scene_file_close(file);
+        return false;
+    }
+
+    for (int i = 0; i < file->object_count; i++)
+    {
+        object_type_t type = file->objects[i].type;
+        if (type != OBJECT_TYPE_PLANE && type != OBJECT_TYPE_SPHERE && type != OBJECT_TYPE_CUBE)
+        {
+            fprintf(stderr, "Error: object %d in %s has unknown type %d\n", i, path, type);
+            scene_file_close(file);
+            return false;
+        }
+    }
+
+    if (!bvh_validate(file->bvh_nodes, file->bvh_node_count, file->bvh_object_indices, file->bvh_object_count, file->objects, file->object_count))
+    {
+        fprintf(stderr, "Error: %s has an invalid BVH\n", path);
+        scene_file_close(file);
+        return false;
+    }
+    if (file->bvh_node_count == 0)
+    {
+        file->bvh_nodes = NULL;
+        file->bvh_object_indices = NULL;
+        file->bvh_object_count = 0;
+    }
+    return true;
+}
+
+// Replaces the scene with the file's. The scene reads the objects, lights and BVH in place, so the file must stay open
+// while the scene or a snapshot of it exists; changing the scene copies them.
+void scene_load_file(scene_t *scene, scene_file_t *file)
+{
+    scene_destroy(scene);
+    scene_set_camera(scene, &file->camera);
+    scene->objects = (object_t *)file->objects;
+    scene->object_storage = scene_storage_borrow(file->objects);
+    scene->object_count = file->object_count;
+    scene->lights = (light_t *)file->lights;
+    scene->light_storage = scene_storage_borrow(file->lights);
+    scene->light_count = file->light_count;
+    scene_mark_content_changed(scene);
+
+    scene->prebuilt_bvh = (prebuilt_bvh_t){
+        .nodes = file->bvh_nodes,
+        .node_count = file->bvh_node_count,
+        .object_indices = file->bvh_object_indices,
+        .object_count = file->bvh_object_count,
+        .content_id = scene->content_id};
+}
+
+// Writes a scene file, with a BVH if bvh isn't NULL
+bool write_scene_file(const char *path, camera_t *camera, object_t *objects, int object_count, light_t *lights, int light_count, bvh_t *bvh)
+{
+    scene_file_header_t header = {0};
+    memcpy(header.magic, SCENE_FILE_MAGIC, sizeof(header.magic));
+    header.version = SCENE_FILE_VERSION;
+    header.byte_order = SCENE_FILE_BYTE_ORDER;
+    get_scene_file_record_sizes(header.record_sizes);
+    header.camera_size = sizeof(camera_t);
+    header.camera = *camera;
+
+    const void *section_data[SCENE_FILE_SECTION_COUNT] = {objects, lights, NULL, NULL};
+    header.sections[SCENE_FILE_SECTION_OBJECTS].count = object_count;
+    header.sections[SCENE_FILE_SECTION_LIGHTS].count = light_count;
+    if (bvh != NULL)
+    {
+        section_data[SCENE_FILE_SECTION_BVH_NODES] = bvh->nodes;
+        section_data[SCENE_FILE_SECTION_BVH_OBJECT_INDICES] = bvh->object_indices;
+        header.sections[SCENE_FILE_SECTION_BVH_NODES].count = bvh->node_count;
+        header.sections[SCENE_FILE_SECTION_BVH_OBJECT_INDICES].count = bvh->object_count;
+    }
+
+    uint64_t offset = sizeof(header);
+    for (int i = 0; i < SCENE_FILE_SECTION_COUNT; i++)
+    {
+        offset = (offset + SCENE_FILE_ALIGNMENT - 1) / SCENE_FILE_ALIGNMENT * SCENE_FILE_ALIGNMENT;
+        header.sections[i].offset = offset;
+        offset += header.sections[i].count * header.record_sizes[i];
+    }
+
+    FILE *stream = fopen(path, "wb");
+    if (stream == NULL)
+    {
+        return false;
+    }
+
+    static const char padding[SCENE_FILE_ALIGNMENT] = {0};
+    bool written = fwrite(&header, sizeof(header), 1, stream) == 1;
+    uint64_t position = sizeof(header);
+    for (int i = 0; i < SCENE_FILE_SECTION_COUNT && written; i++)
+    {
+        size_t padding_size = (size_t)(header.sections[i].offset - position);
+        size_t section_size = (size_t)(header.sections[i].count * header.record_sizes[i]);
+        written = fwrite(padding, 1, padding_size, stream) == padding_size &&
+                  (section_size == 0 || fwrite(section_data[i], 1, section_size, stream) == section_size);
+        position = header.sections[i].offset + section_size;
+    }
+    return fclose(stream) == 0 && written;
+}
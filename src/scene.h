@@ -2,9 +2,14 @@
 
 #include "camera.h"
 #include <cglm/cglm.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
-#define MAX_OBJECT_COUNT 512
-#define MAX_LIGHT_COUNT 512
+#define SCENE_STORAGE_MIN_CAPACITY 16
 
 typedef enum
 {
@@ -40,22 +45,175 @@ typedef struct
         float radius;         // for point light
         float angular_radius; // for directional light
     };
+    float range; // for point light, distance at which it fades out, 0 for unbounded
 } light_t;
 
+// Reference counted block of a scene's objects or lights. Snapshots of a scene share its blocks, and a scene copies a
+// shared block before changing it, so a snapshot costs the same for any scene size and never sees later changes.
+// A block can also borrow elements that live elsewhere, e.g. in a mapped scene file, they are copied on the first change.
 typedef struct
 {
+    atomic_int reference_count;
+    int capacity; // elements that fit, 0 for borrowed ones
+    void *elements;
+    max_align_t data[]; // owned elements
+} scene_storage_t;
+
+struct bvh_node;
+
+// Acceleration structure that came with the scene, e.g. from a scene file, so renderers don't have to build their own
+typedef struct
+{
+    const struct bvh_node *nodes;
+    int node_count;
+    const int *object_indices; // bounded objects in leaf order
     int object_count;
-    object_t objects[MAX_OBJECT_COUNT];
+    unsigned int content_id; // scene content it was built for, it is ignored once objects change
+} prebuilt_bvh_t;
+
+typedef struct
+{
+    // Renderers read objects and lights directly, they are only changed through the scene functions, which keep snapshots
+    // intact. A scene owns a reference to its storage and must be released with scene_destroy.
+    int object_count;
+    object_t *objects;
+    scene_storage_t *object_storage;
     int light_count;
-    light_t lights[MAX_LIGHT_COUNT];
+    light_t *lights;
+    scene_storage_t *light_storage;
     camera_t camera;
-    unsigned int id;
+    prebuilt_bvh_t prebuilt_bvh;
+    unsigned int id;         // changes whenever anything in the scene changes
+    unsigned int content_id; // changes when objects or lights change, but not the camera
 } scene_t;
 
+// Ids are drawn from one counter, so a snapshot or copy that changes after diverging from its scene never reuses an id the
+// scene had or will have, and caches keyed on ids can't confuse the two
+static atomic_uint scene_last_id;
+
+unsigned int scene_get_new_id(void)
+{
+    return atomic_fetch_add(&scene_last_id, 1) + 1;
+}
+
+scene_storage_t *scene_storage_create(int capacity, size_t element_size)
+{
+    scene_storage_t *storage = malloc(sizeof(scene_storage_t) + (size_t)capacity * element_size);
+    if (storage == NULL)
+    {
+        fprintf(stderr, "Error: failed to allocate scene storage for %d elements\n", capacity);
+        exit(EXIT_FAILURE);
+    }
+    atomic_init(&storage->reference_count, 1);
+    storage->capacity = capacity;
+    storage->elements = storage->data;
+    return storage;
+}
+
+// Storage of elements that must outlive it
+scene_storage_t *scene_storage_borrow(const void *elements)
+{
+    scene_storage_t *storage = scene_storage_create(0, 0);
+    storage->elements = (void *)elements;
+    return storage;
+}
+
+void scene_storage_retain(scene_storage_t *storage)
+{
+    if (storage != NULL)
+    {
+        atomic_fetch_add(&storage->reference_count, 1);
+    }
+}
+
+void scene_storage_release(scene_storage_t *storage)
+{
+    if (storage != NULL && atomic_fetch_sub(&storage->reference_count, 1) == 1)
+    {
+        free(storage);
+    }
+}
+
+// Makes *storage hold count elements that only its owner references, keeping the first kept_count. Shared or borrowed
+// storage is copied, full storage grows to twice its capacity.
+void *scene_storage_make_writable(scene_storage_t **storage, int kept_count, int count, size_t element_size)
+{
+    scene_storage_t *old_storage = *storage;
+    // Only the owner can add references, so once it holds the only one nobody else can read the elements anymore
+    if (old_storage != NULL && old_storage->capacity >= count && atomic_load(&old_storage->reference_count) == 1)
+    {
+        return old_storage->elements;
+    }
+
+    int capacity = old_storage != NULL && old_storage->capacity > SCENE_STORAGE_MIN_CAPACITY ? old_storage->capacity : SCENE_STORAGE_MIN_CAPACITY;
+    while (capacity < count)
+    {
+        if (capacity > INT_MAX / 2)
+        {
+            fprintf(stderr, "Error: scenes are limited to %d elements\n", INT_MAX);
+            exit(EXIT_FAILURE);
+        }
+        capacity *= 2;
+    }
+
+    *storage = scene_storage_create(capacity, element_size);
+    if (kept_count > 0)
+    {
+        memcpy((*storage)->elements, old_storage->elements, (size_t)kept_count * element_size);
+    }
+    scene_storage_release(old_storage);
+    return (*storage)->elements;
+}
+
+void scene_destroy(scene_t *scene)
+{
+    scene_storage_release(scene->object_storage);
+    scene_storage_release(scene->light_storage);
+    *scene = (scene_t){0};
+}
+
+// Makes snapshot_dst a copy of the scene that shares its objects and lights, releasing what it held before. Either one can
+// change afterwards without affecting the other, and the snapshot can be read on another thread meanwhile.
+void scene_snapshot(scene_t *scene, scene_t *snapshot_dst)
+{
+    if (snapshot_dst == scene)
+    {
+        return;
+    }
+    scene_storage_retain(scene->object_storage);
+    scene_storage_retain(scene->light_storage);
+    scene_destroy(snapshot_dst);
+    *snapshot_dst = *scene;
+}
+
+// The scene's objects with room for count of them, copied first if snapshots share them. Only the first object_count are
+// kept, the caller sets object_count.
+object_t *scene_get_writable_objects(scene_t *scene, int count)
+{
+    int kept_count = glm_imin(scene->object_count, count);
+    scene->objects = scene_storage_make_writable(&scene->object_storage, kept_count, count, sizeof(object_t));
+    return scene->objects;
+}
+
+// Like scene_get_writable_objects for the lights
+light_t *scene_get_writable_lights(scene_t *scene, int count)
+{
+    int kept_count = glm_imin(scene->light_count, count);
+    scene->lights = scene_storage_make_writable(&scene->light_storage, kept_count, count, sizeof(light_t));
+    return scene->lights;
+}
+
+void scene_mark_content_changed(scene_t *scene)
+{
+    scene->id = scene_get_new_id();
+    scene->content_id = scene->id;
+}
+
 void scene_add_object(scene_t *scene, object_t object)
 {
-    scene->objects[scene->object_count] = object;
+    scene_get_writable_objects(scene, scene->object_count + 1)[scene->object_count] = object;
     scene->object_count++;
+    scene_mark_content_changed(scene);
 }
 
 void make_sphere(object_t *sphere, vec3 center, float radius, material_t material)
@@ -113,8 +271,30 @@ void scene_add_point_light(scene_t *scene, vec3 position, vec3 color, float inte
     glm_vec3_copy(color, light.color);
     light.intensity = intensity;
     light.radius = radius;
-    scene->lights[scene->light_count] = light;
+    scene_get_writable_lights(scene, scene->light_count + 1)[scene->light_count] = light;
     scene->light_count++;
+    scene_mark_content_changed(scene);
+}
+
+// Like scene_add_point_light but only lighting surfaces within range, which renderers can use to skip it elsewhere
+void scene_add_point_light_with_range(scene_t *scene, vec3 position, vec3 color, float intensity, float radius, float range)
+{
+    scene_add_point_light(scene, position, color, intensity, radius);
+    scene_get_writable_lights(scene, scene->light_count)[scene->light_count - 1].range = range;
+}
+
+// Smooth window from 1 at a point light to 0 at its range, so bounded lights have no visible edge. 1 for unbounded lights.
+float get_light_falloff(light_t *light, vec3 position)
+{
+    if (light->position[3] == 0.0f || light->range <= 0.0f)
+    {
+        return 1.0f;
+    }
+
+    float distance_ratio = glm_vec3_distance(light->position, position) / light->range;
+    float distance_ratio2 = distance_ratio * distance_ratio;
+    float window = glm_clamp(1.0f - distance_ratio2 * distance_ratio2, 0.0f, 1.0f);
+    return window * window;
 }
 
 void scene_add_directional_light(scene_t *scene, vec3 direction, vec3 color, float intensity, float angular_radius)
@@ -124,34 +304,37 @@ void scene_add_directional_light(scene_t *scene, vec3 direction, vec3 color, flo
     glm_vec3_copy(color, light.color);
     light.intensity = intensity;
     light.angular_radius = angular_radius;
-    scene->lights[scene->light_count] = light;
+    scene_get_writable_lights(scene, scene->light_count + 1)[scene->light_count] = light;
     scene->light_count++;
+    scene_mark_content_changed(scene);
 }
 
 void scene_set_camera(scene_t *scene, camera_t *camera)
 {
     scene->camera = *camera;
-    ++scene->id;
+    scene->id = scene_get_new_id();
 }
 
 // TODO: Apply perspective division
 void scene_transform(scene_t *scene, mat4 transform, scene_t *scene_dst)
 {
-    if (scene != scene_dst)
-    {
-        *scene_dst = *scene;
-    }
+    scene_snapshot(scene, scene_dst);
+    // Objects move, so an acceleration structure built for them doesn't fit anymore
+    scene_dst->prebuilt_bvh = (prebuilt_bvh_t){0};
 
+    object_t *objects = scene_get_writable_objects(scene_dst, scene_dst->object_count);
     for (int i = 0; i < scene_dst->object_count; i++)
     {
-        object_t *object = &scene_dst->objects[i];
+        object_t *object = &objects[i];
         glm_mat4_mulv3(transform, object->position, 1.0f, object->position);
         glm_mat4_mulv3(transform, object->normal, 0.0f, object->normal);
     }
 
+    light_t *lights = scene_get_writable_lights(scene_dst, scene_dst->light_count);
     for (int i = 0; i < scene_dst->light_count; i++)
     {
-        light_t *light = &scene_dst->lights[i];
+        light_t *light = &lights[i];
         glm_mat4_mulv3(transform, light->position, 1.0f, light->position);
     }
+    scene_mark_content_changed(scene_dst);
 }
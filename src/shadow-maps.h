@@ -0,0 +1,351 @@
+#pragma once
+
+#include "camera.h"
+#include "render-queue.h"
+#include "scene.h"
+
+#define GLFW_INCLUDE_NONE
+#include <glad/glad.h>
+#include <cglm/cglm.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// One depth texture array holds every shadow map: the cascades of the shadowed directional lights, then six cube faces
+// per shadowed point light. OpenGL 3.3 has no cube map arrays, so faces are plain layers picked in the shader.
+#define SHADOW_MAP_SIZE 1024
+#define SHADOW_CASCADE_COUNT 4
+#define SHADOW_MAX_DIRECTIONAL_LIGHTS 1
+#define SHADOW_MAX_POINT_LIGHTS 2
+#define SHADOW_POINT_LAYER_OFFSET (SHADOW_MAX_DIRECTIONAL_LIGHTS * SHADOW_CASCADE_COUNT)
+#define SHADOW_LAYER_COUNT (SHADOW_POINT_LAYER_OFFSET + SHADOW_MAX_POINT_LIGHTS * 6)
+
+#define SHADOW_DISTANCE 40.0f            // view depth covered by the cascades
+#define SHADOW_CASCADE_SPLIT_WEIGHT 0.75f // blend between logarithmic and uniform cascade splits
+#define SHADOW_CASTER_DISTANCE 50.0f      // how far toward a directional light casters outside a cascade still count
+#define SHADOW_POINT_NEAR 0.05f
+#define SHADOW_DEPTH_BIAS_FACTOR 2.0f
+#define SHADOW_DEPTH_BIAS_UNITS 4.0f
+
+// Which lights cast shadows and the light space of every layer, rendered again only when what they depend on changes:
+// cascades follow the camera, point light faces only the objects and lights
+typedef struct
+{
+    GLuint texture;
+    GLuint framebuffer;
+    GLuint compare_sampler; // filtered depth comparisons
+    GLuint depth_sampler;   // raw depths for the blocker search
+    mat4 layer_matrices[SHADOW_LAYER_COUNT]; // world to light clip space
+    vec4 layer_params[SHADOW_LAYER_COUNT];   // 1 for perspective or 0 for orthographic, near, far, orthographic width
+    float cascade_splits[SHADOW_CASCADE_COUNT + 1];
+    int *light_layers; // first layer of every light or -1 if it casts no shadows
+    int light_layer_capacity;
+    int directional_lights[SHADOW_MAX_DIRECTIONAL_LIGHTS];
+    int point_lights[SHADOW_MAX_POINT_LIGHTS];
+    int rendered_point_lights[SHADOW_MAX_POINT_LIGHTS];
+    bool has_cascades;
+    unsigned int cascades_id;
+    bool has_point_maps;
+    unsigned int point_maps_content_id;
+} shadow_maps_t;
+
+void shadow_maps_create(shadow_maps_t *shadow_maps)
+{
+    glGenTextures(1, &shadow_maps->texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, shadow_maps->texture);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, SHADOW_LAYER_COUNT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 0);
+
+    GLuint samplers[2];
+    glGenSamplers(2, samplers);
+    shadow_maps->compare_sampler = samplers[0];
+    shadow_maps->depth_sampler = samplers[1];
+    for (int i = 0; i < 2; i++)
+    {
+        glSamplerParameteri(samplers[i], GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glSamplerParameteri(samplers[i], GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+    glSamplerParameteri(shadow_maps->compare_sampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glSamplerParameteri(shadow_maps->compare_sampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glSamplerParameteri(shadow_maps->compare_sampler, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glSamplerParameteri(shadow_maps->compare_sampler, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    glSamplerParameteri(shadow_maps->depth_sampler, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glSamplerParameteri(shadow_maps->depth_sampler, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    GLint previous_framebuffer;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previous_framebuffer);
+    glGenFramebuffers(1, &shadow_maps->framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, shadow_maps->framebuffer);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    glBindFramebuffer(GL_FRAMEBUFFER, previous_framebuffer);
+
+    for (int i = 0; i < SHADOW_MAX_POINT_LIGHTS; i++)
+    {
+        shadow_maps->point_lights[i] = -1;
+    }
+    shadow_maps->light_layers = NULL;
+    shadow_maps->light_layer_capacity = 0;
+    shadow_maps->has_cascades = false;
+    shadow_maps->has_point_maps = false;
+}
+
+void shadow_maps_destroy(shadow_maps_t *shadow_maps)
+{
+    glDeleteTextures(1, &shadow_maps->texture);
+    glDeleteSamplers(1, &shadow_maps->compare_sampler);
+    glDeleteSamplers(1, &shadow_maps->depth_sampler);
+    glDeleteFramebuffers(1, &shadow_maps->framebuffer);
+    free(shadow_maps->light_layers);
+    shadow_maps->light_layers = NULL;
+    shadow_maps->light_layer_capacity = 0;
+}
+
+// The first directional lights, and the point lights whose light reaches closest to the camera. A point light keeps its
+// slot while it stays selected, so its faces needn't be rendered again.
+void shadow_maps_select_lights(shadow_maps_t *shadow_maps, scene_t *scene)
+{
+    int closest_point_lights[SHADOW_MAX_POINT_LIGHTS];
+    float closest_distances[SHADOW_MAX_POINT_LIGHTS];
+    int directional_light_count = 0;
+    int point_light_count = 0;
+    for (int i = 0; i < SHADOW_MAX_DIRECTIONAL_LIGHTS; i++)
+    {
+        shadow_maps->directional_lights[i] = -1;
+    }
+
+    if (shadow_maps->light_layer_capacity < scene->light_count)
+    {
+        shadow_maps->light_layer_capacity = scene->light_count;
+        shadow_maps->light_layers = (int *)realloc(shadow_maps->light_layers, shadow_maps->light_layer_capacity * sizeof(int));
+        if (shadow_maps->light_layers == NULL)
+        {
+            fprintf(stderr, "Error: failed to allocate shadow map layers\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (int i = 0; i < scene->light_count; i++)
+    {
+        light_t *light = &scene->lights[i];
+        shadow_maps->light_layers[i] = -1;
+        if (light->position[3] == 0.0f)
+        {
+            if (directional_light_count < SHADOW_MAX_DIRECTIONAL_LIGHTS)
+            {
+                shadow_maps->directional_lights[directional_light_count++] = i;
+            }
+            continue;
+        }
+
+        float distance = glm_vec3_distance(light->position, scene->camera.position);
+        if (light->range > 0.0f)
+        {
+            distance = glm_max(distance - light->range, 0.0f);
+        }
+
+        // Insertion into the few closest so far
+        int slot = point_light_count < SHADOW_MAX_POINT_LIGHTS ? point_light_count++ : SHADOW_MAX_POINT_LIGHTS;
+        while (slot > 0 && closest_distances[slot - 1] > distance)
+        {
+            if (slot < SHADOW_MAX_POINT_LIGHTS)
+            {
+                closest_distances[slot] = closest_distances[slot - 1];
+                closest_point_lights[slot] = closest_point_lights[slot - 1];
+            }
+            slot--;
+        }
+        if (slot < SHADOW_MAX_POINT_LIGHTS)
+        {
+            closest_distances[slot] = distance;
+            closest_point_lights[slot] = i;
+        }
+    }
+
+    bool kept[SHADOW_MAX_POINT_LIGHTS] = {false};
+    for (int slot = 0; slot < SHADOW_MAX_POINT_LIGHTS; slot++)
+    {
+        int light_index = shadow_maps->point_lights[slot];
+        shadow_maps->point_lights[slot] = -1;
+        for (int i = 0; i < point_light_count; i++)
+        {
+            if (closest_point_lights[i] == light_index)
+            {
+                shadow_maps->point_lights[slot] = light_index;
+                kept[i] = true;
+            }
+        }
+    }
+    for (int i = 0, slot = 0; i < point_light_count; i++)
+    {
+        if (kept[i])
+        {
+            continue;
+        }
+        while (shadow_maps->point_lights[slot] >= 0)
+        {
+            slot++;
+        }
+        shadow_maps->point_lights[slot] = closest_point_lights[i];
+    }
+
+    for (int i = 0; i < directional_light_count; i++)
+    {
+        shadow_maps->light_layers[shadow_maps->directional_lights[i]] = i * SHADOW_CASCADE_COUNT;
+    }
+    for (int slot = 0; slot < SHADOW_MAX_POINT_LIGHTS; slot++)
+    {
+        if (shadow_maps->point_lights[slot] >= 0)
+        {
+            shadow_maps->light_layers[shadow_maps->point_lights[slot]] = SHADOW_POINT_LAYER_OFFSET + slot * 6;
+        }
+    }
+}
+
+// Splits the shadowed view depth so near cascades get most of the resolution without the far ones growing too coarse
+void shadow_maps_update_cascade_splits(shadow_maps_t *shadow_maps)
+{
+    for (int i = 0; i <= SHADOW_CASCADE_COUNT; i++)
+    {
+        float t = (float)i / SHADOW_CASCADE_COUNT;
+        float logarithmic = Z_NEAR * powf(SHADOW_DISTANCE / Z_NEAR, t);
+        float uniform = Z_NEAR + (SHADOW_DISTANCE - Z_NEAR) * t;
+        shadow_maps->cascade_splits[i] = glm_lerp(uniform, logarithmic, SHADOW_CASCADE_SPLIT_WEIGHT);
+    }
+}
+
+// An orthographic light space around the bounding sphere of the view frustum slice. The sphere doesn't change as the
+// camera turns and its center is snapped to whole texels, so the shadow edges don't shimmer when the camera moves.
+void shadow_maps_update_cascade(shadow_maps_t *shadow_maps, light_t *light, int layer, float near, float far, mat4 view, mat4 projection)
+{
+    // The sphere through the corners of both ends of the slice, its center on the view axis
+    float corner_scale = sqrtf(1.0f / (projection[0][0] * projection[0][0]) + 1.0f / (projection[1][1] * projection[1][1]));
+    float near_corner = near * corner_scale;
+    float far_corner = far * corner_scale;
+    float center_depth = glm_min((near + far) * 0.5f + (far_corner * far_corner - near_corner * near_corner) / (2.0f * (far - near)), far);
+    float radius = sqrtf((center_depth - near) * (center_depth - near) + near_corner * near_corner);
+    radius = glm_max(radius, far_corner);
+    radius = ceilf(radius * 16.0f) / 16.0f;
+
+    mat4 view_inverse;
+    glm_mat4_inv(view, view_inverse);
+    vec3 center;
+    glm_mat4_mulv3(view_inverse, (vec3){0.0f, 0.0f, -center_depth}, 1.0f, center);
+
+    vec3 light_direction;
+    glm_vec3_normalize_to(light->position, light_direction);
+    vec3 eye;
+    glm_vec3_scale(light_direction, radius + SHADOW_CASTER_DISTANCE, eye);
+    glm_vec3_add(center, eye, eye);
+    vec3 up = {0.0f, 1.0f, 0.0f};
+    if (fabsf(light_direction[1]) > 0.99f)
+    {
+        glm_vec3_copy((vec3){1.0f, 0.0f, 0.0f}, up);
+    }
+
+    float depth_range = 2.0f * radius + SHADOW_CASTER_DISTANCE;
+    mat4 light_view, light_projection;
+    glm_lookat(eye, center, up, light_view);
+    glm_ortho(-radius, radius, -radius, radius, 0.0f, depth_range, light_projection);
+    glm_mat4_mul(light_projection, light_view, shadow_maps->layer_matrices[layer]);
+
+    vec4 origin;
+    glm_mat4_mulv(shadow_maps->layer_matrices[layer], (vec4){0.0f, 0.0f, 0.0f, 1.0f}, origin);
+    float texels_per_unit = SHADOW_MAP_SIZE * 0.5f;
+    shadow_maps->layer_matrices[layer][3][0] += (roundf(origin[0] * texels_per_unit) - origin[0] * texels_per_unit) / texels_per_unit;
+    shadow_maps->layer_matrices[layer][3][1] += (roundf(origin[1] * texels_per_unit) - origin[1] * texels_per_unit) / texels_per_unit;
+
+    glm_vec4_copy((vec4){0.0f, 0.0f, depth_range, 2.0f * radius}, shadow_maps->layer_params[layer]);
+}
+
+// Six 90 degree perspectives looking down the world axes, in the order the shader picks them: +x, -x, +y, -y, +z, -z
+void shadow_maps_update_point_light(shadow_maps_t *shadow_maps, light_t *light, int first_layer)
+{
+    static const vec3 face_directions[6] = {{1.0f, 0.0f, 0.0f}, {-1.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f}, {0.0f, -1.0f, 0.0f}, {0.0f, 0.0f, 1.0f}, {0.0f, 0.0f, -1.0f}};
+    static const vec3 face_ups[6] = {{0.0f, -1.0f, 0.0f}, {0.0f, -1.0f, 0.0f}, {0.0f, 0.0f, 1.0f}, {0.0f, 0.0f, -1.0f}, {0.0f, -1.0f, 0.0f}, {0.0f, -1.0f, 0.0f}};
+
+    float far = light->range > 0.0f ? light->range : Z_FAR;
+    mat4 light_projection;
+    glm_perspective(GLM_PI_2f, 1.0f, SHADOW_POINT_NEAR, far, light_projection);
+    for (int face = 0; face < 6; face++)
+    {
+        mat4 light_view;
+        glm_look(light->position, (float *)face_directions[face], (float *)face_ups[face], light_view);
+        glm_mat4_mul(light_projection, light_view, shadow_maps->layer_matrices[first_layer + face]);
+        glm_vec4_copy((vec4){1.0f, SHADOW_POINT_NEAR, far, 0.0f}, shadow_maps->layer_params[first_layer + face]);
+    }
+}
+
+// Renders the casters into one layer with the light_view_projection uniform of the bound program set to the layer's matrix
+void shadow_maps_render_layer(shadow_maps_t *shadow_maps, int layer, render_queue_t *casters, GLint light_view_projection_location, render_stats_t *stats_dst)
+{
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadow_maps->texture, 0, layer);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    glUniformMatrix4fv(light_view_projection_location, 1, GL_FALSE, &shadow_maps->layer_matrices[layer][0][0]);
+    render_queue_submit(casters, stats_dst);
+}
+
+// Picks the shadowed lights and renders the layers that are out of date with the casters' program, returns whether
+// anything changed
+bool shadow_maps_update(shadow_maps_t *shadow_maps, scene_t *scene, mat4 view, mat4 projection,
+                        render_queue_t *casters, GLuint caster_program, GLint light_view_projection_location, render_stats_t *stats_dst)
+{
+    if (shadow_maps->has_cascades && shadow_maps->cascades_id == scene->id)
+    {
+        return false;
+    }
+    shadow_maps->has_cascades = true;
+    shadow_maps->cascades_id = scene->id;
+
+    shadow_maps_select_lights(shadow_maps, scene);
+    shadow_maps_update_cascade_splits(shadow_maps);
+
+    GLint previous_framebuffer;
+    GLint previous_viewport[4];
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previous_framebuffer);
+    glGetIntegerv(GL_VIEWPORT, previous_viewport);
+    glBindFramebuffer(GL_FRAMEBUFFER, shadow_maps->framebuffer);
+    glViewport(0, 0, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE);
+    glEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(SHADOW_DEPTH_BIAS_FACTOR, SHADOW_DEPTH_BIAS_UNITS);
+    glUseProgram(caster_program);
+
+    for (int i = 0; i < SHADOW_MAX_DIRECTIONAL_LIGHTS && shadow_maps->directional_lights[i] >= 0; i++)
+    {
+        light_t *light = &scene->lights[shadow_maps->directional_lights[i]];
+        for (int cascade = 0; cascade < SHADOW_CASCADE_COUNT; cascade++)
+        {
+            int layer = i * SHADOW_CASCADE_COUNT + cascade;
+            shadow_maps_update_cascade(shadow_maps, light, layer, shadow_maps->cascade_splits[cascade], shadow_maps->cascade_splits[cascade + 1], view, projection);
+            shadow_maps_render_layer(shadow_maps, layer, casters, light_view_projection_location, stats_dst);
+        }
+    }
+
+    bool content_changed = !shadow_maps->has_point_maps || shadow_maps->point_maps_content_id != scene->content_id;
+    for (int i = 0; i < SHADOW_MAX_POINT_LIGHTS; i++)
+    {
+        if (shadow_maps->point_lights[i] < 0 || (!content_changed && shadow_maps->rendered_point_lights[i] == shadow_maps->point_lights[i]))
+        {
+            continue;
+        }
+
+        int first_layer = SHADOW_POINT_LAYER_OFFSET + i * 6;
+        shadow_maps_update_point_light(shadow_maps, &scene->lights[shadow_maps->point_lights[i]], first_layer);
+        for (int face = 0; face < 6; face++)
+        {
+            shadow_maps_render_layer(shadow_maps, first_layer + face, casters, light_view_projection_location, stats_dst);
+        }
+    }
+    for (int i = 0; i < SHADOW_MAX_POINT_LIGHTS; i++)
+    {
+        shadow_maps->rendered_point_lights[i] = shadow_maps->point_lights[i];
+    }
+    shadow_maps->has_point_maps = true;
+    shadow_maps->point_maps_content_id = scene->content_id;
+
+    glDisable(GL_POLYGON_OFFSET_FILL);
+    glBindFramebuffer(GL_FRAMEBUFFER, previous_framebuffer);
+    glViewport(previous_viewport[0], previous_viewport[1], previous_viewport[2], previous_viewport[3]);
+    return true;
+}
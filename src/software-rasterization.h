@@ -0,0 +1,889 @@
+#pragma once
+
+#include "camera.h"
+#include "frustum-culling.h"
+#include "imaging.h"
+#include "light-clusters.h"
+#include "meshes.h"
+#include "scene.h"
+#include "thread-pool.h"
+
+#include <cglm/cglm.h>
+#include <float.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(SOFTWARE_RASTERIZATION_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+#define SOFTWARE_RASTERIZATION_SIMD
+#include <emmintrin.h>
+#endif
+
+#define RASTER_TILE_SIZE 64  // screen tiles triangles are binned into, every tile is rasterized and shaded by one job
+#define RASTER_BLOCK_SIZE 8  // blocks of the hierarchical depth buffer, which keeps the farthest depth of each
+#define RASTER_GUARD_BAND 8.0f // triangles are only clipped at this many half viewports from the center, the rest is skipped per tile
+#define RASTER_JOB_TRIANGLE_COUNT 1024 // strip triangles per geometry job, so a finely tessellated sphere spreads over the workers
+#define RASTER_MAX_CLIP_VERTICES 9     // a triangle clipped by 6 planes
+
+// A mesh vertex transformed by the same matrices as the OpenGL vertex shader
+typedef struct
+{
+    vec4 clip;
+    vec3 position; // view space
+    vec3 normal;
+} raster_vertex_t;
+
+// A triangle set up for rasterization and shading. The planes are a * x + b * y + c over window coordinates in pixels, with
+// y up like OpenGL.
+typedef struct
+{
+    float edges[3][3]; // edge i is opposite vertex i, positive inside
+    float depth[3];    // window depth from 0 to 1
+    float inverse_w[3];
+    float barycentric_w[2][3]; // barycentric coordinates of vertex 1 and 2 over w, interpolating them is perspective correct
+    float depth_min;
+    int bounds[2][2];      // [axis][min, max] in pixels, inclusive
+    unsigned int top_left; // bit i is set when edge i owns the pixels exactly on it
+    int object_index;
+    vec3 positions[3];
+    vec3 normals[3];
+} raster_triangle_t;
+
+// Triangles set up by one geometry job
+typedef struct
+{
+    raster_triangle_t *triangles;
+    int count;
+    int capacity;
+} raster_triangle_buffer_t;
+
+// A range of the triangles in a visible object's strip
+typedef struct
+{
+    int object_index;
+    int first;
+    int count;
+} raster_geometry_job_t;
+
+// Renders the objects the way the OpenGL rasterizer does, minus shadows, on the CPU. Triangles are set up in parallel, binned
+// into screen tiles, and each tile is rasterized into a visibility buffer of depths and triangles with a hierarchical depth
+// test, then shaded once per pixel.
+typedef struct
+{
+    thread_pool_t thread_pool;
+    sphere_meshes_t sphere_meshes;
+    int width;
+    int height;
+    int stride; // pixels per row of the buffers below, whole blocks
+    int tile_count_x;
+    int tile_count_y;
+    float *depths;
+    int32_t *triangle_ids; // -1 where nothing was drawn
+    float *block_depths;
+
+    // Per object, rebuilt when the objects change
+    bounding_spheres_t bounding_spheres;
+    bool *visible;
+    signed char *sphere_lods; // the level each sphere was last drawn at or -1
+    int object_capacity;
+    bool has_objects;
+    unsigned int objects_content_id;
+
+    // Per frame
+    raster_geometry_job_t *jobs;
+    int job_count;
+    int job_capacity;
+    raster_triangle_buffer_t *triangle_buffers; // one per job
+    int triangle_buffer_count;
+    raster_triangle_t **triangles; // all jobs' triangles in job order, indexed by triangle id
+    int triangle_count;
+    int triangle_capacity;
+    int *bin_offsets; // per tile, into bin_triangle_ids, and one past the end
+    int bin_offset_capacity;
+    int32_t *bin_triangle_ids;
+    int bin_capacity;
+    light_clusters_t light_clusters;
+    vec4 *light_positions; // view space
+    int light_position_capacity;
+    mat4 view;
+    mat4 projection;
+    scene_t *scene;
+    framebuffer_t *framebuffer;
+    int visible_object_count;
+    int culled_object_count;
+} software_rasterizer_t;
+
+void software_rasterizer_create(software_rasterizer_t *rasterizer, int thread_count)
+{
+    *rasterizer = (software_rasterizer_t){0};
+    thread_pool_create(&rasterizer->thread_pool, thread_count);
+    sphere_meshes_create(&rasterizer->sphere_meshes);
+}
+
+void software_rasterizer_destroy(software_rasterizer_t *rasterizer)
+{
+    thread_pool_destroy(&rasterizer->thread_pool);
+    sphere_meshes_destroy(&rasterizer->sphere_meshes);
+    free(rasterizer->depths);
+    free(rasterizer->triangle_ids);
+    free(rasterizer->block_depths);
+    bounding_spheres_destroy(&rasterizer->bounding_spheres);
+    free(rasterizer->visible);
+    free(rasterizer->sphere_lods);
+    free(rasterizer->jobs);
+    for (int i = 0; i < rasterizer->triangle_buffer_count; i++)
+    {
+        free(rasterizer->triangle_buffers[i].triangles);
+    }
+    free(rasterizer->triangle_buffers);
+    free(rasterizer->triangles);
+    free(rasterizer->bin_offsets);
+    free(rasterizer->bin_triangle_ids);
+    free(rasterizer->light_positions);
+    light_clusters_destroy(&rasterizer->light_clusters);
+    *rasterizer = (software_rasterizer_t){0};
+}
+
+// Grows *array to hold count elements, keeping its contents
+void reserve_raster_array(void **array, int *capacity, int count, size_t element_size)
+{
+    if (*capacity >= count)
+    {
+        return;
+    }
+
+    int new_capacity = *capacity > 0 ? *capacity : 64;
+    while (new_capacity < count)
+    {
+        new_capacity *= 2;
+    }
+    *array = realloc(*array, new_capacity * element_size);
+    if (*array == NULL)
+    {
+        fprintf(stderr, "Error: failed to allocate software rasterizer buffers\n");
+        exit(EXIT_FAILURE);
+    }
+    *capacity = new_capacity;
+}
+
+void software_rasterizer_resize(software_rasterizer_t *rasterizer, int width, int height)
+{
+    if (rasterizer->depths != NULL && rasterizer->width == width && rasterizer->height == height)
+    {
+        return;
+    }
+
+    rasterizer->width = width;
+    rasterizer->height = height;
+    rasterizer->stride = (width + RASTER_BLOCK_SIZE - 1) / RASTER_BLOCK_SIZE * RASTER_BLOCK_SIZE;
+    rasterizer->tile_count_x = (width + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+    rasterizer->tile_count_y = (height + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+    int padded_height = (height + RASTER_BLOCK_SIZE - 1) / RASTER_BLOCK_SIZE * RASTER_BLOCK_SIZE;
+    size_t pixel_count = (size_t)rasterizer->stride * padded_height;
+    free(rasterizer->depths);
+    free(rasterizer->triangle_ids);
+    free(rasterizer->block_depths);
+    rasterizer->depths = (float *)malloc(pixel_count * sizeof(float));
+    rasterizer->triangle_ids = (int32_t *)malloc(pixel_count * sizeof(int32_t));
+    rasterizer->block_depths = (float *)malloc(pixel_count / (RASTER_BLOCK_SIZE * RASTER_BLOCK_SIZE) * sizeof(float));
+    if (rasterizer->depths == NULL || rasterizer->triangle_ids == NULL || rasterizer->block_depths == NULL)
+    {
+        fprintf(stderr, "Error: failed to allocate %dx%d software rasterizer buffers\n", width, height);
+        exit(EXIT_FAILURE);
+    }
+}
+
+void update_raster_objects(software_rasterizer_t *rasterizer, scene_t *scene)
+{
+    if (rasterizer->has_objects && rasterizer->objects_content_id == scene->content_id)
+    {
+        return;
+    }
+    rasterizer->has_objects = true;
+    rasterizer->objects_content_id = scene->content_id;
+
+    if (rasterizer->object_capacity < scene->object_count)
+    {
+        int capacity = scene->object_count;
+        rasterizer->visible = (bool *)realloc(rasterizer->visible, capacity * sizeof(bool));
+        rasterizer->sphere_lods = (signed char *)realloc(rasterizer->sphere_lods, capacity * sizeof(signed char));
+        if (rasterizer->visible == NULL || rasterizer->sphere_lods == NULL)
+        {
+            fprintf(stderr, "Error: failed to allocate software rasterizer objects\n");
+            exit(EXIT_FAILURE);
+        }
+        rasterizer->object_capacity = capacity;
+    }
+    memset(rasterizer->sphere_lods, -1, scene->object_count * sizeof(signed char));
+    bounding_spheres_build(&rasterizer->bounding_spheres, scene->objects, scene->object_count);
+}
+
+// The triangle strip an object is drawn with, indices is NULL for unindexed strips
+void get_raster_mesh(software_rasterizer_t *rasterizer, int object_index, const float **vertices_dst, const unsigned int **indices_dst, int *element_count_dst)
+{
+    object_t *object = &rasterizer->scene->objects[object_index];
+    switch (object->type)
+    {
+    case OBJECT_TYPE_PLANE:
+        *vertices_dst = plane_vertices;
+        *indices_dst = NULL;
+        *element_count_dst = PLANE_VERTEX_COUNT;
+        break;
+    case OBJECT_TYPE_SPHERE:
+    {
+        int level = rasterizer->sphere_lods[object_index];
+        *vertices_dst = rasterizer->sphere_meshes.vertices + rasterizer->sphere_meshes.base_vertices[level] * MESH_VERTEX_SIZE;
+        *indices_dst = rasterizer->sphere_meshes.indices + rasterizer->sphere_meshes.first_indices[level];
+        *element_count_dst = SPHERE_INDEX_COUNT(SPHERE_LOD_SECTOR_COUNT(level), SPHERE_LOD_STACK_COUNT(level));
+        break;
+    }
+    case OBJECT_TYPE_CUBE:
+        *vertices_dst = cube_vertices;
+        *indices_dst = NULL;
+        *element_count_dst = CUBE_VERTEX_COUNT;
+        break;
+    default:
+        fprintf(stderr, "Error: unknown object type %d\n", object->type);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Culls the objects against the view frustum, picks the spheres' levels of detail like the OpenGL rasterizer, and splits the
+// visible objects' strips into geometry jobs
+void update_raster_jobs(software_rasterizer_t *rasterizer, scene_t *scene)
+{
+    update_raster_objects(rasterizer, scene);
+
+    mat4 projection_view;
+    glm_mat4_mul(rasterizer->projection, rasterizer->view, projection_view);
+    frustum_t frustum;
+    frustum_from_matrix(projection_view, &frustum);
+    rasterizer->visible_object_count = frustum_cull(&frustum, &rasterizer->bounding_spheres, rasterizer->visible);
+    rasterizer->culled_object_count = scene->object_count - rasterizer->visible_object_count;
+
+    // Pixels per world unit at unit view depth
+    float pixel_scale = rasterizer->projection[1][1] * 0.5f * rasterizer->height;
+    rasterizer->job_count = 0;
+    for (int i = 0; i < scene->object_count; i++)
+    {
+        object_t *object = &scene->objects[i];
+        if (!rasterizer->visible[i])
+        {
+            continue;
+        }
+
+        if (object->type == OBJECT_TYPE_SPHERE)
+        {
+            vec3 view_position;
+            glm_mat4_mulv3(rasterizer->view, object->position, 1.0f, view_position);
+            float depth = -view_position[2];
+            float screen_radius = depth > object->radius ? object->radius * pixel_scale / depth : FLT_MAX;
+            rasterizer->sphere_lods[i] = (signed char)select_sphere_lod(screen_radius, rasterizer->sphere_lods[i]);
+        }
+
+        const float *vertices;
+        const unsigned int *indices;
+        int element_count;
+        get_raster_mesh(rasterizer, i, &vertices, &indices, &element_count);
+        for (int first = 0; first < element_count - 2; first += RASTER_JOB_TRIANGLE_COUNT)
+        {
+            reserve_raster_array((void **)&rasterizer->jobs, &rasterizer->job_capacity, rasterizer->job_count + 1, sizeof(raster_geometry_job_t));
+            int count = element_count - 2 - first;
+            rasterizer->jobs[rasterizer->job_count++] = (raster_geometry_job_t){
+                .object_index = i,
+                .first = first,
+                .count = count < RASTER_JOB_TRIANGLE_COUNT ? count : RASTER_JOB_TRIANGLE_COUNT};
+        }
+    }
+
+    if (rasterizer->triangle_buffer_count < rasterizer->job_count)
+    {
+        rasterizer->triangle_buffers = (raster_triangle_buffer_t *)realloc(rasterizer->triangle_buffers, rasterizer->job_count * sizeof(raster_triangle_buffer_t));
+        if (rasterizer->triangle_buffers == NULL)
+        {
+            fprintf(stderr, "Error: failed to allocate software rasterizer buffers\n");
+            exit(EXIT_FAILURE);
+        }
+        memset(rasterizer->triangle_buffers + rasterizer->triangle_buffer_count, 0,
+               (rasterizer->job_count - rasterizer->triangle_buffer_count) * sizeof(raster_triangle_buffer_t));
+        rasterizer->triangle_buffer_count = rasterizer->job_count;
+    }
+}
+
+// Plane through the values at the three vertices, relative to vertex 0 so depths stay precise far from the origin
+void make_raster_plane(float x[3], float y[3], float values[3], float edges[3][3], float inverse_area, float plane_dst[3])
+{
+    float delta_1 = values[1] - values[0];
+    float delta_2 = values[2] - values[0];
+    plane_dst[0] = (delta_1 * edges[1][0] + delta_2 * edges[2][0]) * inverse_area;
+    plane_dst[1] = (delta_1 * edges[1][1] + delta_2 * edges[2][1]) * inverse_area;
+    plane_dst[2] = values[0] - plane_dst[0] * x[0] - plane_dst[1] * y[0];
+}
+
+// Sets up a clipped triangle, unless it's degenerate or covers no pixel centers
+void setup_raster_triangle(software_rasterizer_t *rasterizer, raster_vertex_t *vertices[3], int object_index, raster_triangle_buffer_t *buffer)
+{
+    float x[3], y[3], depth[3], inverse_w[3];
+    for (int i = 0; i < 3; i++)
+    {
+        inverse_w[i] = 1.0f / vertices[i]->clip[3];
+        x[i] = (vertices[i]->clip[0] * inverse_w[i] * 0.5f + 0.5f) * rasterizer->width;
+        y[i] = (vertices[i]->clip[1] * inverse_w[i] * 0.5f + 0.5f) * rasterizer->height;
+        depth[i] = vertices[i]->clip[2] * inverse_w[i] * 0.5f + 0.5f;
+    }
+
+    float area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+    if (area == 0.0f || isnan(area))
+    {
+        return;
+    }
+
+    // Pixels whose centers lie in the bounding box
+    float x_min = glm_min(glm_min(x[0], x[1]), x[2]), x_max = glm_max(glm_max(x[0], x[1]), x[2]);
+    float y_min = glm_min(glm_min(y[0], y[1]), y[2]), y_max = glm_max(glm_max(y[0], y[1]), y[2]);
+    int bounds[2][2] = {
+        {(int)glm_max(ceilf(x_min - 0.5f), 0.0f), (int)glm_min(floorf(x_max - 0.5f), rasterizer->width - 1.0f)},
+        {(int)glm_max(ceilf(y_min - 0.5f), 0.0f), (int)glm_min(floorf(y_max - 0.5f), rasterizer->height - 1.0f)}};
+    if (bounds[0][0] > bounds[0][1] || bounds[1][0] > bounds[1][1])
+    {
+        return;
+    }
+
+    reserve_raster_array((void **)&buffer->triangles, &buffer->capacity, buffer->count + 1, sizeof(raster_triangle_t));
+    raster_triangle_t *triangle = &buffer->triangles[buffer->count++];
+    memcpy(triangle->bounds, bounds, sizeof(bounds));
+    triangle->object_index = object_index;
+    triangle->top_left = 0;
+
+    // Every edge is set up from its lower endpoint, so the triangles sharing it compute exactly opposite values, and exactly
+    // one of them covers each pixel on it
+    for (int i = 0; i < 3; i++)
+    {
+        int from = (i + 1) % 3, to = (i + 2) % 3;
+        bool swapped = x[to] < x[from] || (x[to] == x[from] && y[to] < y[from]);
+        if (swapped)
+        {
+            int swap = from;
+            from = to;
+            to = swap;
+        }
+        float sign = swapped != (area < 0.0f) ? -1.0f : 1.0f;
+        float a = y[from] - y[to];
+        float b = x[to] - x[from];
+        float c = -(a * x[from] + b * y[from]);
+        triangle->edges[i][0] = sign * a;
+        triangle->edges[i][1] = sign * b;
+        triangle->edges[i][2] = sign * c;
+        if (triangle->edges[i][0] > 0.0f || (triangle->edges[i][0] == 0.0f && triangle->edges[i][1] < 0.0f))
+        {
+            triangle->top_left |= 1u << i;
+        }
+    }
+
+    float inverse_area = 1.0f / fabsf(area);
+    make_raster_plane(x, y, depth, triangle->edges, inverse_area, triangle->depth);
+    make_raster_plane(x, y, inverse_w, triangle->edges, inverse_area, triangle->inverse_w);
+    make_raster_plane(x, y, (float[3]){0.0f, inverse_w[1], 0.0f}, triangle->edges, inverse_area, triangle->barycentric_w[0]);
+    make_raster_plane(x, y, (float[3]){0.0f, 0.0f, inverse_w[2]}, triangle->edges, inverse_area, triangle->barycentric_w[1]);
+    triangle->depth_min = glm_min(glm_min(depth[0], depth[1]), depth[2]);
+    for (int i = 0; i < 3; i++)
+    {
+        glm_vec3_copy(vertices[i]->position, triangle->positions[i]);
+        glm_vec3_copy(vertices[i]->normal, triangle->normals[i]);
+    }
+}
+
+// Signed distance from a clip plane, positive inside: near, far, then the guard band's left, right, bottom and top
+float get_raster_clip_distance(vec4 clip, int plane)
+{
+    float w = plane < 2 ? clip[3] : RASTER_GUARD_BAND * clip[3];
+    float value = clip[plane < 2 ? 2 : (plane - 2) / 2];
+    return plane % 2 == 0 ? w + value : w - value;
+}
+
+int get_raster_outcode(vec4 clip)
+{
+    int outcode = 0;
+    for (int plane = 0; plane < 6; plane++)
+    {
+        outcode |= (get_raster_clip_distance(clip, plane) < 0.0f) << plane;
+    }
+    return outcode;
+}
+
+void lerp_raster_vertex(raster_vertex_t *from, raster_vertex_t *to, float t, raster_vertex_t *vertex_dst)
+{
+    glm_vec4_lerp(from->clip, to->clip, t, vertex_dst->clip);
+    glm_vec3_lerp(from->position, to->position, t, vertex_dst->position);
+    glm_vec3_lerp(from->normal, to->normal, t, vertex_dst->normal);
+}
+
+// Clips a triangle to the near and far planes and the guard band and sets up the pieces
+void clip_raster_triangle(software_rasterizer_t *rasterizer, raster_vertex_t *vertices[3], int object_index, raster_triangle_buffer_t *buffer)
+{
+    int outcodes[3] = {get_raster_outcode(vertices[0]->clip), get_raster_outcode(vertices[1]->clip), get_raster_outcode(vertices[2]->clip)};
+    if ((outcodes[0] & outcodes[1] & outcodes[2]) != 0)
+    {
+        return;
+    }
+    int crossed_planes = outcodes[0] | outcodes[1] | outcodes[2];
+    if (crossed_planes == 0)
+    {
+        setup_raster_triangle(rasterizer, vertices, object_index, buffer);
+        return;
+    }
+
+    // Sutherland-Hodgman against the crossed planes, then a fan
+    raster_vertex_t polygons[2][RASTER_MAX_CLIP_VERTICES];
+    int vertex_count = 3;
+    for (int i = 0; i < 3; i++)
+    {
+        polygons[0][i] = *vertices[i];
+    }
+    int current = 0;
+    for (int plane = 0; plane < 6 && vertex_count >= 3; plane++)
+    {
+        if (!(crossed_planes & (1 << plane)))
+        {
+            continue;
+        }
+
+        raster_vertex_t *input = polygons[current];
+        raster_vertex_t *output = polygons[1 - current];
+        int output_count = 0;
+        for (int i = 0; i < vertex_count; i++)
+        {
+            raster_vertex_t *from = &input[i];
+            raster_vertex_t *to = &input[(i + 1) % vertex_count];
+            float from_distance = get_raster_clip_distance(from->clip, plane);
+            float to_distance = get_raster_clip_distance(to->clip, plane);
+            if (from_distance >= 0.0f)
+            {
+                output[output_count++] = *from;
+            }
+            if ((from_distance >= 0.0f) != (to_distance >= 0.0f))
+            {
+                lerp_raster_vertex(from, to, from_distance / (from_distance - to_distance), &output[output_count++]);
+            }
+        }
+        vertex_count = output_count;
+        current = 1 - current;
+    }
+
+    for (int i = 1; i + 1 < vertex_count; i++)
+    {
+        raster_vertex_t *fan[3] = {&polygons[current][0], &polygons[current][i], &polygons[current][i + 1]};
+        setup_raster_triangle(rasterizer, fan, object_index, buffer);
+    }
+}
+
+// Transforms a job's part of an object's strip and sets up its triangles
+void process_raster_geometry(void *context, int worker_index, int job_index)
+{
+    software_rasterizer_t *rasterizer = (software_rasterizer_t *)context;
+    raster_geometry_job_t *job = &rasterizer->jobs[job_index];
+    raster_triangle_buffer_t *buffer = &rasterizer->triangle_buffers[job_index];
+    buffer->count = 0;
+
+    mat4 model, model_view, projection_model_view;
+    get_object_model_matrix(&rasterizer->scene->objects[job->object_index], model);
+    glm_mat4_mul(rasterizer->view, model, model_view);
+    glm_mat4_mul(rasterizer->projection, model_view, projection_model_view);
+
+    const float *vertices;
+    const unsigned int *indices;
+    int element_count;
+    get_raster_mesh(rasterizer, job->object_index, &vertices, &indices, &element_count);
+
+    // Consecutive strip triangles share two vertices, so the last three are kept
+    raster_vertex_t strip[3];
+    unsigned int strip_indices[3];
+    for (int i = 0; i < job->count + 2; i++)
+    {
+        int element = job->first + i;
+        unsigned int index = indices != NULL ? indices[element] : (unsigned int)element;
+        const float *vertex = vertices + index * MESH_VERTEX_SIZE;
+        raster_vertex_t *vertex_dst = &strip[i % 3];
+        strip_indices[i % 3] = index;
+        glm_mat4_mulv(projection_model_view, (vec4){vertex[0], vertex[1], vertex[2], 1.0f}, vertex_dst->clip);
+        glm_mat4_mulv3(model_view, (vec3){vertex[0], vertex[1], vertex[2]}, 1.0f, vertex_dst->position);
+        glm_mat4_mulv3(model_view, (vec3){vertex[3], vertex[4], vertex[5]}, 0.0f, vertex_dst->normal);
+        glm_vec3_normalize(vertex_dst->normal);
+
+        if (i < 2 || strip_indices[0] == strip_indices[1] || strip_indices[1] == strip_indices[2] || strip_indices[2] == strip_indices[0])
+        {
+            continue;
+        }
+        raster_vertex_t *triangle[3] = {&strip[(i - 2) % 3], &strip[(i - 1) % 3], &strip[i % 3]};
+        clip_raster_triangle(rasterizer, triangle, job->object_index, buffer);
+    }
+}
+
+// Lists every triangle in the tiles its bounds overlap, in submission order so overlapping triangles at equal depth resolve
+// the same way every frame
+void bin_raster_triangles(software_rasterizer_t *rasterizer)
+{
+    rasterizer->triangle_count = 0;
+    for (int i = 0; i < rasterizer->job_count; i++)
+    {
+        raster_triangle_buffer_t *buffer = &rasterizer->triangle_buffers[i];
+        reserve_raster_array((void **)&rasterizer->triangles, &rasterizer->triangle_capacity, rasterizer->triangle_count + buffer->count, sizeof(raster_triangle_t *));
+        for (int j = 0; j < buffer->count; j++)
+        {
+            rasterizer->triangles[rasterizer->triangle_count++] = &buffer->triangles[j];
+        }
+    }
+
+    int tile_count = rasterizer->tile_count_x * rasterizer->tile_count_y;
+    reserve_raster_array((void **)&rasterizer->bin_offsets, &rasterizer->bin_offset_capacity, tile_count + 1, sizeof(int));
+    int *bin_offsets = rasterizer->bin_offsets;
+    memset(bin_offsets, 0, (tile_count + 1) * sizeof(int));
+
+    // Counting sort: count each tile's triangles, place the bins back to back, then fill them
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (int i = 0; i < rasterizer->triangle_count; i++)
+        {
+            int(*bounds)[2] = rasterizer->triangles[i]->bounds;
+            for (int tile_y = bounds[1][0] / RASTER_TILE_SIZE; tile_y <= bounds[1][1] / RASTER_TILE_SIZE; tile_y++)
+            {
+                for (int tile_x = bounds[0][0] / RASTER_TILE_SIZE; tile_x <= bounds[0][1] / RASTER_TILE_SIZE; tile_x++)
+                {
+                    int tile = tile_y * rasterizer->tile_count_x + tile_x;
+                    if (pass == 1)
+                    {
+                        rasterizer->bin_triangle_ids[bin_offsets[tile]] = i;
+                    }
+                    bin_offsets[tile]++;
+                }
+            }
+        }
+
+        if (pass == 0)
+        {
+            int offset = 0;
+            for (int tile = 0; tile < tile_count; tile++)
+            {
+                int count = bin_offsets[tile];
+                bin_offsets[tile] = offset;
+                offset += count;
+            }
+            bin_offsets[tile_count] = offset;
+            reserve_raster_array((void **)&rasterizer->bin_triangle_ids, &rasterizer->bin_capacity, offset, sizeof(int32_t));
+        }
+    }
+
+    // Filling moved every offset to the end of its bin, which is the start of the next
+    for (int tile = tile_count; tile > 0; tile--)
+    {
+        bin_offsets[tile] = bin_offsets[tile - 1];
+    }
+    bin_offsets[0] = 0;
+}
+
+// False if the triangle misses every pixel center of the block
+bool raster_block_overlaps(raster_triangle_t *triangle, int block_x, int block_y)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        float *edge = triangle->edges[i];
+        float x = block_x + (edge[0] > 0.0f ? RASTER_BLOCK_SIZE - 0.5f : 0.5f);
+        float y = block_y + (edge[1] > 0.0f ? RASTER_BLOCK_SIZE - 0.5f : 0.5f);
+        if (edge[0] * x + (edge[1] * y + edge[2]) < 0.0f)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Farthest depth in a block
+float get_raster_block_depth(software_rasterizer_t *rasterizer, int block_x, int block_y)
+{
+    float *depths = &rasterizer->depths[(size_t)block_y * rasterizer->stride + block_x];
+#ifdef SOFTWARE_RASTERIZATION_SIMD
+    __m128 depth_max = _mm_setzero_ps();
+    for (int y = 0; y < RASTER_BLOCK_SIZE; y++, depths += rasterizer->stride)
+    {
+        for (int x = 0; x < RASTER_BLOCK_SIZE; x += 4)
+        {
+            depth_max = _mm_max_ps(depth_max, _mm_loadu_ps(&depths[x]));
+        }
+    }
+    depth_max = _mm_max_ps(depth_max, _mm_shuffle_ps(depth_max, depth_max, _MM_SHUFFLE(1, 0, 3, 2)));
+    depth_max = _mm_max_ps(depth_max, _mm_shuffle_ps(depth_max, depth_max, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtss_f32(depth_max);
+#else
+    float depth_max = 0.0f;
+    for (int y = 0; y < RASTER_BLOCK_SIZE; y++, depths += rasterizer->stride)
+    {
+        for (int x = 0; x < RASTER_BLOCK_SIZE; x++)
+        {
+            depth_max = glm_max(depth_max, depths[x]);
+        }
+    }
+    return depth_max;
+#endif
+}
+
+// Depth tests the triangle's pixels in [x_min, x_max] x [y_min, y_max] of one block, returns whether any were drawn
+bool rasterize_block(software_rasterizer_t *rasterizer, raster_triangle_t *triangle, int32_t triangle_id, int block_x, int x_min, int x_max, int y_min, int y_max)
+{
+    float *edges = &triangle->edges[0][0];
+    float *depth = triangle->depth;
+    bool drawn = false;
+#ifdef SOFTWARE_RASTERIZATION_SIMD
+    __m128 zero = _mm_setzero_ps();
+    __m128 offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+    __m128 edge_a[3], top_left[3];
+    for (int i = 0; i < 3; i++)
+    {
+        edge_a[i] = _mm_set1_ps(edges[3 * i]);
+        top_left[i] = _mm_castsi128_ps(_mm_set1_epi32(triangle->top_left & (1u << i) ? -1 : 0));
+    }
+    __m128 depth_a = _mm_set1_ps(depth[0]);
+    __m128 id = _mm_castsi128_ps(_mm_set1_epi32(triangle_id));
+    __m128 lane_min = _mm_set1_ps(x_min + 0.5f);
+    __m128 lane_max = _mm_set1_ps(x_max + 0.5f);
+    for (int y = y_min; y <= y_max; y++)
+    {
+        float center_y = y + 0.5f;
+        __m128 edge_row[3];
+        for (int i = 0; i < 3; i++)
+        {
+            edge_row[i] = _mm_set1_ps(edges[3 * i + 1] * center_y + edges[3 * i + 2]);
+        }
+        __m128 depth_row = _mm_set1_ps(depth[1] * center_y + depth[2]);
+        size_t row = (size_t)y * rasterizer->stride;
+        for (int x = block_x; x <= x_max; x += 4)
+        {
+            __m128 center_x = _mm_add_ps(_mm_set1_ps((float)x), offsets);
+            __m128 mask = _mm_and_ps(_mm_cmpge_ps(center_x, lane_min), _mm_cmple_ps(center_x, lane_max));
+            for (int i = 0; i < 3; i++)
+            {
+                __m128 value = _mm_add_ps(_mm_mul_ps(edge_a[i], center_x), edge_row[i]);
+                mask = _mm_and_ps(mask, _mm_or_ps(_mm_cmpgt_ps(value, zero), _mm_and_ps(_mm_cmpeq_ps(value, zero), top_left[i])));
+            }
+            float *depths = &rasterizer->depths[row + x];
+            float *ids = (float *)&rasterizer->triangle_ids[row + x];
+            __m128 pixel_depth = _mm_add_ps(_mm_mul_ps(depth_a, center_x), depth_row);
+            __m128 stored_depth = _mm_loadu_ps(depths);
+            mask = _mm_and_ps(mask, _mm_cmplt_ps(pixel_depth, stored_depth));
+            if (_mm_movemask_ps(mask) == 0)
+            {
+                continue;
+            }
+            _mm_storeu_ps(depths, _mm_or_ps(_mm_and_ps(mask, pixel_depth), _mm_andnot_ps(mask, stored_depth)));
+            _mm_storeu_ps(ids, _mm_or_ps(_mm_and_ps(mask, id), _mm_andnot_ps(mask, _mm_loadu_ps(ids))));
+            drawn = true;
+        }
+    }
+#else
+    for (int y = y_min; y <= y_max; y++)
+    {
+        float center_y = y + 0.5f;
+        float edge_row[3];
+        for (int i = 0; i < 3; i++)
+        {
+            edge_row[i] = edges[3 * i + 1] * center_y + edges[3 * i + 2];
+        }
+        float depth_row = depth[1] * center_y + depth[2];
+        size_t row = (size_t)y * rasterizer->stride;
+        for (int x = x_min; x <= x_max; x++)
+        {
+            float center_x = x + 0.5f;
+            bool inside = true;
+            for (int i = 0; i < 3 && inside; i++)
+            {
+                float value = edges[3 * i] * center_x + edge_row[i];
+                inside = value > 0.0f || (value == 0.0f && (triangle->top_left & (1u << i)));
+            }
+            float pixel_depth = depth[0] * center_x + depth_row;
+            if (inside && pixel_depth < rasterizer->depths[row + x])
+            {
+                rasterizer->depths[row + x] = pixel_depth;
+                rasterizer->triangle_ids[row + x] = triangle_id;
+                drawn = true;
+            }
+        }
+    }
+#endif
+    return drawn;
+}
+
+// Draws a triangle into the part of a tile it overlaps, skipping the blocks it's behind everything in
+void rasterize_triangle(software_rasterizer_t *rasterizer, int32_t triangle_id, int tile_x_min, int tile_y_min, int tile_x_max, int tile_y_max)
+{
+    raster_triangle_t *triangle = rasterizer->triangles[triangle_id];
+    int x_min = glm_max(triangle->bounds[0][0], tile_x_min), x_max = glm_min(triangle->bounds[0][1], tile_x_max);
+    int y_min = glm_max(triangle->bounds[1][0], tile_y_min), y_max = glm_min(triangle->bounds[1][1], tile_y_max);
+    int block_stride = rasterizer->stride / RASTER_BLOCK_SIZE;
+    for (int block_y = y_min / RASTER_BLOCK_SIZE * RASTER_BLOCK_SIZE; block_y <= y_max; block_y += RASTER_BLOCK_SIZE)
+    {
+        for (int block_x = x_min / RASTER_BLOCK_SIZE * RASTER_BLOCK_SIZE; block_x <= x_max; block_x += RASTER_BLOCK_SIZE)
+        {
+            float *block_depth = &rasterizer->block_depths[block_y / RASTER_BLOCK_SIZE * block_stride + block_x / RASTER_BLOCK_SIZE];
+            if (triangle->depth_min >= *block_depth || !raster_block_overlaps(triangle, block_x, block_y))
+            {
+                continue;
+            }
+
+            if (rasterize_block(rasterizer, triangle, triangle_id, block_x,
+                                glm_max(x_min, block_x), glm_min(x_max, block_x + RASTER_BLOCK_SIZE - 1),
+                                glm_max(y_min, block_y), glm_min(y_max, block_y + RASTER_BLOCK_SIZE - 1)))
+            {
+                *block_depth = get_raster_block_depth(rasterizer, block_x, block_y);
+            }
+        }
+    }
+}
+
+// Blinn-Phong like the OpenGL rasterizer's shade(), without shadows
+void shade_raster_light(software_rasterizer_t *rasterizer, int light_index, vec3 position, vec3 normal, material_t *material, vec3 color_dst)
+{
+    light_t *light = &rasterizer->scene->lights[light_index];
+    float *light_position = rasterizer->light_positions[light_index];
+    vec3 light_color;
+    glm_vec3_copy(light->color, light_color);
+    if (light_position[3] != 0.0f && light->range > 0.0f)
+    {
+        float distance_ratio_squared = glm_vec3_distance2(light_position, position) / (light->range * light->range);
+        float window = glm_clamp(1.0f - distance_ratio_squared * distance_ratio_squared, 0.0f, 1.0f);
+        glm_vec3_scale(light_color, window * window, light_color);
+    }
+
+    vec3 light_direction;
+    if (light_position[3] == 0.0f)
+    {
+        glm_vec3_copy(light_position, light_direction);
+    }
+    else
+    {
+        glm_vec3_sub(light_position, position, light_direction);
+        glm_vec3_normalize(light_direction);
+    }
+    float diffuse_intensity = glm_max(glm_vec3_dot(normal, light_direction), 0.0f);
+
+    vec3 view_direction, halfway_direction;
+    glm_vec3_negate_to(position, view_direction);
+    glm_vec3_normalize(view_direction);
+    glm_vec3_add(light_direction, view_direction, halfway_direction);
+    glm_vec3_normalize(halfway_direction);
+    float specular_intensity = powf(glm_max(glm_vec3_dot(normal, halfway_direction), 0.0f), material->shininess);
+
+    for (int i = 0; i < 3; i++)
+    {
+        color_dst[i] += (diffuse_intensity * material->base_color[i] + material->specular * specular_intensity) * light_color[i];
+    }
+}
+
+// Interpolates the visible triangle's view position and normal at a pixel center and lights it with its cluster's lights
+void shade_raster_pixel(software_rasterizer_t *rasterizer, raster_triangle_t *triangle, int x, int y, vec3 color_dst)
+{
+    float center_x = x + 0.5f, center_y = y + 0.5f;
+    float inverse_w = triangle->inverse_w[0] * center_x + triangle->inverse_w[1] * center_y + triangle->inverse_w[2];
+    float barycentric_1 = (triangle->barycentric_w[0][0] * center_x + triangle->barycentric_w[0][1] * center_y + triangle->barycentric_w[0][2]) / inverse_w;
+    float barycentric_2 = (triangle->barycentric_w[1][0] * center_x + triangle->barycentric_w[1][1] * center_y + triangle->barycentric_w[1][2]) / inverse_w;
+    float barycentric_0 = 1.0f - barycentric_1 - barycentric_2;
+
+    // Like the shader, the interpolated normal isn't renormalized
+    vec3 position, normal;
+    for (int i = 0; i < 3; i++)
+    {
+        position[i] = barycentric_0 * triangle->positions[0][i] + barycentric_1 * triangle->positions[1][i] + barycentric_2 * triangle->positions[2][i];
+        normal[i] = barycentric_0 * triangle->normals[0][i] + barycentric_1 * triangle->normals[1][i] + barycentric_2 * triangle->normals[2][i];
+    }
+    material_t *material = &rasterizer->scene->objects[triangle->object_index].material;
+
+    light_clusters_t *clusters = &rasterizer->light_clusters;
+    glm_vec3_zero(color_dst);
+    for (int i = 0; i < clusters->global_light_count; i++)
+    {
+        shade_raster_light(rasterizer, clusters->light_indices[i], position, normal, material, color_dst);
+    }
+    int tile_x = glm_min((int)(center_x * LIGHT_CLUSTER_COUNT_X / rasterizer->width), LIGHT_CLUSTER_COUNT_X - 1);
+    int tile_y = glm_min((int)(center_y * LIGHT_CLUSTER_COUNT_Y / rasterizer->height), LIGHT_CLUSTER_COUNT_Y - 1);
+    int slice = get_light_cluster_slice(-position[2], clusters);
+    uint32_t *range = clusters->cluster_ranges[(slice * LIGHT_CLUSTER_COUNT_Y + tile_y) * LIGHT_CLUSTER_COUNT_X + tile_x];
+    for (uint32_t i = 0; i < range[1]; i++)
+    {
+        shade_raster_light(rasterizer, clusters->light_indices[range[0] + i], position, normal, material, color_dst);
+    }
+}
+
+// Rasterizes a tile's bin into the visibility buffer, then shades the tile's pixels into the framebuffer
+void render_raster_tile(void *context, int worker_index, int tile_index)
+{
+    software_rasterizer_t *rasterizer = (software_rasterizer_t *)context;
+    int tile_x = tile_index % rasterizer->tile_count_x;
+    int tile_y = tile_index / rasterizer->tile_count_x;
+    int x_min = tile_x * RASTER_TILE_SIZE, x_max = glm_min(x_min + RASTER_TILE_SIZE, rasterizer->width) - 1;
+    int y_min = tile_y * RASTER_TILE_SIZE, y_max = glm_min(y_min + RASTER_TILE_SIZE, rasterizer->height) - 1;
+
+    // Clears whole blocks, including the padding past the edges of the screen
+    int block_x_max = x_max / RASTER_BLOCK_SIZE * RASTER_BLOCK_SIZE + RASTER_BLOCK_SIZE - 1;
+    int block_y_max = y_max / RASTER_BLOCK_SIZE * RASTER_BLOCK_SIZE + RASTER_BLOCK_SIZE - 1;
+    int block_stride = rasterizer->stride / RASTER_BLOCK_SIZE;
+    for (int y = y_min; y <= block_y_max; y++)
+    {
+        size_t row = (size_t)y * rasterizer->stride;
+        for (int x = x_min; x <= block_x_max; x++)
+        {
+            rasterizer->depths[row + x] = 1.0f;
+            rasterizer->triangle_ids[row + x] = -1;
+        }
+    }
+    for (int y = y_min; y <= block_y_max; y += RASTER_BLOCK_SIZE)
+    {
+        for (int x = x_min; x <= block_x_max; x += RASTER_BLOCK_SIZE)
+        {
+            rasterizer->block_depths[y / RASTER_BLOCK_SIZE * block_stride + x / RASTER_BLOCK_SIZE] = 1.0f;
+        }
+    }
+
+    for (int i = rasterizer->bin_offsets[tile_index]; i < rasterizer->bin_offsets[tile_index + 1]; i++)
+    {
+        rasterize_triangle(rasterizer, rasterizer->bin_triangle_ids[i], x_min, y_min, x_max, y_max);
+    }
+
+    for (int y = y_min; y <= y_max; y++)
+    {
+        for (int x = x_min; x <= x_max; x++)
+        {
+            int32_t triangle_id = rasterizer->triangle_ids[(size_t)y * rasterizer->stride + x];
+            vec3 color = {0.0f, 0.0f, 0.0f};
+            if (triangle_id >= 0)
+            {
+                shade_raster_pixel(rasterizer, rasterizer->triangles[triangle_id], x, y, color);
+            }
+            set_pixel(rasterizer->framebuffer, x, y, color);
+        }
+    }
+}
+
+// Renders the scene into framebuffer, completely and deterministically
+void software_rasterizer_render(software_rasterizer_t *rasterizer, scene_t *scene, framebuffer_t *framebuffer)
+{
+    software_rasterizer_resize(rasterizer, framebuffer->width, framebuffer->height);
+    rasterizer->scene = scene;
+    rasterizer->framebuffer = framebuffer;
+    glm_perspective(45.0f, (float)framebuffer->width / (float)framebuffer->height, Z_NEAR, Z_FAR, rasterizer->projection);
+    glm_look(scene->camera.position, scene->camera.direction, scene->camera.up, rasterizer->view);
+
+    light_clusters_build(&rasterizer->light_clusters, scene->lights, scene->light_count, rasterizer->view, rasterizer->projection);
+    reserve_raster_array((void **)&rasterizer->light_positions, &rasterizer->light_position_capacity, scene->light_count, sizeof(vec4));
+    for (int i = 0; i < scene->light_count; i++)
+    {
+        light_t *light = &scene->lights[i];
+        glm_mat4_mulv3(rasterizer->view, light->position, light->position[3], rasterizer->light_positions[i]);
+        rasterizer->light_positions[i][3] = light->position[3];
+    }
+
+    update_raster_jobs(rasterizer, scene);
+    thread_pool_run(&rasterizer->thread_pool, rasterizer->job_count, process_raster_geometry, rasterizer);
+    bin_raster_triangles(rasterizer);
+    thread_pool_run(&rasterizer->thread_pool, rasterizer->tile_count_x * rasterizer->tile_count_y, render_raster_tile, rasterizer);
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#include "gl-utils.h"
+
+#define GLFW_INCLUDE_NONE
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Images in flight, the GPU reads one while the next ones are written
+#define TEXTURE_STREAM_RING_SIZE 3
+#define TEXTURE_STREAM_SLOT_ALIGNMENT 256
+#define TEXTURE_STREAM_FENCE_TIMEOUT 1000000000ull // nanoseconds
+
+// An RGB8 texture updated with a new image every frame. Images are written into a ring of slots in one pixel buffer object
+// and copied to the texture by the GPU, so uploads neither stall on the previous frame nor copy inside the driver.
+// The buffer stays persistently mapped where the context supports it (GL 4.4 or ARB_buffer_storage), otherwise each slot is
+// mapped unsynchronized, which is safe because the fences already guarantee the GPU is done with it.
+typedef struct
+{
+    GLuint texture;
+    GLuint pixel_buffer;
+    int width;
+    int height;
+    size_t slot_size;
+    bool persistent;
+    unsigned char *mapped_pixels;
+    GLsync fences[TEXTURE_STREAM_RING_SIZE];
+    int next_slot;
+} texture_stream_t;
+
+void texture_stream_create(texture_stream_t *texture_stream, int width, int height)
+{
+    *texture_stream = (texture_stream_t){.width = width, .height = height};
+    size_t image_size = (size_t)width * height * 3;
+    texture_stream->slot_size = (image_size + TEXTURE_STREAM_SLOT_ALIGNMENT - 1) / TEXTURE_STREAM_SLOT_ALIGNMENT * TEXTURE_STREAM_SLOT_ALIGNMENT;
+    GLsizeiptr buffer_size = (GLsizeiptr)(texture_stream->slot_size * TEXTURE_STREAM_RING_SIZE);
+
+    // Immutable storage lets the driver skip the completeness and reallocation checks on every upload
+    glGenTextures(1, &texture_stream->texture);
+    glBindTexture(GL_TEXTURE_2D, texture_stream->texture);
+    gl_tex_storage_2d_proc_t tex_storage_2d = NULL;
+    if (has_gl_feature(4, 2, "GL_ARB_texture_storage"))
+    {
+        tex_storage_2d = (gl_tex_storage_2d_proc_t)glfwGetProcAddress("glTexStorage2D");
+    }
+    if (tex_storage_2d != NULL)
+    {
+        tex_storage_2d(GL_TEXTURE_2D, 1, GL_RGB8, width, height);
+    }
+    else
+    {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glGenBuffers(1, &texture_stream->pixel_buffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, texture_stream->pixel_buffer);
+    gl_buffer_storage_proc_t buffer_storage = NULL;
+    if (has_gl_feature(4, 4, "GL_ARB_buffer_storage"))
+    {
+        buffer_storage = (gl_buffer_storage_proc_t)glfwGetProcAddress("glBufferStorage");
+    }
+    if (buffer_storage != NULL)
+    {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        buffer_storage(GL_PIXEL_UNPACK_BUFFER, buffer_size, NULL, flags);
+        texture_stream->mapped_pixels = (unsigned char *)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, buffer_size, flags);
+        texture_stream->persistent = texture_stream->mapped_pixels != NULL;
+    }
+    if (!texture_stream->persistent)
+    {
+        // A buffer with immutable storage cannot be given mutable storage, start over with a fresh one
+        if (buffer_storage != NULL)
+        {
+            glDeleteBuffers(1, &texture_stream->pixel_buffer);
+            glGenBuffers(1, &texture_stream->pixel_buffer);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, texture_stream->pixel_buffer);
+        }
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, buffer_size, NULL, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void texture_stream_destroy(texture_stream_t *texture_stream)
+{
+    for (int i = 0; i < TEXTURE_STREAM_RING_SIZE; i++)
+    {
+        if (texture_stream->fences[i] != NULL)
+        {
+            glDeleteSync(texture_stream->fences[i]);
+        }
+    }
+    if (texture_stream->persistent)
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, texture_stream->pixel_buffer);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+    glDeleteBuffers(1, &texture_stream->pixel_buffer);
+    glDeleteTextures(1, &texture_stream->texture);
+    *texture_stream = (texture_stream_t){0};
+}
+
+// Copies a tightly packed width x height RGB8 image into the next slot and queues its upload to the texture
+void texture_stream_upload(texture_stream_t *texture_stream, const unsigned char *pixels)
+{
+    int slot = texture_stream->next_slot;
+    texture_stream->next_slot = (slot + 1) % TEXTURE_STREAM_RING_SIZE;
+
+    // Uploaded TEXTURE_STREAM_RING_SIZE frames ago, so the wait almost never blocks
+    GLsync fence = texture_stream->fences[slot];
+    if (fence != NULL)
+    {
+        GLenum status;
+        do
+        {
+            status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, TEXTURE_STREAM_FENCE_TIMEOUT);
+        } while (status == GL_TIMEOUT_EXPIRED);
+        if (status == GL_WAIT_FAILED)
+        {
+            fprintf(stderr, "Error: failed to wait for a texture upload\n");
+            exit(EXIT_FAILURE);
+        }
+        glDeleteSync(fence);
+        texture_stream->fences[slot] = NULL;
+    }
+
+    size_t image_size = (size_t)texture_stream->width * texture_stream->height * 3;
+    GLintptr offset = (GLintptr)(slot * texture_stream->slot_size);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, texture_stream->pixel_buffer);
+    if (texture_stream->persistent)
+    {
+        memcpy(texture_stream->mapped_pixels + offset, pixels, image_size);
+    }
+    else
+    {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+        void *slot_pixels = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, offset, (GLsizeiptr)image_size, flags);
+        if (slot_pixels == NULL)
+        {
+            fprintf(stderr, "Error: failed to map the pixel buffer\n");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(slot_pixels, pixels, image_size);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glBindTexture(GL_TEXTURE_2D, texture_stream->texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, texture_stream->width, texture_stream->height, GL_RGB, GL_UNSIGNED_BYTE, (const void *)offset);
+    texture_stream->fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
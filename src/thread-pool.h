@@ -0,0 +1,241 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <threads.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+// Called once per job index, worker_index identifies the calling thread (0 is the thread that called thread_pool_run)
+typedef void (*thread_pool_job_t)(void *context, int worker_index, int job_index);
+
+// Contiguous range of job indices, the owner pops from the front and thieves take from the back
+typedef struct
+{
+    mtx_t mutex;
+    int begin;
+    int end;
+} job_queue_t;
+
+typedef struct
+{
+    struct thread_pool_t *pool;
+    int index;
+    thrd_t thread;
+} thread_pool_worker_t;
+
+typedef struct thread_pool_t
+{
+    int worker_count;
+    thread_pool_worker_t *workers;
+    job_queue_t *queues;
+
+    mtx_t mutex;
+    cnd_t work_available;
+    cnd_t work_done;
+    unsigned int generation;
+    int busy_worker_count;
+    bool stopping;
+
+    thread_pool_job_t job;
+    void *job_context;
+} thread_pool_t;
+
+int get_processor_count(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO system_info;
+    GetSystemInfo(&system_info);
+    return (int)system_info.dwNumberOfProcessors;
+#else
+    long processor_count = sysconf(_SC_NPROCESSORS_ONLN);
+    return processor_count > 0 ? (int)processor_count : 1;
+#endif
+}
+
+bool job_queue_pop(job_queue_t *queue, int *job_index_dst)
+{
+    mtx_lock(&queue->mutex);
+    bool has_job = queue->begin < queue->end;
+    if (has_job)
+    {
+        *job_index_dst = queue->begin++;
+    }
+    mtx_unlock(&queue->mutex);
+    return has_job;
+}
+
+// Takes the back half of the remaining jobs
+bool job_queue_steal(job_queue_t *queue, int *begin_dst, int *end_dst)
+{
+    mtx_lock(&queue->mutex);
+    int remaining_count = queue->end - queue->begin;
+    bool has_job = remaining_count > 0;
+    if (has_job)
+    {
+        *end_dst = queue->end;
+        queue->end -= (remaining_count + 1) / 2;
+        *begin_dst = queue->end;
+    }
+    mtx_unlock(&queue->mutex);
+    return has_job;
+}
+
+bool thread_pool_steal(thread_pool_t *pool, int worker_index)
+{
+    for (int i = 1; i < pool->worker_count; i++)
+    {
+        job_queue_t *victim = &pool->queues[(worker_index + i) % pool->worker_count];
+
+        int begin, end;
+        if (job_queue_steal(victim, &begin, &end))
+        {
+            job_queue_t *queue = &pool->queues[worker_index];
+            mtx_lock(&queue->mutex);
+            queue->begin = begin;
+            queue->end = end;
+            mtx_unlock(&queue->mutex);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void thread_pool_work(thread_pool_t *pool, int worker_index)
+{
+    // No jobs are added while running, so once every queue is empty all jobs are taken
+    do
+    {
+        int job_index;
+        while (job_queue_pop(&pool->queues[worker_index], &job_index))
+        {
+            pool->job(pool->job_context, worker_index, job_index);
+        }
+    } while (thread_pool_steal(pool, worker_index));
+}
+
+int thread_pool_worker_main(void *arg)
+{
+    thread_pool_worker_t *worker = (thread_pool_worker_t *)arg;
+    thread_pool_t *pool = worker->pool;
+    unsigned int generation = 0;
+
+    mtx_lock(&pool->mutex);
+    for (;;)
+    {
+        while (!pool->stopping && pool->generation == generation)
+        {
+            cnd_wait(&pool->work_available, &pool->mutex);
+        }
+
+        if (pool->stopping)
+        {
+            break;
+        }
+
+        generation = pool->generation;
+        mtx_unlock(&pool->mutex);
+
+        thread_pool_work(pool, worker->index);
+
+        mtx_lock(&pool->mutex);
+        if (--pool->busy_worker_count == 0)
+        {
+            cnd_signal(&pool->work_done);
+        }
+    }
+    mtx_unlock(&pool->mutex);
+
+    return 0;
+}
+
+// worker_count includes the calling thread, so worker_count - 1 threads are started
+void thread_pool_create(thread_pool_t *pool, int worker_count)
+{
+    *pool = (thread_pool_t){0};
+    pool->worker_count = worker_count > 0 ? worker_count : 1;
+    pool->workers = calloc(pool->worker_count, sizeof(thread_pool_worker_t));
+    pool->queues = calloc(pool->worker_count, sizeof(job_queue_t));
+    if (pool->workers == NULL || pool->queues == NULL)
+    {
+        fprintf(stderr, "Error: failed to allocate thread pool\n");
+        exit(EXIT_FAILURE);
+    }
+
+    mtx_init(&pool->mutex, mtx_plain);
+    cnd_init(&pool->work_available);
+    cnd_init(&pool->work_done);
+
+    for (int i = 0; i < pool->worker_count; i++)
+    {
+        mtx_init(&pool->queues[i].mutex, mtx_plain);
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+    }
+
+    for (int i = 1; i < pool->worker_count; i++)
+    {
+        if (thrd_create(&pool->workers[i].thread, thread_pool_worker_main, &pool->workers[i]) != thrd_success)
+        {
+            fprintf(stderr, "Error: failed to start worker thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+// Runs job for every index in [0, job_count) and returns once all of them are finished
+void thread_pool_run(thread_pool_t *pool, int job_count, thread_pool_job_t job, void *context)
+{
+    mtx_lock(&pool->mutex);
+    pool->job = job;
+    pool->job_context = context;
+    for (int i = 0; i < pool->worker_count; i++)
+    {
+        pool->queues[i].begin = (int)((long long)job_count * i / pool->worker_count);
+        pool->queues[i].end = (int)((long long)job_count * (i + 1) / pool->worker_count);
+    }
+    pool->busy_worker_count = pool->worker_count - 1;
+    pool->generation++;
+    cnd_broadcast(&pool->work_available);
+    mtx_unlock(&pool->mutex);
+
+    thread_pool_work(pool, 0);
+
+    mtx_lock(&pool->mutex);
+    while (pool->busy_worker_count > 0)
+    {
+        cnd_wait(&pool->work_done, &pool->mutex);
+    }
+    mtx_unlock(&pool->mutex);
+}
+
+void thread_pool_destroy(thread_pool_t *pool)
+{
+    mtx_lock(&pool->mutex);
+    pool->stopping = true;
+    cnd_broadcast(&pool->work_available);
+    mtx_unlock(&pool->mutex);
+
+    for (int i = 1; i < pool->worker_count; i++)
+    {
+        thrd_join(pool->workers[i].thread, NULL);
+    }
+
+    for (int i = 0; i < pool->worker_count; i++)
+    {
+        mtx_destroy(&pool->queues[i].mutex);
+    }
+    mtx_destroy(&pool->mutex);
+    cnd_destroy(&pool->work_available);
+    cnd_destroy(&pool->work_done);
+
+    free(pool->workers);
+    free(pool->queues);
+    *pool = (thread_pool_t){0};
+}
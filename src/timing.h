@@ -0,0 +1,11 @@
+#pragma once
+
+#include <time.h>
+
+// Wall clock time in seconds
+double get_time(void)
+{
+    struct timespec time;
+    timespec_get(&time, TIME_UTC);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "imaging.h"
+
+#include <stdbool.h>
+#include <string.h>
+#include <threads.h>
+
+// Three images shared by one producer and one consumer thread: the producer draws into one, the newest complete image waits
+// in another and the consumer reads the third, so neither thread ever waits for the other to finish with an image
+typedef struct
+{
+    mtx_t mutex;
+    framebuffer_t framebuffers[3];
+    int drawing;
+    int ready;
+    int presenting;
+    bool has_new_image;
+} triple_buffer_t;
+
+void triple_buffer_create(triple_buffer_t *triple_buffer)
+{
+    *triple_buffer = (triple_buffer_t){.drawing = 0, .ready = 1, .presenting = 2};
+    mtx_init(&triple_buffer->mutex, mtx_plain);
+}
+
+void triple_buffer_destroy(triple_buffer_t *triple_buffer)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        framebuffer_destroy(&triple_buffer->framebuffers[i]);
+    }
+    mtx_destroy(&triple_buffer->mutex);
+}
+
+// Clears all images, neither thread may use the triple buffer meanwhile
+void triple_buffer_resize(triple_buffer_t *triple_buffer, int width, int height)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        framebuffer_resize(&triple_buffer->framebuffers[i], width, height);
+        memset(triple_buffer->framebuffers[i].pixels, 0, (size_t)width * height * 3);
+    }
+    triple_buffer->has_new_image = false;
+}
+
+// Producer side, the image to draw into. It starts out as a copy of the last published one, so drawing can be incremental.
+framebuffer_t *triple_buffer_get_drawing(triple_buffer_t *triple_buffer)
+{
+    return &triple_buffer->framebuffers[triple_buffer->drawing];
+}
+
+void triple_buffer_publish(triple_buffer_t *triple_buffer)
+{
+    mtx_lock(&triple_buffer->mutex);
+    int published = triple_buffer->drawing;
+    triple_buffer->drawing = triple_buffer->ready;
+    triple_buffer->ready = published;
+    triple_buffer->has_new_image = true;
+    mtx_unlock(&triple_buffer->mutex);
+
+    // Only the producer writes images, so the published one stays intact while it is copied even if the consumer takes it
+    framebuffer_t *source = &triple_buffer->framebuffers[published];
+    memcpy(triple_buffer->framebuffers[triple_buffer->drawing].pixels, source->pixels, (size_t)source->width * source->height * 3);
+}
+
+// Consumer side, the newest published image or NULL if there is none since the last call. It stays valid until the next call.
+framebuffer_t *triple_buffer_acquire(triple_buffer_t *triple_buffer)
+{
+    mtx_lock(&triple_buffer->mutex);
+    bool has_new_image = triple_buffer->has_new_image;
+    if (has_new_image)
+    {
+        int ready = triple_buffer->ready;
+        triple_buffer->ready = triple_buffer->presenting;
+        triple_buffer->presenting = ready;
+        triple_buffer->has_new_image = false;
+    }
+    mtx_unlock(&triple_buffer->mutex);
+
+    return has_new_image ? &triple_buffer->framebuffers[triple_buffer->presenting] : NULL;
+}